@@ -0,0 +1,35 @@
+include(../libneuron.pri)
+
+TARGET = neuroncore
+TEMPLATE = lib
+CONFIG += staticlib
+CONFIG -= qt
+
+# Plain C++ without Qt, libneuron adapts it to the Qt signal API
+HEADERS += \
+    modbusmapimage.h \
+    neuronbits.h \
+    neuronboardprofile.h \
+    neurondefines.h \
+    neuronframe.h \
+    neuronregister.h \
+    neuronspidevice.h \
+    neurontransport.h \
+    spscring.h
+
+SOURCES += \
+    modbusmapimage.cpp \
+    neuronbits.cpp \
+    neuronframe.cpp \
+    neuronspidevice.cpp \
+    neurontransport.cpp
+
+target.path = $$[QT_INSTALL_LIBS]
+INSTALLS += target
+
+for(header, HEADERS) {
+    path = $$[QT_INSTALL_PREFIX]/include/libneuron/$${dirname(header)}
+    eval(headers_$${path}.files += $${header})
+    eval(headers_$${path}.path = $${path})
+    eval(INSTALLS *= headers_$${path})
+}
@@ -0,0 +1,293 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "modbusmapimage.h"
+#include "neuronregister.h"
+
+#include <algorithm>
+#include <map>
+#include <string.h>
+
+static const char imageMagic[4] = { 'N', 'M', 'A', 'P' };
+
+ModbusMapImage::ModbusMapImage()
+{
+
+}
+
+bool ModbusMapImage::setData(const uint8_t *data, int64_t size)
+{
+    m_data = nullptr;
+    m_header = nullptr;
+    if (!data || size < (int64_t)sizeof(Header)) {
+        m_errorString = "Modbus map image is too short";
+        return false;
+    }
+
+    const Header *header = (const Header *)data;
+    if (memcmp(header->magic, imageMagic, sizeof(imageMagic)) != 0) {
+        m_errorString = "Modbus map image has an invalid magic";
+        return false;
+    }
+    if (header->version != currentVersion) {
+        m_errorString = "Unsupported modbus map image version";
+        return false;
+    }
+    if (header->imageSize != size ||
+            header->nodeRangesOffset + header->nodeCount * sizeof(NodeRange) > (uint64_t)size ||
+            (uint64_t)header->stringsOffset + header->stringsSize > (uint64_t)size ||
+            header->stringsSize == 0 || data[header->stringsOffset + header->stringsSize - 1] != 0) {
+        m_errorString = "Modbus map image is truncated or corrupted";
+        return false;
+    }
+    for (int type = 0; type < CircuitTypeCount; type++) {
+        if ((uint64_t)header->tableOffset[type] + (uint64_t)header->tableCount[type] * sizeof(Entry) > (uint64_t)size) {
+            m_errorString = "Modbus map image table is out of range";
+            return false;
+        }
+        if ((uint64_t)header->nameIndexOffset[type] + (uint64_t)header->tableCount[type] * sizeof(uint16_t) > (uint64_t)size) {
+            m_errorString = "Modbus map image name index is out of range";
+            return false;
+        }
+        const Entry *table = (const Entry *)(data + header->tableOffset[type]);
+        const uint16_t *nameIndex = (const uint16_t *)(data + header->nameIndexOffset[type]);
+        for (uint32_t i = 0; i < header->tableCount[type]; i++) {
+            if (table[i].nameOffset >= header->stringsSize || nameIndex[i] >= header->tableCount[type]) {
+                m_errorString = "Modbus map image name is out of range";
+                return false;
+            }
+        }
+    }
+
+    m_data = data;
+    m_header = header;
+    m_errorString = "";
+    return true;
+}
+
+bool ModbusMapImage::isValid() const
+{
+    return m_header != nullptr;
+}
+
+int64_t ModbusMapImage::size() const
+{
+    return m_header ? m_header->imageSize : 0;
+}
+
+int ModbusMapImage::nodeCount() const
+{
+    return m_header ? m_header->nodeCount : 0;
+}
+
+ModbusMapImage::NodeRange ModbusMapImage::nodeRange(int subNode) const
+{
+    NodeRange range = {};
+    if (subNode < 1 || subNode > nodeCount()) {
+        return range;
+    }
+    return ((const NodeRange *)(m_data + m_header->nodeRangesOffset))[subNode - 1];
+}
+
+int ModbusMapImage::count(CircuitType type) const
+{
+    return m_header ? m_header->tableCount[type] : 0;
+}
+
+const ModbusMapImage::Entry &ModbusMapImage::entry(CircuitType type, int index) const
+{
+    return ((const Entry *)(m_data + m_header->tableOffset[type]))[index];
+}
+
+const char *ModbusMapImage::name(const Entry &entry) const
+{
+    return (const char *)(m_data + m_header->stringsOffset + entry.nameOffset);
+}
+
+int ModbusMapImage::indexOf(CircuitType type, const char *circuit, int subNode) const
+{
+    if (!m_header) {
+        return -1;
+    }
+
+    // The name index lists the entries sorted by name and sub-node, find the first one of that name
+    const uint16_t *nameIndex = (const uint16_t *)(m_data + m_header->nameIndexOffset[type]);
+    int low = 0;
+    int high = count(type);
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (strcmp(name(entry(type, nameIndex[middle])), circuit) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (int i = low; i < count(type); i++) {
+        const Entry &candidate = entry(type, nameIndex[i]);
+        if (strcmp(name(candidate), circuit) != 0) {
+            break;
+        }
+        if (subNode == 0 || candidate.subNode == subNode) {
+            return nameIndex[i];
+        }
+    }
+    return -1;
+}
+
+bool ModbusMapImage::isCoilType(CircuitType type)
+{
+    return type == CircuitTypeDigitalInput || type == CircuitTypeDigitalOutput ||
+            type == CircuitTypeRelayOutput || type == CircuitTypeUserLED || type == CircuitTypeCoil;
+}
+
+double ModbusMapImage::decode(const Entry &entry, const uint16_t *registers)
+{
+    switch (entry.dataType) {
+    case DataTypeBit:
+    case DataTypeMixedBits:
+        return (registers[0] >> entry.startBit) & 0x01;
+    case DataTypeWord:
+        return RegisterForDataType<DataTypeWord>::Type::decode(registers);
+    case DataTypeDWord:
+        return RegisterForDataType<DataTypeDWord>::Type::decode(registers);
+    case DataTypeReal:
+        return RegisterForDataType<DataTypeReal>::Type::decode(registers);
+    }
+    return 0;
+}
+
+static bool entryLessThan(const ModbusMapImage::Circuit &left, const ModbusMapImage::Circuit &right)
+{
+    if (left.subNode != right.subNode) {
+        return left.subNode < right.subNode;
+    }
+    if (left.address != right.address) {
+        return left.address < right.address;
+    }
+    return left.name < right.name;
+}
+
+std::vector<uint8_t> ModbusMapImage::build(int nodeCount, const std::vector<Circuit> &circuits)
+{
+    // Later definitions of the same circuit on the same sub-node replace earlier ones.
+    // The key sorts by name first, like strcmp on the names, then by sub-node.
+    std::map<std::string, Circuit> circuitsByName[CircuitTypeCount];
+    for (size_t i = 0; i < circuits.size(); i++) {
+        const Circuit &circuit = circuits.at(i);
+        circuitsByName[circuit.type][circuit.name + '\0' + (char)circuit.subNode] = circuit;
+    }
+
+    std::string strings;
+    std::map<std::string, uint32_t> stringOffsets;
+    std::vector<NodeRange> nodeRanges(nodeCount, NodeRange());
+    std::vector<bool> nodeHasCoils(nodeCount, false);
+    std::vector<bool> nodeHasRegisters(nodeCount, false);
+
+    Header header = {};
+    memcpy(header.magic, imageMagic, sizeof(imageMagic));
+    header.version = currentVersion;
+    header.nodeCount = nodeCount;
+    header.nodeRangesOffset = sizeof(Header);
+
+    std::vector<Entry> entries;
+    std::vector<uint16_t> nameIndices;
+    uint32_t offset = header.nodeRangesOffset + nodeCount * sizeof(NodeRange);
+    for (int type = 0; type < CircuitTypeCount; type++) {
+        // Entries are grouped by sub-node and register, so scans walk the table front to back
+        std::vector<Circuit> table;
+        for (std::map<std::string, Circuit>::const_iterator it = circuitsByName[type].begin(); it != circuitsByName[type].end(); ++it) {
+            table.push_back(it->second);
+        }
+        std::sort(table.begin(), table.end(), entryLessThan);
+
+        header.tableOffset[type] = offset;
+        header.tableCount[type] = table.size();
+        std::map<std::string, uint16_t> entryIndices;
+        for (size_t i = 0; i < table.size(); i++) {
+            const Circuit &circuit = table.at(i);
+            if (stringOffsets.find(circuit.name) == stringOffsets.end()) {
+                stringOffsets[circuit.name] = strings.size();
+                strings.append(circuit.name).append(1, '\0');
+            }
+            entryIndices[circuit.name + '\0' + (char)circuit.subNode] = i;
+
+            Entry entry = {};
+            entry.nameOffset = stringOffsets[circuit.name];
+            entry.address = circuit.address;
+            entry.count = circuit.count;
+            entry.subNode = circuit.subNode;
+            entry.permission = circuit.permission;
+            entry.dataType = circuit.dataType;
+            entry.category = circuit.category;
+            entry.registerAddress = circuit.registerAddress;
+            entry.startBit = circuit.startBit;
+            entry.unitZeroAddress = circuit.unitZeroAddress;
+            entries.push_back(entry);
+
+            if (circuit.subNode < 1 || circuit.subNode > nodeCount) {
+                continue;
+            }
+            int node = circuit.subNode - 1;
+            uint16_t last = circuit.address + std::max<int>(circuit.count, 1) - 1;
+            NodeRange &range = nodeRanges[node];
+            if (isCoilType((CircuitType)type)) {
+                range.firstCoil = nodeHasCoils[node] ? std::min(range.firstCoil, circuit.address) : circuit.address;
+                range.lastCoil = nodeHasCoils[node] ? std::max(range.lastCoil, last) : last;
+                nodeHasCoils[node] = true;
+            } else {
+                range.firstRegister = nodeHasRegisters[node] ? std::min(range.firstRegister, circuit.address) : circuit.address;
+                range.lastRegister = nodeHasRegisters[node] ? std::max(range.lastRegister, last) : last;
+                nodeHasRegisters[node] = true;
+            }
+        }
+        offset += table.size() * sizeof(Entry);
+
+        // The map keys are sorted by name
+        for (std::map<std::string, Circuit>::const_iterator it = circuitsByName[type].begin(); it != circuitsByName[type].end(); ++it) {
+            nameIndices.push_back(entryIndices[it->first]);
+        }
+    }
+
+    for (int type = 0; type < CircuitTypeCount; type++) {
+        header.nameIndexOffset[type] = offset;
+        offset += header.tableCount[type] * sizeof(uint16_t);
+    }
+    if (strings.empty()) {
+        strings.append(1, '\0');
+    }
+    header.stringsOffset = offset;
+    header.stringsSize = strings.size();
+    header.imageSize = offset + strings.size();
+
+    std::vector<uint8_t> image;
+    image.reserve(header.imageSize);
+    const uint8_t *bytes = (const uint8_t *)&header;
+    image.insert(image.end(), bytes, bytes + sizeof(Header));
+    bytes = (const uint8_t *)nodeRanges.data();
+    image.insert(image.end(), bytes, bytes + nodeCount * sizeof(NodeRange));
+    bytes = (const uint8_t *)entries.data();
+    image.insert(image.end(), bytes, bytes + entries.size() * sizeof(Entry));
+    bytes = (const uint8_t *)nameIndices.data();
+    image.insert(image.end(), bytes, bytes + nameIndices.size() * sizeof(uint16_t));
+    image.insert(image.end(), strings.begin(), strings.end());
+    return image;
+}
@@ -0,0 +1,163 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MODBUSMAPIMAGE_H
+#define MODBUSMAPIMAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Compiled modbus map of one Neuron model, see libneuron-mapcompiler. Free of any Qt
+ * dependency, ModbusMap loads it and resolves circuits by their Qt names.
+ *
+ * The image is used in place, directly from a memory mapped file or from a
+ * buffer built from the CSV files. All values are little endian.
+ *
+ *   Header
+ *   NodeRange[nodeCount]            register and coil range of each sub-node
+ *   Entry[]                         one table per circuit type, grouped by sub-node and sorted by address
+ *   uint16_t[]                      one name index per circuit type, entry indices sorted by name and sub-node
+ *   String table                    zero terminated circuit names, interned
+ *
+ * The digital, relay, LED and analog tables hold the basic circuits named by
+ * their number, e.g. "2.3". The coil and register tables hold every coil and
+ * register of the map named by their full content, e.g. "Counter of Digital
+ * Input 2.3", so the same name exists once per sub-node.
+ */
+class ModbusMapImage
+{
+public:
+    enum CircuitType {
+        CircuitTypeDigitalInput,
+        CircuitTypeDigitalOutput,
+        CircuitTypeRelayOutput,
+        CircuitTypeUserLED,
+        CircuitTypeAnalogInput,
+        CircuitTypeAnalogOutput,
+        CircuitTypeCoil,
+        CircuitTypeRegister,
+        CircuitTypeCount
+    };
+
+    enum DataType {
+        DataTypeBit,
+        DataTypeMixedBits,
+        DataTypeWord,
+        DataTypeDWord,
+        DataTypeReal
+    };
+
+    enum Category {
+        CategoryBasic,
+        CategoryAdvanced,
+        CategoryExpert,
+        CategoryObsolete,
+        CategoryReserved
+    };
+
+    typedef struct {
+        char magic[4];
+        uint16_t version;
+        uint16_t nodeCount;
+        uint32_t imageSize;
+        uint32_t nodeRangesOffset;
+        uint32_t stringsOffset;
+        uint32_t stringsSize;
+        uint32_t tableOffset[CircuitTypeCount];
+        uint32_t tableCount[CircuitTypeCount];
+        uint32_t nameIndexOffset[CircuitTypeCount];
+    } __attribute__((packed)) Header;
+
+    // Bit circuits are addressed by their coil, registerAddress and startBit locate the
+    // same bit within a MixedBits register word. For registers both addresses are equal.
+    // unitZeroAddress is the address of the "Via Unit 0" column, which addresses the
+    // sub-nodes of a model in one range.
+    typedef struct {
+        uint32_t nameOffset;
+        uint16_t address;
+        uint16_t count;
+        uint8_t subNode;
+        uint8_t permission;
+        uint8_t dataType;
+        uint8_t category;
+        uint16_t registerAddress;
+        uint8_t startBit;
+        uint8_t reserved;
+        uint16_t unitZeroAddress;
+    } __attribute__((packed)) Entry;
+
+    typedef struct {
+        uint16_t firstCoil;
+        uint16_t lastCoil;
+        uint16_t firstRegister;
+        uint16_t lastRegister;
+    } __attribute__((packed)) NodeRange;
+
+    struct Circuit {
+        std::string name; // Latin-1
+        CircuitType type;
+        uint8_t subNode;
+        uint16_t address;
+        uint16_t count;
+        uint8_t permission;
+        DataType dataType = DataTypeWord;
+        Category category = CategoryBasic;
+        uint16_t registerAddress = 0;
+        uint8_t startBit = 0;
+        uint16_t unitZeroAddress = 0;
+    };
+
+    static const uint16_t currentVersion = 4;
+
+    ModbusMapImage();
+
+    // The data must stay valid as long as the image is used
+    bool setData(const uint8_t *data, int64_t size);
+    bool isValid() const;
+    // Why setData() rejected the data
+    const char *errorString() const { return m_errorString; }
+    const uint8_t *data() const { return m_data; }
+    int64_t size() const;
+
+    int nodeCount() const;
+    NodeRange nodeRange(int subNode) const;
+
+    int count(CircuitType type) const;
+    const Entry &entry(CircuitType type, int index) const;
+    const char *name(const Entry &entry) const;
+    // With subNode 0 the first sub-node defining the circuit is returned
+    int indexOf(CircuitType type, const char *circuit, int subNode = 0) const;
+
+    static bool isCoilType(CircuitType type);
+    // Decodes the value of an entry from the register words starting at its registerAddress
+    static double decode(const Entry &entry, const uint16_t *registers);
+    static std::vector<uint8_t> build(int nodeCount, const std::vector<Circuit> &circuits);
+
+private:
+    const uint8_t *m_data = nullptr;
+    const Header *m_header = nullptr;
+    const char *m_errorString = "";
+};
+
+#endif // MODBUSMAPIMAGE_H
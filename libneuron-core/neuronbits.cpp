@@ -0,0 +1,129 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronbits.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NEURONBITS_NEON
+#endif
+
+static const uint8_t bitMask[16] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                                   0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+
+void NeuronBits::unpack(const uint16_t *words, int count, uint8_t *bits)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i mask = _mm_loadu_si128((const __m128i *)bitMask);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= count; i += 16) {
+        // Spread the low byte of the word over lanes 0-7 and the high byte over lanes 8-15
+        __m128i value = _mm_cvtsi32_si128(words[i >> 4]);
+        value = _mm_unpacklo_epi8(value, value);
+        value = _mm_unpacklo_epi16(value, value);
+        value = _mm_unpacklo_epi32(value, value);
+        value = _mm_cmpeq_epi8(_mm_and_si128(value, mask), mask);
+        _mm_storeu_si128((__m128i *)(bits + i), _mm_and_si128(value, one));
+    }
+#elif defined(NEURONBITS_NEON)
+    const uint8x16_t mask = vld1q_u8(bitMask);
+    const uint8x16_t one = vdupq_n_u8(1);
+    for (; i + 16 <= count; i += 16) {
+        uint16_t word = words[i >> 4];
+        uint8x16_t value = vcombine_u8(vdup_n_u8(word & 0xff), vdup_n_u8(word >> 8));
+        vst1q_u8(bits + i, vandq_u8(vtstq_u8(value, mask), one));
+    }
+#endif
+    for (; i < count; i++) {
+        bits[i] = (words[i >> 4] >> (i & 0x0f)) & 0x01;
+    }
+}
+
+void NeuronBits::pack(const uint8_t *bits, int count, uint16_t *words)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i *)(bits + i));
+        words[i >> 4] = ~_mm_movemask_epi8(_mm_cmpeq_epi8(value, zero)) & 0xffff;
+    }
+#elif defined(NEURONBITS_NEON)
+    const uint8x16_t mask = vld1q_u8(bitMask);
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t value = vld1q_u8(bits + i);
+        value = vandq_u8(vtstq_u8(value, value), mask);
+        // Pairwise adds sum the eight lanes of each half into one byte
+        uint8x8_t sum = vpadd_u8(vget_low_u8(value), vget_high_u8(value));
+        sum = vpadd_u8(sum, sum);
+        sum = vpadd_u8(sum, sum);
+        words[i >> 4] = vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+    }
+#endif
+    if (i < count) {
+        memset(words + (i >> 4), 0, (wordCount(count) - (i >> 4)) * sizeof(uint16_t));
+    }
+    for (; i < count; i++) {
+        if (bits[i]) {
+            words[i >> 4] |= (1 << (i & 0x0f));
+        }
+    }
+}
+
+bool NeuronBits::edges(const uint16_t *previous, const uint16_t *current, int wordCount, uint16_t *rising, uint16_t *falling)
+{
+    int i = 0;
+    uint16_t changed = 0;
+#if defined(__SSE2__)
+    __m128i anyChanged = _mm_setzero_si128();
+    for (; i + 8 <= wordCount; i += 8) {
+        __m128i before = _mm_loadu_si128((const __m128i *)(previous + i));
+        __m128i after = _mm_loadu_si128((const __m128i *)(current + i));
+        _mm_storeu_si128((__m128i *)(rising + i), _mm_andnot_si128(before, after));
+        _mm_storeu_si128((__m128i *)(falling + i), _mm_andnot_si128(after, before));
+        anyChanged = _mm_or_si128(anyChanged, _mm_xor_si128(before, after));
+    }
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(anyChanged, _mm_setzero_si128())) != 0xffff;
+#elif defined(NEURONBITS_NEON)
+    uint16x8_t anyChanged = vdupq_n_u16(0);
+    for (; i + 8 <= wordCount; i += 8) {
+        uint16x8_t before = vld1q_u16(previous + i);
+        uint16x8_t after = vld1q_u16(current + i);
+        vst1q_u16(rising + i, vbicq_u16(after, before));
+        vst1q_u16(falling + i, vbicq_u16(before, after));
+        anyChanged = vorrq_u16(anyChanged, veorq_u16(before, after));
+    }
+    uint16x4_t folded = vorr_u16(vget_low_u16(anyChanged), vget_high_u16(anyChanged));
+    changed = vget_lane_u16(folded, 0) | vget_lane_u16(folded, 1) | vget_lane_u16(folded, 2) | vget_lane_u16(folded, 3);
+#endif
+    for (; i < wordCount; i++) {
+        rising[i] = ~previous[i] & current[i];
+        falling[i] = previous[i] & ~current[i];
+        changed |= previous[i] ^ current[i];
+    }
+    return changed != 0;
+}
@@ -0,0 +1,46 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONBITS_H
+#define NEURONBITS_H
+
+#include <stdint.h>
+
+// Bulk conversion between packed bits and one byte per circuit.
+//
+// Bit n of a packed buffer is bit (n % 16) of word n / 16, the layout of the
+// MixedBits registers and of the ReadBit/WriteBits payload. Unpacked values are
+// 0 or 1, any non zero byte packs as 1. Uses SSE2 or NEON where available.
+class NeuronBits
+{
+public:
+    static void unpack(const uint16_t *words, int count, uint8_t *bits);
+    static void pack(const uint8_t *bits, int count, uint16_t *words);
+
+    // Rising and falling edges of the packed words against the previous scan,
+    // returns false if no bit changed
+    static bool edges(const uint16_t *previous, const uint16_t *current, int wordCount, uint16_t *rising, uint16_t *falling);
+
+    static int wordCount(int bitCount) { return (bitCount + 15) >> 4; }
+};
+
+#endif // NEURONBITS_H
@@ -0,0 +1,131 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef NEURONBOARDPROFILE_H
+#define NEURONBOARDPROFILE_H
+
+#include <stdint.h>
+
+// Static description of the Neuron models, taken from the modbus maps.
+//
+// Every model is a base board with up to two extension groups, each group is one
+// sub-node on its own chip select. The tables are constexpr, so a model chosen at
+// compile time through NeuronBoard<> compiles down to constants. The runtime lookup
+// by name is used by the dynamic detection.
+
+struct NeuronNodeWiring {
+    const char *devicePath;
+    int gpio; // Interrupt line of the sub-node
+};
+
+struct NeuronNodeProfile {
+    uint8_t digitalInputs;
+    uint8_t digitalOutputs;
+    uint8_t relayOutputs;
+    uint8_t userLeds;
+    uint8_t analogInputs;
+    uint8_t analogOutputs;
+    uint16_t basicRegisters; // Registers 0 to basicRegisters - 1 hold the basic circuits
+    int speed; // Highest SPI clock of the group in Hz
+};
+
+struct NeuronBoardProfile {
+    const char *model;
+    int nodeCount;
+    NeuronNodeProfile nodes[3];
+};
+
+namespace NeuronBoardProfiles {
+
+static const int maxNodes = 3;
+
+constexpr NeuronNodeWiring wiring[maxNodes] = {
+    {"/dev/spidev0.1", 27},
+    {"/dev/spidev0.3", 23},
+    {"/dev/spidev0.2", 22}
+};
+
+// E-4Ai4Ao* boards use a digital isolator on the SPI bus, they are limited to 8 MHz
+constexpr NeuronNodeProfile base = {4, 4, 0, 4, 0, 0, 505, 12000000};
+constexpr NeuronNodeProfile di8ro8 = {8, 0, 8, 0, 0, 0, 19, 12000000};
+constexpr NeuronNodeProfile di16ro14 = {16, 0, 14, 0, 0, 0, 35, 12000000};
+constexpr NeuronNodeProfile di14ro14 = {14, 0, 14, 0, 0, 0, 31, 12000000};
+constexpr NeuronNodeProfile di30 = {30, 0, 0, 0, 0, 0, 63, 12000000};
+constexpr NeuronNodeProfile ro28 = {0, 0, 28, 0, 0, 0, 2, 12000000};
+constexpr NeuronNodeProfile ai4ao4di6ro5 = {6, 0, 5, 0, 4, 4, 505, 8000000};
+constexpr NeuronNodeProfile ai4ao4di4ro5 = {4, 0, 5, 0, 4, 4, 505, 8000000};
+constexpr NeuronNodeProfile light = {0, 0, 0, 0, 0, 0, 21, 12000000};
+
+constexpr NeuronBoardProfile profiles[] = {
+    {"S103", 1, {base, {}, {}}},
+    {"M103", 2, {base, di8ro8, {}}},
+    {"M203", 2, {base, di16ro14, {}}},
+    {"M303", 2, {base, di30, {}}},
+    {"M403", 2, {base, ro28, {}}},
+    {"M503", 2, {base, ai4ao4di6ro5, {}}},
+    {"M523", 2, {base, ai4ao4di4ro5, {}}},
+    {"M603", 2, {base, light, {}}},
+    {"L203", 3, {base, di16ro14, di16ro14}},
+    {"L303", 3, {base, di30, di30}},
+    {"L403", 3, {base, ro28, ro28}},
+    {"L503", 3, {base, ai4ao4di6ro5, di14ro14}},
+    {"L513", 3, {base, ai4ao4di6ro5, ai4ao4di6ro5}},
+    {"L523", 3, {base, ai4ao4di4ro5, di16ro14}},
+    {"L533", 3, {base, ai4ao4di4ro5, ai4ao4di4ro5}}
+};
+
+constexpr int profileCount = sizeof(profiles) / sizeof(profiles[0]);
+
+constexpr bool equal(const char *a, const char *b)
+{
+    return *a == *b && (*a == '\0' || equal(a + 1, b + 1));
+}
+
+// Index of the model in profiles, -1 if it is unknown
+constexpr int indexOf(const char *model, int index = 0)
+{
+    return index >= profileCount ? -1 : (equal(profiles[index].model, model) ? index : indexOf(model, index + 1));
+}
+
+// Returns nullptr for unknown models
+inline const NeuronBoardProfile *find(const char *model)
+{
+    int index = indexOf(model);
+    return index < 0 ? nullptr : &profiles[index];
+}
+
+}
+
+// Model chosen at compile time, e.g. NeuronBoard<NeuronBoardProfiles::indexOf("M503")>
+template<int Index>
+struct NeuronBoard
+{
+    static_assert(Index >= 0 && Index < NeuronBoardProfiles::profileCount, "Unknown Neuron model");
+
+    static constexpr const char *model() { return NeuronBoardProfiles::profiles[Index].model; }
+    static constexpr int nodeCount() { return NeuronBoardProfiles::profiles[Index].nodeCount; }
+    static constexpr const NeuronNodeProfile &node(int node) { return NeuronBoardProfiles::profiles[Index].nodes[node]; }
+    static constexpr const char *devicePath(int node) { return NeuronBoardProfiles::wiring[node].devicePath; }
+    static constexpr int gpio(int node) { return NeuronBoardProfiles::wiring[node].gpio; }
+    static constexpr int speed(int node) { return NeuronBoardProfiles::profiles[Index].nodes[node].speed; }
+};
+
+#endif // NEURONBOARDPROFILE_H
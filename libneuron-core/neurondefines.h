@@ -14,4 +14,12 @@ enum FunctionCode {
     Idle = 0xfa //Non modbus conform
 };
 
+enum SpiError {
+    NoError,
+    TimeoutError,
+    ProtocolError,
+    CrcError,
+    UnknownError
+};
+
 #endif // NEURONDEFINES_H
@@ -0,0 +1,227 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "neuronframe.h"
+
+#include <string.h>
+
+static const uint16_t crcTable[] = {
+    0,  1408,  3968,  2560,  7040,  7680,  5120,  4480, 13184, 13824, 15360,
+    14720, 10240, 11648, 10112,  8704, 25472, 26112, 27648, 27008, 30720, 32128,
+    30592, 29184, 20480, 21888, 24448, 23040, 19328, 19968, 17408, 16768, 50048,
+    50688, 52224, 51584, 55296, 56704, 55168, 53760, 61440, 62848, 65408, 64000,
+    60288, 60928, 58368, 57728, 40960, 42368, 44928, 43520, 48000, 48640, 46080,
+    45440, 37760, 38400, 39936, 39296, 34816, 36224, 34688, 33280, 33665, 34305,
+    35841, 35201, 38913, 40321, 38785, 37377, 45057, 46465, 49025, 47617, 43905,
+    44545, 41985, 41345, 57345, 58753, 61313, 59905, 64385, 65025, 62465, 61825,
+    54145, 54785, 56321, 55681, 51201, 52609, 51073, 49665, 16385, 17793, 20353,
+    18945, 23425, 24065, 21505, 20865, 29569, 30209, 31745, 31105, 26625, 28033,
+    26497, 25089,  9089,  9729, 11265, 10625, 14337, 15745, 14209, 12801,  4097,
+    5505,  8065,  6657,  2945,  3585,  1025,   385,   899,  1539,  3075,  2435,
+    6147,  7555,  6019,  4611, 12291, 13699, 16259, 14851, 11139, 11779,  9219,
+    8579, 24579, 25987, 28547, 27139, 31619, 32259, 29699, 29059, 21379, 22019,
+    23555, 22915, 18435, 19843, 18307, 16899, 49155, 50563, 53123, 51715, 56195,
+    56835, 54275, 53635, 62339, 62979, 64515, 63875, 59395, 60803, 59267, 57859,
+    41859, 42499, 44035, 43395, 47107, 48515, 46979, 45571, 36867, 38275, 40835,
+    39427, 35715, 36355, 33795, 33155, 32770, 34178, 36738, 35330, 39810, 40450,
+    37890, 37250, 45954, 46594, 48130, 47490, 43010, 44418, 42882, 41474, 58242,
+    58882, 60418, 59778, 63490, 64898, 63362, 61954, 53250, 54658, 57218, 55810,
+    52098, 52738, 50178, 49538, 17282, 17922, 19458, 18818, 22530, 23938, 22402,
+    20994, 28674, 30082, 32642, 31234, 27522, 28162, 25602, 24962,  8194,  9602,
+    12162, 10754, 15234, 15874, 13314, 12674,  4994,  5634,  7170,  6530,  2050,
+    3458,  1922,   514
+};
+
+NeuronFrame::NeuronFrame() :
+    NeuronFrame(FunctionCode::Idle, 0x0e55, 0)
+{
+
+}
+
+NeuronFrame::NeuronFrame(FunctionCode functionCode, uint16_t address, uint8_t length, const void *payload, int payloadSize) :
+    m_functionCode(functionCode),
+    m_address(address),
+    m_length(length)
+{
+    int payloadBytes = payloadLength(functionCode, length);
+    uint16_t len2 = 0;
+    if (payloadBytes >= 0) {
+        len2 = m_sizeOfCommunicationHeader + payloadBytes;
+        uint16_t trLen2 = ((len2 + 1) & 0xfffe); // transaction length must be even
+        m_secondPhaseLength = trLen2 + 2;
+    }
+    m_tx.assign(m_sizeOfNeuronSpiMessage + m_secondPhaseLength, 0);
+
+    NeuronSpiMessage *tx1 = (NeuronSpiMessage *)m_tx.data();
+    tx1->op = m_functionCode;
+    tx1->reg = m_address;
+    tx1->len = isOnePhaseOperation() ? length : (len2 > 255 ? 0 : len2);
+    tx1->crc = crc(m_tx.data(), m_sizeOfCommunicationHeader, 0);
+    if (isOnePhaseOperation()) {
+        return;
+    }
+
+    uint8_t *tx2 = m_tx.data() + m_sizeOfNeuronSpiMessage;
+    NeuronSpiMessage *header = (NeuronSpiMessage *)tx2;
+    header->op = m_functionCode;
+    header->len = m_length;
+    header->reg = m_address;
+    if (payload && payloadSize > 0) {
+        memmove(tx2 + m_sizeOfCommunicationHeader, payload, payloadSize < payloadBytes ? payloadSize : payloadBytes);
+    }
+
+    int trLen2 = m_secondPhaseLength - 2;
+    ((uint16_t *)tx2)[trLen2 >> 1] = crc(tx2, trLen2, tx1->crc);
+}
+
+const uint16_t *NeuronFrame::payloadData() const
+{
+    if (isOnePhaseOperation()) {
+        return nullptr;
+    }
+    return (const uint16_t *)(m_tx.data() + m_sizeOfNeuronSpiMessage + m_sizeOfCommunicationHeader);
+}
+
+bool NeuronFrame::checkRxCrc(const uint8_t *rx) const
+{
+    uint16_t checksum = crc(rx, m_sizeOfCommunicationHeader, 0);
+    if (checksum != ((const NeuronSpiMessage *)rx)->crc) {
+        return false;
+    }
+    if (isOnePhaseOperation()) {
+        return true;
+    }
+
+    // The CRC of the second phase continues the CRC of the first phase
+    int trLen2 = m_secondPhaseLength - 2;
+    const uint8_t *rx2 = rx + m_sizeOfNeuronSpiMessage;
+    checksum = crc(rx2, trLen2, checksum);
+    return ((const uint16_t *)rx2)[trLen2 >> 1] == checksum;
+}
+
+bool NeuronFrame::checkRxHeader(const uint8_t *rx) const
+{
+    // Unexpected first phases of one phase operations are tolerated, the board may lag behind
+    if (isOnePhaseOperation()) {
+        return true;
+    }
+    if (!isIdleReply(rx)) {
+        return false;
+    }
+
+    const NeuronSpiMessage *rx2 = (const NeuronSpiMessage *)(rx + m_sizeOfNeuronSpiMessage);
+    if (rx2->op != m_functionCode) {
+        return false;
+    }
+    switch (m_functionCode) {
+    case FunctionCode::ReadRegister:
+        return rx2->len <= m_length && rx2->reg == m_address;
+    case FunctionCode::ReadBit:
+        return rx2->reg == m_address;
+    case FunctionCode::ReadString:
+        return rx2->len <= m_length;
+    default:
+        return true;
+    }
+}
+
+int NeuronFrame::resultCount(const uint8_t *rx) const
+{
+    const NeuronSpiMessage *rx2 = (const NeuronSpiMessage *)(rx + m_sizeOfNeuronSpiMessage);
+    int count = rx2->len < m_length ? rx2->len : m_length;
+    if (m_functionCode == FunctionCode::ReadRegister) {
+        return count;
+    } else if (m_functionCode == FunctionCode::ReadBit) {
+        return (count + 15) >> 4; // Bits are packed into 16 bit words
+    }
+    return 0;
+}
+
+const uint16_t *NeuronFrame::resultData(const uint8_t *rx) const
+{
+    return (const uint16_t *)(rx + m_sizeOfNeuronSpiMessage + m_sizeOfCommunicationHeader);
+}
+
+int NeuronFrame::characterCount(const uint8_t *rx) const
+{
+    if (m_functionCode != FunctionCode::ReadString) {
+        return 0;
+    }
+    const NeuronSpiMessage *rx2 = (const NeuronSpiMessage *)(rx + m_sizeOfNeuronSpiMessage);
+    return rx2->len < m_length ? rx2->len : m_length;
+}
+
+const char *NeuronFrame::characterData(const uint8_t *rx) const
+{
+    return (const char *)(rx + m_sizeOfNeuronSpiMessage + m_sizeOfCommunicationHeader);
+}
+
+bool NeuronFrame::isIdleReply(const uint8_t *rx)
+{
+    uint32_t firstWord;
+    memcpy(&firstWord, rx, sizeof(firstWord));
+    return (firstWord & 0xffff00ff) == m_idlePattern || rx[0] == FunctionCode::WriteCharacter;
+}
+
+int NeuronFrame::piggybackedCharacter(const uint8_t *rx)
+{
+    // First phase of the reply: WriteCharacter, characters left on the board, unused, the character
+    if (rx[0] != FunctionCode::WriteCharacter) {
+        return -1;
+    }
+    return rx[3];
+}
+
+int NeuronFrame::idleStatus(const uint8_t *rx)
+{
+    uint32_t firstWord;
+    memcpy(&firstWord, rx, sizeof(firstWord));
+    if ((firstWord & 0xffff00ff) != m_idlePattern) {
+        return -1;
+    }
+    return rx[1];
+}
+
+uint16_t NeuronFrame::crc(const uint8_t *data, int length, uint16_t initial)
+{
+    uint16_t result = initial;
+    for (int i = 0; i < length; i++) {
+        result = (result >> 8) ^ crcTable[(result ^ data[i]) & 0xff];
+    }
+    return result;
+}
+
+int NeuronFrame::payloadLength(FunctionCode functionCode, uint8_t length)
+{
+    switch (functionCode) {
+    case FunctionCode::ReadBit:
+    case FunctionCode::WriteBits:
+        return ((length + 15) >> 4) << 1; // trunc to 16bit in bytes
+    case FunctionCode::ReadRegister:
+    case FunctionCode::WriteRegister:
+        return length * sizeof(uint16_t);
+    case FunctionCode::WriteString:
+    case FunctionCode::ReadString:
+        return length;
+    default:
+        return -1; // One phase operation
+    }
+}
@@ -0,0 +1,108 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef NEURONFRAME_H
+#define NEURONFRAME_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "neurondefines.h"
+
+/*
+ * Frame of the Neuron SPI protocol, free of any Qt dependency.
+ *
+ * First phase, 6 bytes:
+ *   Function
+ *   Length, or the value for one phase operations
+ *   Register Lo
+ *   Register Hi
+ *   Error Check Lo
+ *   Error Check Hi
+ *
+ * Second phase, only for two phase operations:
+ *   Function, length and register header (4 bytes)
+ *   Payload, padded to an even length
+ *   Error Check Lo, Hi continuing the CRC of the first phase
+ */
+class NeuronFrame
+{
+public:
+    // Receive buffers must hold this many bytes
+    static const int maxFrameLength = 256 + 2 + 40;
+
+    // Idle frame
+    NeuronFrame();
+    // For one phase operations length is the value sent in the first phase. The payload holds
+    // the registers, packed bits or characters of write operations.
+    NeuronFrame(FunctionCode functionCode, uint16_t address, uint8_t length, const void *payload = nullptr, int payloadSize = 0);
+
+    FunctionCode functionCode() const { return m_functionCode; }
+    uint16_t address() const { return m_address; }
+    uint8_t length() const { return m_length; }
+
+    bool isOnePhaseOperation() const { return m_secondPhaseLength == 0; }
+    // Total number of bytes on the bus, first phase plus the second phase including its CRC
+    int messageLength() const { return static_cast<int>(m_tx.size()); }
+    int secondPhaseLength() const { return m_secondPhaseLength; }
+    const uint8_t *txData() const { return m_tx.data(); }
+    // Registers or packed bits written by a two phase operation, nullptr for one phase operations
+    const uint16_t *payloadData() const;
+
+    bool checkRxCrc(const uint8_t *rx) const;
+    bool checkRxHeader(const uint8_t *rx) const;
+    // Registers of a ReadRegister reply or packed words of a ReadBit reply, within the receive buffer
+    int resultCount(const uint8_t *rx) const;
+    const uint16_t *resultData(const uint8_t *rx) const;
+    // Characters of a ReadString reply, within the receive buffer
+    int characterCount(const uint8_t *rx) const;
+    const char *characterData(const uint8_t *rx) const;
+
+    // The board answers the first phase with the idle pattern or a piggybacked UART character
+    static bool isIdleReply(const uint8_t *rx);
+    // Any reply may carry one received UART character in its first phase, returns -1 if there is none
+    static int piggybackedCharacter(const uint8_t *rx);
+    // Status flags in the length byte of an idle reply, the events enabled in the interrupt mask
+    // register of the board like changed inputs. Returns -1 if the first phase is no idle reply.
+    static int idleStatus(const uint8_t *rx);
+    static uint16_t crc(const uint8_t *data, int length, uint16_t initial);
+    // Payload bytes of the second phase, -1 for one phase operations
+    static int payloadLength(FunctionCode functionCode, uint8_t length);
+
+private:
+    typedef struct {
+        uint8_t op;
+        uint8_t len;
+        uint16_t reg;
+        uint16_t crc;
+    } __attribute__((packed)) NeuronSpiMessage;
+    static const int m_sizeOfNeuronSpiMessage = 6;
+    static const int m_sizeOfCommunicationHeader = 4;
+    static const uint32_t m_idlePattern = 0x0e5500fa;
+
+    FunctionCode m_functionCode = FunctionCode::Idle;
+    uint16_t m_address = 0x0e55;
+    uint8_t m_length = 0;
+    int m_secondPhaseLength = 0; // Even payload length plus 2 bytes CRC, 0 for one phase operations
+    std::vector<uint8_t> m_tx;
+};
+
+#endif // NEURONFRAME_H
@@ -0,0 +1,128 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONREGISTER_H
+#define NEURONREGISTER_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+#include <type_traits>
+
+#include "modbusmapimage.h"
+
+// Order of the 16 bit words of a 32 bit value. Counters (DWord) are stored
+// low word first, floating point values (Real) high word first.
+enum WordOrder {
+    LittleEndianWords,
+    BigEndianWords
+};
+
+// Encoding of a value stored in one or two consecutive registers, resolved at compile time
+template<typename T, WordOrder order = LittleEndianWords>
+struct Register
+{
+    static_assert(sizeof(T) == 2 || sizeof(T) == 4, "Registers hold 16 or 32 bit values");
+    typedef T ValueType;
+    typedef typename std::conditional<sizeof(T) == 2, uint16_t, uint32_t>::type RawType;
+    static const int wordCount = sizeof(T) / 2;
+
+    static T decode(const uint16_t *words)
+    {
+        RawType raw;
+        if (wordCount == 1) {
+            raw = words[0];
+        } else if (order == LittleEndianWords) {
+            raw = (RawType)((uint32_t)words[0] | ((uint32_t)words[1] << 16));
+        } else {
+            raw = (RawType)(((uint32_t)words[0] << 16) | (uint32_t)words[1]);
+        }
+        T value;
+        memcpy(&value, &raw, sizeof(T));
+        return value;
+    }
+
+    static void encode(T value, uint16_t *words)
+    {
+        RawType raw;
+        memcpy(&raw, &value, sizeof(T));
+        uint32_t bits = raw;
+        if (wordCount == 1) {
+            words[0] = bits;
+        } else if (order == LittleEndianWords) {
+            words[0] = bits & 0xffff;
+            words[1] = bits >> 16;
+        } else {
+            words[0] = bits >> 16;
+            words[1] = bits & 0xffff;
+        }
+    }
+};
+
+// Fixed point register, the engineering value is raw * numerator / denominator,
+// e.g. ScaledRegister<uint16_t, 10, 4000> for "0..4000 ~ 0..10V"
+template<typename T, int numerator, int denominator, WordOrder order = LittleEndianWords>
+struct ScaledRegister
+{
+    typedef double ValueType;
+    static const int wordCount = Register<T, order>::wordCount;
+
+    static double decode(const uint16_t *words)
+    {
+        return Register<T, order>::decode(words) * ((double)numerator / denominator);
+    }
+
+    static void encode(double value, uint16_t *words)
+    {
+        // Round to the nearest raw value within the range of the register
+        double raw = value * ((double)denominator / numerator);
+        raw = std::min<double>(std::max<double>(raw, std::numeric_limits<T>::min()), std::numeric_limits<T>::max());
+        Register<T, order>::encode((T)std::llround(raw), words);
+    }
+};
+
+// Register encoding of a modbus map data type
+template<ModbusMapImage::DataType dataType> struct RegisterForDataType;
+template<> struct RegisterForDataType<ModbusMapImage::DataTypeWord> { typedef Register<uint16_t> Type; };
+template<> struct RegisterForDataType<ModbusMapImage::DataTypeDWord> { typedef Register<uint32_t, LittleEndianWords> Type; };
+template<> struct RegisterForDataType<ModbusMapImage::DataTypeReal> { typedef Register<float, BigEndianWords> Type; };
+
+// Converts count values stored back to back, e.g. a whole analog group of the process image
+template<typename R, typename V>
+inline void decodeRegisters(const uint16_t *words, int count, V *values)
+{
+    for (int i = 0; i < count; i++) {
+        values[i] = R::decode(words + i * R::wordCount);
+    }
+}
+
+template<typename R, typename V>
+inline void encodeRegisters(const V *values, int count, uint16_t *words)
+{
+    for (int i = 0; i < count; i++) {
+        R::encode(values[i], words + i * R::wordCount);
+    }
+}
+
+#endif // NEURONREGISTER_H
@@ -0,0 +1,127 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "neuronspidevice.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+NeuronSpiDevice::NeuronSpiDevice()
+{
+
+}
+
+NeuronSpiDevice::~NeuronSpiDevice()
+{
+    close();
+}
+
+bool NeuronSpiDevice::open(const char *path)
+{
+    close();
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    return m_fd >= 0;
+}
+
+void NeuronSpiDevice::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool NeuronSpiDevice::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+int NeuronSpiDevice::handle() const
+{
+    return m_fd;
+}
+
+bool NeuronSpiDevice::setSpeed(int speed)
+{
+    return ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) >= 0;
+}
+
+SpiError NeuronSpiDevice::transfer(const NeuronFrame &frame, uint8_t *rx)
+{
+    spi_ioc_transfer spiTransfer[7];
+    memset(spiTransfer, 0, sizeof(spiTransfer));
+    spiTransfer[0].delay_usecs = m_nssDefaultPause; // starting pause between NSS and SCLK
+    spiTransfer[1].tx_buf = (unsigned long) frame.txData();
+    spiTransfer[1].rx_buf = (unsigned long) rx;
+
+    int messageCount = 2;
+    if (frame.isOnePhaseOperation()) {
+        spiTransfer[1].len = frame.messageLength();
+    } else {
+        spiTransfer[1].len = 6;
+        // Splitting data up to fit into SPI messages
+        int total = frame.secondPhaseLength();
+        while (total > 0 && messageCount < 7) {
+            spiTransfer[messageCount].tx_buf = (unsigned long)frame.txData() + 6 + (m_maxSpiRx * (messageCount - 2));
+            spiTransfer[messageCount].rx_buf = (unsigned long)rx + 6 + (m_maxSpiRx * (messageCount - 2));
+            if ((total - m_maxSpiRx) > 0) {
+                spiTransfer[messageCount].len = m_maxSpiRx;
+                total -= m_maxSpiRx;
+            } else {
+                spiTransfer[messageCount].len = total;
+                total = 0;
+            }
+            messageCount++;
+        }
+    }
+
+    if (ioctl(m_fd, SPI_IOC_MESSAGE(messageCount), spiTransfer) < 1) {
+        return SpiError::UnknownError;
+    }
+    if (!frame.checkRxCrc(rx)) {
+        return SpiError::CrcError;
+    }
+    if (!frame.checkRxHeader(rx)) {
+        return SpiError::ProtocolError;
+    }
+    return SpiError::NoError;
+}
+
+int NeuronSpiDevice::readRegisters(uint16_t address, uint8_t count, uint16_t *registers)
+{
+    NeuronFrame frame(FunctionCode::ReadRegister, address, count);
+    if (transfer(frame, m_rx) != SpiError::NoError) {
+        return -1;
+    }
+    int resultCount = frame.resultCount(m_rx);
+    memcpy(registers, frame.resultData(m_rx), resultCount * sizeof(uint16_t));
+    return resultCount;
+}
+
+SpiError NeuronSpiDevice::writeRegister(uint16_t address, uint16_t value)
+{
+    NeuronFrame frame(FunctionCode::WriteRegister, address, 1, &value, sizeof(value));
+    return transfer(frame, m_rx);
+}
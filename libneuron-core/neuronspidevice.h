@@ -0,0 +1,62 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef NEURONSPIDEVICE_H
+#define NEURONSPIDEVICE_H
+
+#include <stdint.h>
+
+#include "neurondefines.h"
+#include "neuronframe.h"
+
+// Blocking access to one spidev device, free of any Qt dependency.
+//
+// A transfer clocks one frame and checks CRC and header of the reply. Queueing,
+// retries and threads are left to the caller, see NeuronTransport.
+class NeuronSpiDevice
+{
+public:
+    NeuronSpiDevice();
+    ~NeuronSpiDevice();
+    NeuronSpiDevice(const NeuronSpiDevice &) = delete;
+    NeuronSpiDevice &operator=(const NeuronSpiDevice &) = delete;
+
+    bool open(const char *path);
+    void close();
+    bool isOpen() const;
+    int handle() const;
+
+    bool setSpeed(int speed);
+
+    // The receive buffer must hold NeuronFrame::maxFrameLength bytes
+    SpiError transfer(const NeuronFrame &frame, uint8_t *rx);
+    // Convenience for synchronous users, returns the number of registers read or -1
+    int readRegisters(uint16_t address, uint8_t count, uint16_t *registers);
+    SpiError writeRegister(uint16_t address, uint16_t value);
+
+private:
+    int m_fd = -1;
+    const int m_maxSpiRx = 64; // On the RPI 2,3 the SPI transmit is limitted to 94 bytes.
+    const int m_nssDefaultPause = 10;
+    uint8_t m_rx[NeuronFrame::maxFrameLength];
+};
+
+#endif // NEURONSPIDEVICE_H
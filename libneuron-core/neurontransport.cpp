@@ -0,0 +1,652 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "neurontransport.h"
+#include "neuronbits.h"
+
+#include <algorithm>
+#include <string.h>
+
+const int NeuronTransport::maxStreamRegisters;
+
+NeuronTransport::NeuronTransport(Listener *listener) :
+    m_listener(listener)
+{
+
+}
+
+NeuronTransport::~NeuronTransport()
+{
+    stop();
+}
+
+bool NeuronTransport::open(const char *path)
+{
+    return m_spiDevice.open(path);
+}
+
+bool NeuronTransport::setSpeed(int speed)
+{
+    // Serialized with the fallback and its restore in the worker thread
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if (!m_spiDevice.setSpeed(speed)) {
+        return false;
+    }
+    m_speed = speed;
+    m_restoreSpeed = 0;
+    return true;
+}
+
+int NeuronTransport::speed() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_speed;
+}
+
+void NeuronTransport::start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_stopRequested = false;
+    m_thread = std::thread(&NeuronTransport::run, this);
+}
+
+void NeuronTransport::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_stopRequested = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+bool NeuronTransport::isRunning() const
+{
+    return m_thread.joinable();
+}
+
+void NeuronTransport::submit(Request request)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    // An identical read that is running or queued already answers this one as well, unless a
+    // write to its registers is queued behind it. The read must see the value of that write.
+    bool writeBehind = false;
+    for (size_t i = m_queue.size(); i > 0 && !writeBehind; i--) {
+        const NeuronFrame &frame = m_queue[i - 1].request.frame;
+        if (isSameRead(request.frame, frame)) {
+            m_queue[i - 1].sharedContexts.push_back(request.context);
+            m_statistics.sharedReads++;
+            return;
+        }
+        writeBehind = isOverlappingWrite(frame, request.frame);
+    }
+    if (!writeBehind && m_activeFrame && isSameRead(request.frame, *m_activeFrame)) {
+        m_activeSharedContexts.push_back(request.context);
+        m_statistics.sharedReads++;
+        return;
+    }
+
+    Transaction transaction;
+    transaction.request = std::move(request);
+    transaction.deadline = elapsed() + m_transactionTimeout;
+    m_queue.push_back(std::move(transaction));
+    m_condition.notify_one();
+}
+
+int NeuronTransport::transactionTimeout() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_transactionTimeout;
+}
+
+void NeuronTransport::setTransactionTimeout(int milliseconds)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_transactionTimeout = milliseconds;
+}
+
+NeuronTransport::RetryPolicy NeuronTransport::retryPolicy() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_retryPolicy;
+}
+
+void NeuronTransport::setRetryPolicy(const RetryPolicy &policy)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_retryPolicy = policy;
+}
+
+NeuronTransport::Statistics NeuronTransport::statistics() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_statistics;
+}
+
+bool NeuronTransport::startStreaming(const StreamConfiguration &configuration)
+{
+    if (configuration.count < 1 || configuration.count > maxStreamRegisters) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_streamConfiguration = configuration;
+    m_streamRing.reset(new SpscRing<StreamSample>(configuration.capacity));
+    m_streamStatistics = StreamStatistics();
+    m_streamStart = nsecsElapsed();
+    m_streamGeneration++;
+    m_streaming = true;
+    m_condition.notify_one();
+    return true;
+}
+
+void NeuronTransport::stopStreaming()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_streaming = false;
+}
+
+bool NeuronTransport::isStreaming() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_streaming;
+}
+
+int NeuronTransport::readSamples(StreamSample *samples, int maxCount)
+{
+    std::shared_ptr<SpscRing<StreamSample> > ring;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        ring = m_streamRing;
+    }
+    if (!ring) {
+        return 0;
+    }
+    return ring->pop(samples, maxCount);
+}
+
+NeuronTransport::StreamStatistics NeuronTransport::streamStatistics() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    StreamStatistics statistics = m_streamStatistics;
+    int64_t elapsed = nsecsElapsed() - m_streamStart;
+    if (elapsed > 0) {
+        statistics.rate = statistics.samples * 1000000000.0 / elapsed;
+    }
+    return statistics;
+}
+
+int NeuronTransport::readUartCharacters(char *characters, int maxCount)
+{
+    return m_uartRing.pop(characters, maxCount);
+}
+
+int NeuronTransport::idleInterval() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_idleInterval;
+}
+
+void NeuronTransport::setIdleInterval(int milliseconds)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_idleInterval = std::max(milliseconds, 0);
+    m_condition.notify_one();
+}
+
+uint8_t NeuronTransport::takeStatus()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    uint8_t status = m_status;
+    m_status = 0;
+    return status;
+}
+
+int64_t NeuronTransport::elapsed() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_clockStart).count();
+}
+
+int64_t NeuronTransport::nsecsElapsed() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_clockStart).count();
+}
+
+void NeuronTransport::sleep(int microseconds)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(microseconds));
+}
+
+void NeuronTransport::run()
+{
+    // The stream frame is rebuilt in this thread whenever the stream configuration changes
+    NeuronFrame streamFrame;
+    int streamGeneration = -1;
+    const NeuronFrame idleFrame;
+
+    while (!m_stopRequested) {
+        Transaction transaction;
+        bool hasTransaction = false;
+        std::vector<Transaction> expiredTransactions;
+        bool streaming;
+        bool sendIdle = false;
+        int interFrameGap = 0;
+        int64_t streamStart = 0;
+        std::shared_ptr<SpscRing<StreamSample> > streamRing;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            expiredTransactions = takeExpiredTransactions();
+            streaming = m_streaming;
+            if (expiredTransactions.empty() && m_queue.empty() && !streaming) {
+                // A quiet bus is polled with idle frames for the status of the board
+                int64_t idleDue = m_lastTransfer + m_idleInterval - elapsed();
+                if (m_idleInterval > 0 && idleDue <= 0) {
+                    sendIdle = true;
+                } else {
+                    // Sleep until new work arrives, the deadlines are checked again on wake up
+                    int64_t wait = m_idleInterval > 0 ? std::min<int64_t>(idleDue, m_maxIdleWait) : m_maxIdleWait;
+                    m_condition.wait_for(locker, std::chrono::milliseconds(wait));
+                    continue;
+                }
+            }
+            if (!m_queue.empty()) {
+                Transaction first = std::move(m_queue.front());
+                m_queue.pop_front();
+                transaction = coalesceWrites(std::move(first));
+                hasTransaction = true;
+                m_activeFrame = &transaction.request.frame;
+            } else if (streaming) {
+                if (streamGeneration != m_streamGeneration) {
+                    streamGeneration = m_streamGeneration;
+                    streamFrame = NeuronFrame(FunctionCode::ReadRegister, m_streamConfiguration.address, m_streamConfiguration.count);
+                }
+                interFrameGap = m_streamConfiguration.interFrameGap;
+                streamRing = m_streamRing;
+                streamStart = m_streamStart;
+            }
+        }
+
+        if (sendIdle) {
+            transfer(idleFrame, m_rx);
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_statistics.idleFrames++;
+            continue;
+        }
+
+        for (size_t i = 0; i < expiredTransactions.size(); i++) {
+            finishTransaction(expiredTransactions[i], SpiError::TimeoutError);
+        }
+
+        if (hasTransaction) {
+            processTransaction(transaction);
+            // While streaming the stream interval paces the bus instead
+            if (!streaming) {
+                sleep(1000);
+            }
+        } else if (streamRing) {
+            streamSample(streamFrame, streamRing.get(), streamStart);
+            if (interFrameGap > 0) {
+                sleep(interFrameGap);
+            }
+        }
+    }
+
+    // Complete whatever is left so no caller waits for a reply that never finishes
+    std::deque<Transaction> pendingTransactions;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        pendingTransactions.swap(m_queue);
+    }
+    for (size_t i = 0; i < pendingTransactions.size(); i++) {
+        finishTransaction(pendingTransactions[i], SpiError::UnknownError);
+    }
+}
+
+NeuronTransport::Transaction NeuronTransport::coalesceWrites(Transaction first)
+{
+    FunctionCode functionCode = first.request.frame.functionCode();
+    if (functionCode != FunctionCode::WriteBit && functionCode != FunctionCode::WriteRegister) {
+        return first;
+    }
+    // The bit count of WriteBits goes into one byte, see NeuronSpi::writeRegisters() for the register limit
+    const int maxSpan = (functionCode == FunctionCode::WriteBit) ? 255 : 126;
+
+    // Only writes of the same kind right behind the first one are merged, so the order of
+    // the queue is kept. A later write to the same address replaces the earlier value, the
+    // merged range must not have gaps since WriteBits and WriteRegister write every address.
+    std::map<int, uint16_t> values;
+    addWriteValues(first.request.frame, &values);
+    std::map<int, uint16_t> mergedValues;
+    int mergeCount = 0;
+    for (int i = 0; i < static_cast<int>(m_queue.size()) && i < m_maxCoalescedWrites; i++) {
+        const NeuronFrame &frame = m_queue[i].request.frame;
+        if (frame.functionCode() != functionCode) {
+            break;
+        }
+        addWriteValues(frame, &values);
+        int span = values.rbegin()->first - values.begin()->first + 1;
+        if (span > maxSpan) {
+            break;
+        }
+        if (span == static_cast<int>(values.size())) {
+            mergeCount = i + 1;
+            mergedValues = values;
+        }
+    }
+    if (mergeCount == 0) {
+        return first;
+    }
+
+    Transaction merged;
+    merged.deadline = first.deadline;
+    merged.coalesced.push_back(std::move(first.request));
+    for (int i = 0; i < mergeCount; i++) {
+        merged.coalesced.push_back(std::move(m_queue.front().request));
+        m_queue.pop_front();
+    }
+
+    std::vector<uint16_t> data;
+    for (std::map<int, uint16_t>::const_iterator it = mergedValues.begin(); it != mergedValues.end(); ++it) {
+        data.push_back(it->second);
+    }
+    uint16_t address = mergedValues.begin()->first;
+    if (functionCode == FunctionCode::WriteBit) {
+        std::vector<uint8_t> bits(data.begin(), data.end());
+        std::vector<uint16_t> words(NeuronBits::wordCount(bits.size()));
+        NeuronBits::pack(bits.data(), bits.size(), words.data());
+        merged.request.frame = NeuronFrame(FunctionCode::WriteBits, address, bits.size(), words.data(), words.size() * sizeof(uint16_t));
+    } else {
+        merged.request.frame = NeuronFrame(FunctionCode::WriteRegister, address, data.size(), data.data(), data.size() * sizeof(uint16_t));
+    }
+    m_statistics.coalescedWrites += merged.coalesced.size();
+    return merged;
+}
+
+void NeuronTransport::addWriteValues(const NeuronFrame &frame, std::map<int, uint16_t> *values)
+{
+    // WriteBit is a one phase operation carrying the value in the length byte
+    if (frame.functionCode() == FunctionCode::WriteBit) {
+        (*values)[frame.address()] = frame.length() ? 1 : 0;
+        return;
+    }
+    const uint16_t *registers = frame.payloadData();
+    for (int i = 0; i < frame.length(); i++) {
+        (*values)[frame.address() + i] = registers[i];
+    }
+}
+
+bool NeuronTransport::isSameRead(const NeuronFrame &frame, const NeuronFrame &other)
+{
+    if (frame.functionCode() != FunctionCode::ReadRegister && frame.functionCode() != FunctionCode::ReadBit) {
+        return false;
+    }
+    return frame.functionCode() == other.functionCode() && frame.address() == other.address() && frame.length() == other.length();
+}
+
+bool NeuronTransport::isOverlappingWrite(const NeuronFrame &write, const NeuronFrame &read)
+{
+    bool bits;
+    int count;
+    switch (write.functionCode()) {
+    case FunctionCode::WriteRegister:
+        bits = false;
+        count = write.length();
+        break;
+    case FunctionCode::WriteBit:
+        bits = true;
+        count = 1;
+        break;
+    case FunctionCode::WriteBits:
+        bits = true;
+        count = write.length();
+        break;
+    default:
+        // Characters go to the UART, not to registers
+        return false;
+    }
+    // Coils are mirrored in the MixedBits registers, a write of the other kind may change any of them
+    if (bits != (read.functionCode() == FunctionCode::ReadBit)) {
+        return true;
+    }
+    return write.address() < read.address() + read.length() && read.address() < write.address() + count;
+}
+
+void NeuronTransport::processTransaction(const Transaction &transaction)
+{
+    RetryPolicy policy = retryPolicy();
+    const Request &request = transaction.request;
+
+    int attempt = 0;
+    for (;;) {
+        SpiError error = transfer(request.frame, m_rx);
+        if (error == SpiError::NoError) {
+            m_consecutiveFailures = 0;
+            finishTransaction(transaction, error, m_rx);
+            return;
+        }
+
+        m_consecutiveFailures++;
+        if (error == SpiError::CrcError) {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_statistics.crcErrors++;
+        }
+        if (m_consecutiveFailures >= policy.resyncThreshold) {
+            resynchronize();
+        }
+
+        if (error == SpiError::UnknownError || !request.retryable || attempt >= policy.maxRetries) {
+            finishTransaction(transaction, error);
+            return;
+        }
+
+        attempt++;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_statistics.retries++;
+        }
+        sleep(std::min(policy.initialBackoff << std::min(attempt - 1, 16), policy.maxBackoff));
+    }
+}
+
+SpiError NeuronTransport::transfer(const NeuronFrame &frame, uint8_t *rx)
+{
+    // Failed transfers count as well, an absent board is not polled back to back
+    m_lastTransfer = elapsed();
+    SpiError error = m_spiDevice.transfer(frame, rx);
+    if (error != SpiError::NoError) {
+        m_lastFailure = m_lastTransfer;
+        m_listener->transferFailed(frame, error);
+        return error;
+    }
+    if (m_fallbackActive) {
+        restoreSpeed();
+    }
+    if (frame.isOnePhaseOperation() && !NeuronFrame::isIdleReply(rx)) {
+        // Only reported, the device accepted the reply already
+        m_listener->unexpectedReply(frame, rx);
+    }
+
+    int status = NeuronFrame::idleStatus(rx);
+    if (status > 0) {
+        uint8_t previousStatus;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            previousStatus = m_status;
+            m_status |= status;
+        }
+        if (previousStatus == 0) {
+            m_listener->statusReported(status);
+        }
+    }
+
+    int character = NeuronFrame::piggybackedCharacter(rx);
+    if (character >= 0 && !m_uartRing.push(character)) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_statistics.uartOverruns++;
+    }
+    return SpiError::NoError;
+}
+
+void NeuronTransport::resynchronize()
+{
+    RetryPolicy policy = retryPolicy();
+    int failures = m_consecutiveFailures;
+    m_consecutiveFailures = 0;
+
+    // Idle frames let the board drop a partially received frame
+    const NeuronFrame idleFrame;
+    for (int i = 0; i < policy.resyncIdleFrames; i++) {
+        transfer(idleFrame, m_resyncRx);
+        sleep(policy.maxBackoff);
+    }
+
+    bool fallback = false;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        int speed = m_speed;
+        if (policy.fallbackSpeed > 0 && (speed == 0 || speed > policy.fallbackSpeed) && m_spiDevice.setSpeed(policy.fallbackSpeed)) {
+            m_speed = policy.fallbackSpeed;
+            // The speed of the device is unknown if none was set, it cannot be restored
+            m_restoreSpeed = speed;
+            m_fallbackActive = speed > 0;
+            fallback = true;
+        }
+    }
+    if (fallback) {
+        m_lastFailure = elapsed();
+        m_listener->speedChanged(policy.fallbackSpeed);
+    }
+
+    const NeuronFrame versionFrame(FunctionCode::ReadRegister, 1000, 5);
+    bool success = (transfer(versionFrame, m_resyncRx) == SpiError::NoError) && versionFrame.resultCount(m_resyncRx) == 5;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if (success) {
+            m_statistics.resynchronizations++;
+        } else {
+            m_statistics.failedResynchronizations++;
+        }
+    }
+    m_listener->resynchronizationFinished(failures, success, success ? versionFrame.resultData(m_resyncRx) : nullptr, success ? 5 : 0);
+}
+
+void NeuronTransport::restoreSpeed()
+{
+    int speed;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        // Replaced by setSpeed() meanwhile
+        if (m_restoreSpeed == 0) {
+            m_fallbackActive = false;
+            return;
+        }
+        if (m_retryPolicy.restoreInterval <= 0 || elapsed() - m_lastFailure < m_retryPolicy.restoreInterval || !m_spiDevice.setSpeed(m_restoreSpeed)) {
+            return;
+        }
+        m_speed = m_restoreSpeed;
+        m_restoreSpeed = 0;
+        m_fallbackActive = false;
+        m_statistics.speedRestores++;
+        speed = m_speed;
+    }
+    m_listener->speedChanged(speed);
+}
+
+void NeuronTransport::streamSample(const NeuronFrame &frame, SpscRing<StreamSample> *ring, int64_t start)
+{
+    // Stream reads are not retried, the next sample follows right away
+    SpiError error = transfer(frame, m_rx);
+    int64_t timestamp = nsecsElapsed() - start;
+    if (error != SpiError::NoError) {
+        m_consecutiveFailures++;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_streamStatistics.errors++;
+            if (error == SpiError::CrcError) {
+                m_statistics.crcErrors++;
+            }
+        }
+        if (m_consecutiveFailures >= retryPolicy().resyncThreshold) {
+            resynchronize();
+        }
+        return;
+    }
+    m_consecutiveFailures = 0;
+
+    StreamSample sample;
+    sample.timestamp = timestamp;
+    // Copied straight from the receive buffer, the stream loop does not allocate
+    sample.count = std::min(frame.resultCount(m_rx), maxStreamRegisters);
+    memcpy(sample.registers, frame.resultData(m_rx), sample.count * sizeof(uint16_t));
+    bool stored = ring->push(sample);
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_streamStatistics.samples++;
+    if (!stored) {
+        m_streamStatistics.dropped++;
+    }
+}
+
+std::vector<NeuronTransport::Transaction> NeuronTransport::takeExpiredTransactions()
+{
+    // Deadlines are assigned in submission order, so the oldest transaction expires first
+    std::vector<Transaction> expiredTransactions;
+    const int64_t now = elapsed();
+    while (!m_queue.empty() && m_queue.front().deadline <= now) {
+        expiredTransactions.push_back(std::move(m_queue.front()));
+        m_queue.pop_front();
+    }
+    return expiredTransactions;
+}
+
+void NeuronTransport::finishTransaction(const Transaction &transaction, SpiError error, const uint8_t *rx)
+{
+    std::vector<void *> sharedContexts = transaction.sharedContexts;
+    int requestCount = transaction.coalesced.empty() ? 1 : transaction.coalesced.size();
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if (&transaction.request.frame == m_activeFrame) {
+            sharedContexts.insert(sharedContexts.end(), m_activeSharedContexts.begin(), m_activeSharedContexts.end());
+            m_activeSharedContexts.clear();
+            m_activeFrame = nullptr;
+        }
+        m_statistics.transactions += requestCount;
+        if (error == SpiError::TimeoutError) {
+            m_statistics.timeouts += requestCount;
+        } else if (error != SpiError::NoError) {
+            m_statistics.transferErrors += requestCount;
+        }
+    }
+
+    if (transaction.coalesced.empty()) {
+        m_listener->requestFinished(transaction.request, sharedContexts, error, rx);
+        return;
+    }
+    // Every merged request completes with the outcome of the shared frame
+    for (size_t i = 0; i < transaction.coalesced.size(); i++) {
+        m_listener->requestFinished(transaction.coalesced.at(i), sharedContexts, error, nullptr);
+    }
+}
@@ -0,0 +1,238 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef NEURONTRANSPORT_H
+#define NEURONTRANSPORT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "neurondefines.h"
+#include "neuronframe.h"
+#include "neuronspidevice.h"
+#include "spscring.h"
+
+// Transaction engine of one SPI device, free of any Qt dependency.
+//
+// A worker thread sends the queued requests in order. Queued writes are merged into
+// one frame, identical reads share one transfer unless a write to their registers is
+// queued in between, failed transfers are retried and the bus is resynchronized after
+// repeated failures. A quiet bus is polled with idle frames.
+// Results are delivered to the Listener on the worker thread, see Spi for the Qt adapter.
+class NeuronTransport
+{
+public:
+    struct Statistics {
+        uint64_t transactions = 0;
+        uint64_t timeouts = 0;
+        uint64_t transferErrors = 0;
+        uint64_t crcErrors = 0;
+        uint64_t retries = 0;
+        uint64_t resynchronizations = 0;
+        uint64_t failedResynchronizations = 0;
+        uint64_t speedRestores = 0; // The fallback speed was replaced by the previous speed again
+        uint64_t uartOverruns = 0; // Piggybacked UART characters dropped because nobody took them
+        uint64_t coalescedWrites = 0; // Write requests sent together with others in one frame
+        uint64_t sharedReads = 0; // Reads answered by an identical queued or running read
+        uint64_t idleFrames = 0;
+    };
+
+    struct RetryPolicy {
+        int maxRetries = 3;
+        int initialBackoff = 100; // In microseconds, doubled for every further attempt
+        int maxBackoff = 2000; // In microseconds
+        int resyncThreshold = 5; // Consecutive failed transfers before the bus is resynchronized
+        int resyncIdleFrames = 4;
+        int fallbackSpeed = 8000000; // Speed used after a resynchronization, 0 keeps the current speed
+        int restoreInterval = 10000; // In milliseconds without a failed transfer before the speed replaced by the fallback speed is restored, 0 keeps the fallback speed
+    };
+
+    static const int maxStreamRegisters = 16;
+
+    struct StreamSample {
+        int64_t timestamp = 0; // In nanoseconds since the stream was started
+        uint8_t count = 0;
+        uint16_t registers[maxStreamRegisters];
+    };
+
+    struct StreamConfiguration {
+        uint16_t address = 0;
+        uint8_t count = 0; // Consecutive registers read per sample, at most maxStreamRegisters
+        int interFrameGap = 0; // In microseconds between two samples, 0 reads back to back
+        int capacity = 4096; // Samples buffered until the consumer drains them
+    };
+
+    struct StreamStatistics {
+        uint64_t samples = 0;
+        uint64_t dropped = 0; // Read while the ring was full
+        uint64_t errors = 0;
+        double rate = 0; // Achieved samples per second
+    };
+
+    struct Request {
+        NeuronFrame frame;
+        // Writes to the UART are not repeated, a retry could duplicate characters on the line
+        bool retryable = true;
+        void *context = nullptr; // Handed back to the listener, e.g. the reply of the adapter
+    };
+
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        // Completes a request together with the identical reads that shared its transfer.
+        // The receive buffer holds the reply, it is nullptr if the request failed or was
+        // merged into a larger write. It is only valid during the call.
+        virtual void requestFinished(const Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx) = 0;
+        virtual void transferFailed(const NeuronFrame &frame, SpiError error) = 0;
+        // The first phase of a one phase operation was no idle reply, the board may lag behind
+        virtual void unexpectedReply(const NeuronFrame &frame, const uint8_t *rx) = 0;
+        // Carries the register 1000 block if the bus could be resynchronized
+        virtual void resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count) = 0;
+        // The board reported status flags after the last takeStatus()
+        virtual void statusReported(uint8_t status) = 0;
+        // The worker changed the speed, to the fallback speed while resynchronizing or back to the previous speed
+        virtual void speedChanged(int speed) = 0;
+    };
+
+    explicit NeuronTransport(Listener *listener);
+    ~NeuronTransport();
+    NeuronTransport(const NeuronTransport &) = delete;
+    NeuronTransport &operator=(const NeuronTransport &) = delete;
+
+    bool open(const char *path);
+    // Replaces the previous speed, also the one a fallback speed would be restored to
+    bool setSpeed(int speed);
+    // Speed in use, 0 if none was set
+    int speed() const;
+
+    void start();
+    // Pending requests finish with an UnknownError
+    void stop();
+    bool isRunning() const;
+
+    void submit(Request request);
+
+    // Time a request may wait in the queue before it fails with a TimeoutError
+    int transactionTimeout() const;
+    void setTransactionTimeout(int milliseconds);
+
+    RetryPolicy retryPolicy() const;
+    void setRetryPolicy(const RetryPolicy &policy);
+
+    Statistics statistics() const;
+
+    // Streaming reads the same registers continuously whenever no request is queued
+    bool startStreaming(const StreamConfiguration &configuration);
+    void stopStreaming();
+    bool isStreaming() const;
+    // Called by one consumer thread, returns the number of samples taken
+    int readSamples(StreamSample *samples, int maxCount);
+    StreamStatistics streamStatistics() const;
+
+    // UART characters the board piggybacked on replies, called by one consumer thread
+    int readUartCharacters(char *characters, int maxCount);
+
+    // Idle frames are sent whenever the bus was quiet for the interval, 0 disables them.
+    // Their replies carry the status flags of the board, as do the first phases of all other replies.
+    int idleInterval() const;
+    void setIdleInterval(int milliseconds);
+    // Status flags reported since the last call
+    uint8_t takeStatus();
+
+private:
+    struct Transaction {
+        Request request;
+        int64_t deadline = 0; // In milliseconds of m_clockStart
+        // Requests merged into request, the merged frame belongs to the worker thread
+        std::vector<Request> coalesced;
+        // Identical reads attached while queued, completed with the same result
+        std::vector<void *> sharedContexts;
+    };
+
+    Listener *m_listener;
+    NeuronSpiDevice m_spiDevice;
+    std::thread m_thread;
+    std::atomic<bool> m_stopRequested{false};
+    const std::chrono::steady_clock::time_point m_clockStart = std::chrono::steady_clock::now();
+
+    const int m_maxIdleWait = 100; // In milliseconds, upper bound to notice stop requests
+    const int m_maxCoalescedWrites = 64; // Queued writes looked at behind the one being sent
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Transaction> m_queue;
+    // Frame the worker is sending, identical reads submitted meanwhile wait for its result
+    const NeuronFrame *m_activeFrame = nullptr;
+    std::vector<void *> m_activeSharedContexts;
+    int m_transactionTimeout = 100; // In milliseconds
+    RetryPolicy m_retryPolicy;
+    Statistics m_statistics;
+    int m_speed = 0;
+    int m_restoreSpeed = 0; // Speed replaced by the fallback speed, 0 if the fallback speed is not in use
+
+    bool m_streaming = false;
+    int m_streamGeneration = 0;
+    StreamConfiguration m_streamConfiguration;
+    std::shared_ptr<SpscRing<StreamSample> > m_streamRing;
+    StreamStatistics m_streamStatistics;
+    int64_t m_streamStart = 0; // In nanoseconds of m_clockStart
+
+    SpscRing<char> m_uartRing{1024};
+
+    int m_idleInterval = 0; // In milliseconds
+    uint8_t m_status = 0;
+
+    // Only used by the worker thread
+    int m_consecutiveFailures = 0;
+    int64_t m_lastTransfer = 0; // In milliseconds of m_clockStart
+    int64_t m_lastFailure = 0; // In milliseconds of m_clockStart
+    bool m_fallbackActive = false;
+    uint8_t m_rx[NeuronFrame::maxFrameLength];
+    uint8_t m_resyncRx[NeuronFrame::maxFrameLength];
+
+    int64_t elapsed() const;
+    int64_t nsecsElapsed() const;
+    static void sleep(int microseconds);
+
+    void run();
+    Transaction coalesceWrites(Transaction first);
+    static void addWriteValues(const NeuronFrame &frame, std::map<int, uint16_t> *values);
+    static bool isSameRead(const NeuronFrame &frame, const NeuronFrame &other);
+    static bool isOverlappingWrite(const NeuronFrame &write, const NeuronFrame &read);
+    void processTransaction(const Transaction &transaction);
+    SpiError transfer(const NeuronFrame &frame, uint8_t *rx);
+    void resynchronize();
+    void restoreSpeed();
+    void streamSample(const NeuronFrame &frame, SpscRing<StreamSample> *ring, int64_t start);
+    std::vector<Transaction> takeExpiredTransactions();
+    void finishTransaction(const Transaction &transaction, SpiError error = SpiError::NoError, const uint8_t *rx = nullptr);
+};
+
+#endif // NEURONTRANSPORT_H
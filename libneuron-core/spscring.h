@@ -0,0 +1,102 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Lock free ring buffer for exactly one producer and one consumer thread, free of any Qt dependency.
+// The storage is allocated once, the capacity is rounded up to a power of two.
+template<typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(int capacity)
+    {
+        uint32_t size = 1;
+        while (size < (uint32_t)std::max(capacity, 1)) {
+            size <<= 1;
+        }
+        m_buffer.resize(size);
+        m_items = m_buffer.data();
+        m_mask = size - 1;
+    }
+
+    int capacity() const { return m_mask + 1; }
+    int count() const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire); }
+
+    // Producer side, returns false if the ring is full
+    bool push(const T &item)
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+        m_items[head & m_mask] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side, stores up to count items in one block and returns how many fit
+    int push(const T *items, int count)
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        count = std::min<int>(count, capacity() - (head - m_tail.load(std::memory_order_acquire)));
+        for (int i = 0; i < count; i++) {
+            m_items[(head + i) & m_mask] = items[i];
+        }
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side, takes up to maxCount items in one block
+    int pop(T *items, int maxCount)
+    {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        int count = std::min<int>(m_head.load(std::memory_order_acquire) - tail, maxCount);
+        for (int i = 0; i < count; i++) {
+            items[i] = m_items[(tail + i) & m_mask];
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<T> m_buffer;
+    T *m_items = nullptr;
+    uint32_t m_mask = 0;
+
+    // Producer and consumer indices on separate cache lines. Padded by hand instead of alignas,
+    // C++11 operator new does not honour an alignment above the one of max_align_t.
+    static const int m_cacheLineSize = 64;
+    char m_paddingBefore[m_cacheLineSize];
+    std::atomic<uint32_t> m_head{0};
+    char m_paddingHead[m_cacheLineSize - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> m_tail{0};
+    char m_paddingTail[m_cacheLineSize - sizeof(std::atomic<uint32_t>)];
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,19 @@
+include(../libneuron.pri)
+
+TARGET = libneuron-mapcompiler
+
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$top_srcdir/libneuron/ $$top_srcdir/libneuron-core/
+LIBS += -L$$top_builddir/libneuron/ -lneuron -L$$top_builddir/libneuron-core/ -lneuroncore
+
+DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+SOURCES += \
+        main.cpp
+
+target.path = $$[QT_INSTALL_PREFIX]/bin
+INSTALLS += target
@@ -0,0 +1,106 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QElapsedTimer>
+
+#include <modbusmap.h>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("libneuron map compiler");
+    QCoreApplication::setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compile the modbus map CSV files into binary map images");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("maps", "Directory containing the Neuron_<model> and Extension_<model> CSV directories");
+
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the images to <directory> instead of the maps directory", "directory");
+    parser.addOption(outputOption);
+    QCommandLineOption benchmarkOption(QStringList() << "b" << "benchmark", "Only load the CSV maps of all models <iterations> times and print the load time", "iterations");
+    parser.addOption(benchmarkOption);
+    parser.process(app);
+
+    QString mapDirectory = parser.positionalArguments().value(0, "./modbus_maps/");
+    QString outputDirectory = parser.isSet(outputOption) ? parser.value(outputOption) : mapDirectory;
+    if (!QDir(mapDirectory).exists()) {
+        qWarning() << "Map directory does not exist" << mapDirectory;
+        return -1;
+    }
+    ModbusMap::setMapDirectory(mapDirectory);
+
+    QStringList models;
+    foreach (const QString &directory, QDir(mapDirectory).entryList(QStringList() << "Neuron_*" << "Extension_*", QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QString model = directory.mid(directory.indexOf('_') + 1);
+        if (ModbusMap::numberOfNodes(model) < 1) {
+            qInfo() << "Skipping" << directory << "unknown number of sub-nodes";
+            continue;
+        }
+        models.append(model);
+    }
+
+    if (parser.isSet(benchmarkOption)) {
+        int iterations = qMax(1, parser.value(benchmarkOption).toInt());
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; i++) {
+            foreach (const QString &model, models) {
+                ModbusMap map(model);
+                if (!map.loadCsvMap()) {
+                    qWarning() << "Could not load CSV map of" << model;
+                    return -1;
+                }
+            }
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        qInfo() << "Loaded" << models.count() << "CSV maps" << iterations << "times in" << elapsed / 1000000 << "ms," << elapsed / 1000 / iterations << "us per iteration";
+        return 0;
+    }
+
+    int compiled = 0;
+    foreach (const QString &model, models) {
+        ModbusMap map(model);
+        if (!map.loadCsvMap()) {
+            qWarning() << "Could not load CSV map of" << model;
+            return -1;
+        }
+
+        QString imagePath = QDir(outputDirectory).filePath(ModbusMap::imageFileName(model));
+        QDir().mkpath(QFileInfo(imagePath).absolutePath());
+        if (!map.saveImage(imagePath)) {
+            qWarning() << "Could not write" << imagePath;
+            return -1;
+        }
+        qInfo() << "Compiled" << model << "to" << imagePath << map.image().size() << "bytes";
+        compiled++;
+    }
+
+    qInfo() << "Compiled" << compiled << "modbus maps";
+    return 0;
+}
@@ -7,21 +7,27 @@ QT -= gui
 CONFIG += c++11 console
 CONFIG -= app_bundle
 
-INCLUDEPATH += $$top_srcdir/libneuron/
-LIBS += -L$$top_builddir/libneuron/ -lneuron
+INCLUDEPATH += $$top_srcdir/libneuron/ $$top_srcdir/libneuron-core/
+LIBS += -L$$top_builddir/libneuron/ -lneuron -L$$top_builddir/libneuron-core/ -lneuroncore
 
 DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
         configuration.cpp \
         main.cpp \
-        modbusmap.cpp \
-        testengine.cpp
+        modbusloopbacktest.cpp \
+        modbusrtutest.cpp \
+        rtuslavesimulator.cpp \
+        testengine.cpp \
+        transportorderingtest.cpp
 
 HEADERS += \
     configuration.h \
-    modbusmap.h \
-    testengine.h
+    modbusloopbacktest.h \
+    modbusrtutest.h \
+    rtuslavesimulator.h \
+    testengine.h \
+    transportorderingtest.h
 
 target.path = $$[QT_INSTALL_PREFIX]/bin
 INSTALLS += target
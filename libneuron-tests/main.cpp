@@ -31,6 +31,9 @@
 
 #include "testengine.h"
 #include "configuration.h"
+#include "modbusloopbacktest.h"
+#include "modbusrtutest.h"
+#include "transportorderingtest.h"
 
 int main(int argc, char *argv[])
 {
@@ -42,28 +45,83 @@ int main(int argc, char *argv[])
     parser.setApplicationDescription("Test the neuron SPI communication");
     parser.addHelpOption();
     parser.addVersionOption();
-    parser.addPositionalArgument("model", "Neuron model type");
+    parser.addPositionalArgument("model", "Neuron model type, detected from the hardware if omitted");
 
     QCommandLineOption fileOption(QStringList() << "f" << "file", "Test configuration <file>", "./test.json");
     parser.addOption(fileOption);
 
     QCommandLineOption switchAllOption(QStringList() << "a" << "all", "switch all <on/off>", "off");
     parser.addOption(switchAllOption);
+
+    QCommandLineOption monitorOption(QStringList() << "m" << "monitor", "Print input changes, analog changes below <deadband> are suppressed", "deadband");
+    parser.addOption(monitorOption);
+
+    QCommandLineOption extensionOption(QStringList() << "e" << "extension", "Extension module <model> on the RS485 line, can be given several times", "model");
+    parser.addOption(extensionOption);
+
+    QCommandLineOption simulateExtensionsOption(QStringList() << "simulate-extensions", "Simulate the extension modules instead of using the RS485 line");
+    parser.addOption(simulateExtensionsOption);
+
+    QCommandLineOption modbusLoopbackOption(QStringList() << "modbus-loopback", "Check the Modbus TCP server of neurond on the loopback interface, needs the model but no hardware");
+    parser.addOption(modbusLoopbackOption);
+
+    QCommandLineOption transportOrderingOption(QStringList() << "transport-ordering", "Check the request order of the SPI transaction engine, needs no hardware");
+    parser.addOption(transportOrderingOption);
+
+    QCommandLineOption modbusRtuOption(QStringList() << "modbus-rtu", "Check the Modbus RTU framing against a simulated slave on a noisy line, needs no hardware");
+    parser.addOption(modbusRtuOption);
     parser.process(app);
 
+    if (parser.isSet(modbusRtuOption)) {
+        ModbusRtuTest rtuTest;
+        return rtuTest.run() ? 0 : -1;
+    }
+
+    if (parser.isSet(transportOrderingOption)) {
+        TransportOrderingTest orderingTest;
+        return orderingTest.run() ? 0 : -1;
+    }
+
+    if (parser.isSet(modbusLoopbackOption)) {
+        if (parser.positionalArguments().isEmpty()) {
+            qWarning() << "The Neuron model is required for the Modbus TCP loopback checks";
+            return -1;
+        }
+        ModbusLoopbackTest loopbackTest;
+        return loopbackTest.run(parser.positionalArguments().first()) ? 0 : -1;
+    }
+
     QString testFile = parser.value(fileOption);
 
 
 
     TestEngine *testEngine = new TestEngine();
-    qInfo() << "Given Neuron model type is" << parser.positionalArguments().first();
-    if (!testEngine->loadMobusMap(parser.positionalArguments().first())) {
+    QString model = parser.positionalArguments().value(0);
+    if (!model.isEmpty()) {
+        qInfo() << "Given Neuron model type is" << model;
+    }
+    bool simulateExtensions = parser.isSet(simulateExtensionsOption);
+    if (!testEngine->initHardware(model)) {
+        // Simulated extensions do not need the SPI devices, but the model cannot be detected without them
+        if (!simulateExtensions || model.isEmpty()) {
+            qWarning() << "Could not init hardware";
+            return -1;
+        }
+        qInfo() << "No SPI hardware, only the simulated extensions are available";
+        testEngine->initSimulation(model);
+    }
+    foreach (const QString &extensionModel, parser.values(extensionOption)) {
+        testEngine->addExtension(extensionModel);
+    }
+    testEngine->setSimulateExtensions(simulateExtensions);
+    if (!testEngine->loadMobusMap(testEngine->model())) {
         qWarning() << "Could not load modbus map";
         return -1;
     }
-    if (!testEngine->initHardware()) {
-        qWarning() << "Could not init hardware";
-        return -1;
+
+    if (parser.isSet(monitorOption)) {
+        testEngine->startMonitor(parser.value(monitorOption).toDouble());
+        return app.exec();
     }
 
     QString allOnOff = parser.value(switchAllOption);
@@ -0,0 +1,293 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "modbusloopbacktest.h"
+#include "modbusmap.h"
+#include "neuronsharedimage.h"
+#include "neuronmodbustcpserver.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QSet>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+
+static QByteArray pdu(quint8 function, quint16 address, quint16 value)
+{
+    QByteArray data;
+    data.append(static_cast<char>(function));
+    data.append(static_cast<char>(address >> 8));
+    data.append(static_cast<char>(address & 0xff));
+    data.append(static_cast<char>(value >> 8));
+    data.append(static_cast<char>(value & 0xff));
+    return data;
+}
+
+static quint16 responseWord(const QByteArray &response, int index)
+{
+    return (static_cast<quint8>(response.at(index)) << 8) | static_cast<quint8>(response.at(index + 1));
+}
+
+ModbusLoopbackTest::ModbusLoopbackTest(QObject *parent) :
+    QObject{parent}
+{
+
+}
+
+ModbusLoopbackTest::~ModbusLoopbackTest()
+{
+    if (m_socket >= 0) {
+        ::close(m_socket);
+    }
+}
+
+bool ModbusLoopbackTest::run(const QString &neuronModel)
+{
+    ModbusMap modbusMap(neuronModel);
+    if (!modbusMap.loadModbusMap()) {
+        qWarning() << "Could not load modbus map of" << neuronModel;
+        return false;
+    }
+    int unitCount = modbusMap.numberOfNodes();
+    int registersPerUnit = 0;
+    for (int unit = 1; unit <= unitCount; unit++) {
+        registersPerUnit = qMax(registersPerUnit, modbusMap.nodeRange(unit).lastRegister + 1);
+    }
+
+    NeuronSharedImage sharedImage;
+    if (!sharedImage.create(QString("/neuron-loopback-%1").arg(QCoreApplication::applicationPid()), neuronModel, unitCount, registersPerUnit)) {
+        return false;
+    }
+    QVector<quint16> registers(registersPerUnit);
+    sharedImage.beginPublish();
+    for (int unit = 1; unit <= unitCount; unit++) {
+        for (int address = 0; address < registersPerUnit; address++) {
+            registers[address] = registerValue(unit, address);
+        }
+        sharedImage.publishUnit(unit, registers.constData(), registers.count());
+    }
+    sharedImage.endPublish(1, QDateTime::currentMSecsSinceEpoch());
+
+    NeuronModbusTcpServer server(&sharedImage, &modbusMap);
+    if (!server.listen(0)) {
+        return false;
+    }
+    server.start();
+    bool success = connectServer(server.port()) && runChecks(&modbusMap, &sharedImage);
+    if (success) {
+        qInfo() << "Modbus TCP loopback checks of" << neuronModel << "passed";
+    }
+    return success;
+}
+
+quint16 ModbusLoopbackTest::registerValue(int unit, quint16 address)
+{
+    // Unique within the registers of the maps, which end below 4096
+    return (unit << 12) + address;
+}
+
+bool ModbusLoopbackTest::connectServer(quint16 port)
+{
+    m_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct timeval timeout;
+    timeout.tv_sec = m_timeout / 1000;
+    timeout.tv_usec = (m_timeout % 1000) * 1000;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (m_socket < 0 || ::connect(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+        qWarning() << "Could not connect to the Modbus TCP server on port" << port << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool ModbusLoopbackTest::receive(char *data, int length)
+{
+    while (length > 0) {
+        ssize_t received = ::recv(m_socket, data, length, 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+QByteArray ModbusLoopbackTest::request(quint8 unit, const QByteArray &pdu)
+{
+    // MBAP header: transaction, protocol, length of unit and PDU, unit
+    quint16 transaction = ++m_transaction;
+    QByteArray frame;
+    frame.append(static_cast<char>(transaction >> 8));
+    frame.append(static_cast<char>(transaction & 0xff));
+    frame.append(static_cast<char>(0));
+    frame.append(static_cast<char>(0));
+    frame.append(static_cast<char>((pdu.size() + 1) >> 8));
+    frame.append(static_cast<char>((pdu.size() + 1) & 0xff));
+    frame.append(static_cast<char>(unit));
+    frame.append(pdu);
+    if (::send(m_socket, frame.constData(), frame.size(), MSG_NOSIGNAL) != frame.size()) {
+        return QByteArray();
+    }
+
+    char header[7];
+    if (!receive(header, sizeof(header))) {
+        return QByteArray();
+    }
+    quint16 length = (static_cast<quint8>(header[4]) << 8) | static_cast<quint8>(header[5]);
+    QByteArray response(length > 1 ? length - 1 : 0, 0);
+    if (length < 2 || !receive(response.data(), response.size())) {
+        return QByteArray();
+    }
+    if (((static_cast<quint8>(header[0]) << 8) | static_cast<quint8>(header[1])) != transaction || static_cast<quint8>(header[6]) != unit) {
+        qWarning() << "Response does not match transaction" << transaction << "of unit" << unit;
+        return QByteArray();
+    }
+    return response;
+}
+
+bool ModbusLoopbackTest::runChecks(ModbusMap *modbusMap, NeuronSharedImage *sharedImage)
+{
+    QByteArray response = request(1, pdu(0x03, 0, 4));
+    bool registersMatch = response.size() == 9 && response.at(1) == 8;
+    for (int i = 0; registersMatch && i < 4; i++) {
+        registersMatch = responseWord(response, 2 + i * 2) == registerValue(1, i);
+    }
+    if (!check(registersMatch, "Holding registers 0 to 3 of unit 1")) {
+        return false;
+    }
+
+    // A digital input of the last sub-node and its register word, their "Via Unit 0" addresses
+    // differ from the ones of their unit on models with several sub-nodes
+    int lastUnit = sharedImage->unitCount();
+    const ModbusMapImage::Entry *input = nullptr;
+    for (int i = 0; !input && i < modbusMap->circuitCount(ModbusMapImage::CircuitTypeDigitalInput); i++) {
+        const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(ModbusMapImage::CircuitTypeDigitalInput, i));
+        if (entry.subNode == lastUnit && entry.dataType == ModbusMapImage::DataTypeMixedBits) {
+            input = &entry;
+        }
+    }
+    const ModbusMapImage::Entry *word = nullptr;
+    for (int i = 0; input && !word && i < modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i));
+        if (entry.subNode == lastUnit && entry.address == input->registerAddress) {
+            word = &entry;
+        }
+    }
+    if (!check(input && word, QString("Digital input of unit %1 in the modbus map").arg(lastUnit))) {
+        return false;
+    }
+
+    quint16 inputRegister = registerValue(lastUnit, word->address);
+    foreach (quint8 unitZero, QList<quint8>() << 0 << 255) {
+        response = request(unitZero, pdu(0x04, word->unitZeroAddress, 1));
+        if (!check(response.size() == 4 && responseWord(response, 2) == inputRegister,
+                   QString("Register %1 of unit %2 via unit %3 at %4").arg(word->address).arg(lastUnit).arg(unitZero).arg(word->unitZeroAddress))) {
+            return false;
+        }
+    }
+    response = request(0, pdu(0x02, input->unitZeroAddress, 1));
+    if (!check(response.size() == 3 && (response.at(2) & 1) == ((inputRegister >> input->startBit) & 1),
+               QString("Digital input coil %1 of unit %2 via unit 0").arg(input->address).arg(lastUnit))) {
+        return false;
+    }
+
+    // Writes are posted as commands of the resolved sub-node
+    response = request(0, pdu(0x06, word->unitZeroAddress, 0x1234));
+    if (!check(response == pdu(0x06, word->unitZeroAddress, 0x1234)
+               && checkCommand(sharedImage, lastUnit, NeuronSharedImage::CommandWriteRegister, word->address, 0x1234),
+               QString("Register write to unit %1 via unit 0").arg(lastUnit))) {
+        return false;
+    }
+    response = request(1, pdu(0x05, 0, 0xff00));
+    if (!check(response == pdu(0x05, 0, 0xff00) && checkCommand(sharedImage, 1, NeuronSharedImage::CommandWriteBit, 0, 1), "Coil write to unit 1")) {
+        return false;
+    }
+
+    // Registers beyond the basic ones are not scanned by neurond, their image words are no values
+    // Several entries may share a register, none of them may be basic
+    QSet<quint32> basicRegisters;
+    for (int i = 0; i < modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i));
+        for (int j = 0; entry.category == ModbusMapImage::CategoryBasic && j < qMax<int>(entry.count, 1); j++) {
+            basicRegisters.insert((static_cast<quint32>(entry.subNode) << 16) | static_cast<quint16>(entry.address + j));
+        }
+    }
+    const ModbusMapImage::Entry *unpublished = nullptr;
+    for (int i = 0; !unpublished && i < modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i));
+        if (entry.category != ModbusMapImage::CategoryBasic && entry.category != ModbusMapImage::CategoryReserved
+                && !basicRegisters.contains((static_cast<quint32>(entry.subNode) << 16) | entry.address)) {
+            unpublished = &entry;
+        }
+    }
+    if (!check(unpublished, "Register beyond the basic ones in the modbus map")) {
+        return false;
+    }
+    response = request(0, pdu(0x03, unpublished->unitZeroAddress, 1));
+    if (!check(response.size() == 2 && static_cast<quint8>(response.at(0)) == 0x83 && response.at(1) == 0x02,
+               QString("Exception for unpublished register %1 of unit %2 via unit 0").arg(unpublished->address).arg(unpublished->subNode))) {
+        return false;
+    }
+    response = request(unpublished->subNode, pdu(0x03, unpublished->address, 1));
+    if (!check(response.size() == 2 && static_cast<quint8>(response.at(0)) == 0x83 && response.at(1) == 0x02,
+               QString("Exception for unpublished register %1 of unit %2").arg(unpublished->address).arg(unpublished->subNode))) {
+        return false;
+    }
+
+    response = request(0, pdu(0x03, 0xfff0, 1));
+    return check(response.size() == 2 && static_cast<quint8>(response.at(0)) == 0x83 && response.at(1) == 0x02, "Exception for an address without register via unit 0");
+}
+
+bool ModbusLoopbackTest::checkCommand(NeuronSharedImage *sharedImage, int unit, int type, quint16 address, quint16 value)
+{
+    NeuronSharedImage::Command command;
+    if (sharedImage->takeCommands(&command, 1) != 1) {
+        return false;
+    }
+    return command.unit == unit && command.type == type && command.address == address && command.value == value;
+}
+
+bool ModbusLoopbackTest::check(bool condition, const QString &description)
+{
+    if (condition) {
+        qInfo() << "Passed:" << description;
+    } else {
+        qWarning() << "Failed:" << description;
+    }
+    return condition;
+}
@@ -0,0 +1,60 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MODBUSLOOPBACKTEST_H
+#define MODBUSLOOPBACKTEST_H
+
+#include <QObject>
+#include <QVector>
+
+class ModbusMap;
+class NeuronSharedImage;
+
+// Checks the Modbus TCP server of neurond without hardware. The server answers
+// from a shared image with known register values, the client is a plain socket
+// on the loopback interface. Units 1..n and the "Via Unit 0" layout are read and
+// written, writes must arrive as commands of the right sub-node.
+class ModbusLoopbackTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModbusLoopbackTest(QObject *parent = nullptr);
+    ~ModbusLoopbackTest() override;
+
+    // Returns false on the first failed check
+    bool run(const QString &neuronModel);
+
+private:
+    int m_socket = -1;
+    quint16 m_transaction = 0;
+    const int m_timeout = 1000; // In milliseconds
+
+    static quint16 registerValue(int unit, quint16 address);
+    bool connectServer(quint16 port);
+    bool receive(char *data, int length);
+    QByteArray request(quint8 unit, const QByteArray &pdu);
+    bool runChecks(ModbusMap *modbusMap, NeuronSharedImage *sharedImage);
+    bool checkCommand(NeuronSharedImage *sharedImage, int unit, int type, quint16 address, quint16 value);
+    bool check(bool condition, const QString &description);
+};
+
+#endif // MODBUSLOOPBACKTEST_H
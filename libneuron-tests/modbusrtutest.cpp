@@ -0,0 +1,101 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "modbusrtutest.h"
+#include "neuronmodbusrtu.h"
+#include "rtuslavesimulator.h"
+
+#include <QEventLoop>
+#include <QTimer>
+#include <QDebug>
+
+ModbusRtuTest::ModbusRtuTest(QObject *parent) :
+    QObject{parent}
+{
+
+}
+
+bool ModbusRtuTest::run()
+{
+    NeuronModbusRtu bus;
+    bus.setBaudRate(m_baudRate);
+    bus.setResponseTimeout(200);
+    RtuSlaveSimulator slave(1, 16, m_baudRate);
+    slave.connectBus(&bus);
+    slave.setRegisterValue(0, 0x1111);
+    slave.setRegisterValue(1, 0x2222);
+
+    // The copy arrives before the line was silent, it must not answer the next request
+    slave.duplicateNextResponse();
+    QList<SpiResult> results = waitForResults(QList<SpiReply *>() << bus.readRegisters(1, 0, 1) << bus.readRegisters(1, 1, 1));
+    if (!check(results.count() == 2 && results.at(0).values == QVector<quint16>() << 0x1111 && results.at(1).values == QVector<quint16>() << 0x2222,
+               "A duplicated response is dropped")) {
+        return false;
+    }
+    if (!check(bus.statistics().discardedBytes == 7, "The duplicated response is counted as discarded")) {
+        return false;
+    }
+
+    // Arrives after the timeout, while the next request would wait for its response without the quiet period
+    slave.delayNextResponse(140);
+    results = waitForResults(QList<SpiReply *>() << bus.readRegisters(1, 0, 1) << bus.readRegisters(1, 1, 1));
+    if (!check(results.count() == 2 && results.at(0).error == SpiError::TimeoutError && results.at(1).values == QVector<quint16>() << 0x2222,
+               "A late response is dropped after the timeout")) {
+        return false;
+    }
+
+    qInfo() << "Modbus RTU framing checks passed";
+    return true;
+}
+
+QList<SpiResult> ModbusRtuTest::waitForResults(const QList<SpiReply *> &replies)
+{
+    QEventLoop loop;
+    QList<SpiResult> results;
+    int pending = replies.count();
+    for (int i = 0; i < replies.count(); i++) {
+        results.append(SpiResult());
+        replies.at(i)->then(this, [&results, &pending, &loop, i] (const SpiResult &result) {
+            results[i] = result;
+            if (--pending == 0) {
+                loop.quit();
+            }
+        });
+    }
+    QTimer::singleShot(3000, &loop, &QEventLoop::quit);
+    loop.exec();
+    if (pending > 0) {
+        qWarning() << pending << "Modbus RTU requests did not finish";
+        return QList<SpiResult>();
+    }
+    return results;
+}
+
+bool ModbusRtuTest::check(bool condition, const QString &description)
+{
+    if (condition) {
+        qInfo() << "Passed:" << description;
+    } else {
+        qWarning() << "Failed:" << description;
+    }
+    return condition;
+}
@@ -0,0 +1,50 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MODBUSRTUTEST_H
+#define MODBUSRTUTEST_H
+
+#include <QObject>
+#include <QList>
+
+#include "spimessage.h"
+
+// Checks the framing of the Modbus RTU master without hardware. A simulated slave
+// answers with the faults of a noisy line, a duplicated or a late response, and
+// the following request must still get its own response.
+class ModbusRtuTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModbusRtuTest(QObject *parent = nullptr);
+
+    // Returns false on the first failed check
+    bool run();
+
+private:
+    const int m_baudRate = 1200; // Slow enough that the line times dominate the timer accuracy
+
+    QList<SpiResult> waitForResults(const QList<SpiReply *> &replies);
+    bool check(bool condition, const QString &description);
+};
+
+#endif // MODBUSRTUTEST_H
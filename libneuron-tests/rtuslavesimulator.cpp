@@ -0,0 +1,181 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "rtuslavesimulator.h"
+#include "neuronmodbusrtu.h"
+
+#include <QTimer>
+#include <QDebug>
+
+RtuSlaveSimulator::RtuSlaveSimulator(quint8 slaveAddress, int registerCount, int baudRate, QObject *parent) :
+    QObject{parent},
+    m_slaveAddress(slaveAddress),
+    m_baudRate(baudRate),
+    m_registers(registerCount, 0),
+    m_coils(registerCount, false)
+{
+
+}
+
+void RtuSlaveSimulator::connectBus(NeuronModbusRtu *bus)
+{
+    connect(bus, &NeuronModbusRtu::transmit, this, &RtuSlaveSimulator::receive);
+    connect(this, &RtuSlaveSimulator::transmit, bus, &NeuronModbusRtu::receive);
+}
+
+quint16 RtuSlaveSimulator::registerValue(quint16 address) const
+{
+    return m_registers.value(address);
+}
+
+void RtuSlaveSimulator::setRegisterValue(quint16 address, quint16 value)
+{
+    if (address < m_registers.count()) {
+        m_registers[address] = value;
+    }
+}
+
+bool RtuSlaveSimulator::coil(quint16 address) const
+{
+    return m_coils.value(address);
+}
+
+void RtuSlaveSimulator::delayNextResponse(int milliseconds)
+{
+    m_nextResponseDelay = milliseconds;
+}
+
+void RtuSlaveSimulator::duplicateNextResponse()
+{
+    m_duplicateNextResponse = true;
+}
+
+void RtuSlaveSimulator::receive(const QByteArray &data)
+{
+    m_rxBuffer.append(data);
+    int length = requestLength();
+    if (length < 0 || m_rxBuffer.size() < length) {
+        return;
+    }
+    QByteArray request = m_rxBuffer.left(length);
+    m_rxBuffer.clear();
+
+    if ((quint8)request.at(0) != m_slaveAddress) {
+        return;
+    }
+    quint16 checksum = (quint8)request.at(length - 2) | ((quint8)request.at(length - 1) << 8);
+    if (checksum != NeuronModbusRtu::crc(request.constData(), length - 2)) {
+        qWarning() << "Simulated slave" << m_slaveAddress << "received a frame with invalid CRC";
+        return;
+    }
+
+    QByteArray response = handleRequest(request);
+    checksum = NeuronModbusRtu::crc(response.constData(), response.size());
+    response.append((char)(checksum & 0xff)).append((char)(checksum >> 8));
+
+    // 10 bits per character for request and response
+    int lineTime = (request.size() + response.size()) * 10 * 1000 / m_baudRate;
+    // A duplicated response follows right behind the first one, before the line was silent
+    bool duplicate = m_duplicateNextResponse;
+    QTimer::singleShot(lineTime + m_nextResponseDelay, this, [this, response, duplicate] {
+        emit transmit(response);
+        if (duplicate) {
+            emit transmit(response);
+        }
+    });
+    m_nextResponseDelay = 0;
+    m_duplicateNextResponse = false;
+}
+
+int RtuSlaveSimulator::requestLength() const
+{
+    if (m_rxBuffer.size() < 2) {
+        return -1;
+    }
+    switch ((quint8)m_rxBuffer.at(1)) {
+    case 0x03:
+    case 0x05:
+    case 0x06:
+        return 8;
+    case 0x10:
+        return m_rxBuffer.size() < 7 ? -1 : 9 + (quint8)m_rxBuffer.at(6);
+    default:
+        // Unknown functions are answered after their address and function
+        return 4;
+    }
+}
+
+QByteArray RtuSlaveSimulator::handleRequest(const QByteArray &request)
+{
+    quint8 function = request.at(1);
+    if (request.size() < 8) {
+        return exception(function, 0x01);
+    }
+    quint16 address = ((quint8)request.at(2) << 8) | (quint8)request.at(3);
+    quint16 value = ((quint8)request.at(4) << 8) | (quint8)request.at(5);
+
+    QByteArray response;
+    response.append((char)m_slaveAddress).append((char)function);
+    switch (function) {
+    case 0x03:
+        if (value < 1 || value > 125 || address + value > m_registers.count()) {
+            return exception(function, 0x02);
+        }
+        response.append((char)(value * 2));
+        for (int i = address; i < address + value; i++) {
+            response.append((char)(m_registers.at(i) >> 8)).append((char)(m_registers.at(i) & 0xff));
+        }
+        return response;
+    case 0x05:
+        if (address >= m_coils.count()) {
+            return exception(function, 0x02);
+        }
+        m_coils[address] = value == 0xff00;
+        return request.left(6);
+    case 0x06:
+        if (address >= m_registers.count()) {
+            return exception(function, 0x02);
+        }
+        m_registers[address] = value;
+        return request.left(6);
+    case 0x10:
+        if ((quint8)request.at(6) != value * 2) {
+            return exception(function, 0x03);
+        }
+        if (address + value > m_registers.count()) {
+            return exception(function, 0x02);
+        }
+        for (int i = 0; i < value; i++) {
+            m_registers[address + i] = ((quint8)request.at(7 + 2 * i) << 8) | (quint8)request.at(8 + 2 * i);
+        }
+        return request.left(6);
+    default:
+        return exception(function, 0x01);
+    }
+}
+
+QByteArray RtuSlaveSimulator::exception(quint8 function, quint8 code) const
+{
+    QByteArray response;
+    response.append((char)m_slaveAddress).append((char)(function | 0x80)).append((char)code);
+    return response;
+}
@@ -0,0 +1,69 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef RTUSLAVESIMULATOR_H
+#define RTUSLAVESIMULATOR_H
+
+#include <QObject>
+#include <QVector>
+
+class NeuronModbusRtu;
+
+// Simulated extension module answering Modbus RTU requests like a slave on the RS485 line.
+// Responses are delayed by the time the request and the response need on the line.
+class RtuSlaveSimulator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RtuSlaveSimulator(quint8 slaveAddress, int registerCount, int baudRate = 19200, QObject *parent = nullptr);
+
+    void connectBus(NeuronModbusRtu *bus);
+
+    quint16 registerValue(quint16 address) const;
+    void setRegisterValue(quint16 address, quint16 value);
+    bool coil(quint16 address) const;
+
+    // Faults of a slave on a noisy line, applied to the next response only
+    void delayNextResponse(int milliseconds);
+    void duplicateNextResponse();
+
+private:
+    quint8 m_slaveAddress;
+    int m_baudRate;
+    QVector<quint16> m_registers;
+    QVector<bool> m_coils;
+    QByteArray m_rxBuffer;
+    int m_nextResponseDelay = 0; // In milliseconds on top of the line time
+    bool m_duplicateNextResponse = false;
+
+    int requestLength() const;
+    QByteArray handleRequest(const QByteArray &request);
+    QByteArray exception(quint8 function, quint8 code) const;
+
+public slots:
+    void receive(const QByteArray &data);
+
+signals:
+    void transmit(const QByteArray &frame);
+};
+
+#endif // RTUSLAVESIMULATOR_H
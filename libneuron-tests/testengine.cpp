@@ -21,6 +21,13 @@
 // SOFTWARE.
 
 #include "testengine.h"
+#include "neuronregister.h"
+#include "neuroncalibration.h"
+#include "neuronprocessimage.h"
+#include "neuronmodbusrtu.h"
+#include "neuronextension.h"
+#include "neuronuart.h"
+#include "rtuslavesimulator.h"
 
 #include <QTimer>
 #include <QDebug>
@@ -32,66 +39,203 @@ TestEngine::TestEngine(QObject *parent) :
 
 }
 
-bool TestEngine::loadMobusMap(const QString &neuronModel)
+void TestEngine::addExtension(const QString &extensionModel)
 {
-    m_modbusMap = new ModbusMap(neuronModel, this);
-    return m_modbusMap->loadModbusMap();
+    m_extensionModels.append(extensionModel);
 }
 
-bool TestEngine::initHardware()
+void TestEngine::setSimulateExtensions(bool simulate)
 {
-    int subNodes = m_modbusMap->numberOfNodes();
-
-    for (int i=0; i< subNodes; i++) {
-        NeuronSpi *spi = new NeuronSpi(i);
-        qDebug() << "Init SPI" << i;
-        if (!spi->init()) {
-            qWarning() << "Could not init SPI";
-            return false;
-        }
+    m_simulateExtensions = simulate;
+}
 
-        if (!spi->idleOperation()) {
-            qWarning() << "Could not send idle operation message";
-            return false;
-        }
-        m_spiList.append(spi);
+bool TestEngine::loadMobusMap(const QString &neuronModel)
+{
+    m_modbusMap = new ModbusMap(neuronModel, this);
+    foreach (const QString &extensionModel, m_extensionModels) {
+        m_modbusMap->addExtension(extensionModel);
+    }
+    if (!m_modbusMap->loadModbusMap()) {
+        return false;
+    }
+
+    // The configuration of each sub-node is read once, the process image converts the analog groups every cycle
+    for (int i = 0; i < m_spiList.count(); i++) {
+        NeuronCalibration *calibration = new NeuronCalibration(m_spiList.at(i), m_modbusMap, i + 1, this);
+        connect(calibration, &NeuronCalibration::loaded, this, [calibration] (bool success) {
+            QStringList inputs;
+            for (int channel = 0; channel < calibration->analogInputChannels().count(); channel++) {
+                inputs.append(calibration->analogInputChannels().at(channel) + " " + NeuronCalibration::unitName(calibration->analogInputUnit(channel)));
+            }
+            qCDebug(dcNeuronCalibration()) << "Configuration of sub-node" << calibration->subNode() << (success ? "loaded" : "failed") << "analog inputs" << inputs << "analog outputs" << calibration->analogOutputChannels();
+        });
+        calibration->load();
+        m_calibrations.append(calibration);
     }
     return true;
 }
 
+bool TestEngine::initHardware(const QString &neuronModel)
+{
+    m_spiList = NeuronSpi::initSubNodes(neuronModel, &m_model, m_probeTimeout, this);
+    return !m_spiList.isEmpty();
+}
+
+void TestEngine::initSimulation(const QString &neuronModel)
+{
+    m_spiList.clear();
+    m_model = neuronModel;
+}
+
+QString TestEngine::model() const
+{
+    return m_model;
+}
+
 void TestEngine::setAllDigitalOutputs(bool value)
 {
-    foreach (RegisterDescriptor reg, m_modbusMap->digitalOutputRegisters().values()) {
-        auto spi = m_spiList.at(reg.subNode()-1);
-        spi->writeBit(reg.address(), value);
-        QTest::qWait(1); //Wait for 10 ms
-    }
+    setAllCircuits(ModbusMapImage::CircuitTypeDigitalOutput, value);
 }
 
 void TestEngine::setAllRelayOutputs(bool value)
 {
-    foreach (RegisterDescriptor reg, m_modbusMap->relayOutputRegisters().values()) {
-        auto spi = m_spiList.at(reg.subNode()-1);
-        spi->writeBit(reg.address(), value);
-        QTest::qWait(1); //Wait for 10 ms
-    }
+    setAllCircuits(ModbusMapImage::CircuitTypeRelayOutput, value);
 }
 
 void TestEngine::setAllUserLEDs(bool value)
 {
-    foreach (RegisterDescriptor reg, m_modbusMap->userLEDRegisters().values()) {
-        auto spi = m_spiList.at(reg.subNode()-1);
-        spi->writeBit(reg.address(), value);
+    setAllCircuits(ModbusMapImage::CircuitTypeUserLED, value);
+}
+
+void TestEngine::setAllCircuits(ModbusMapImage::CircuitType type, bool value)
+{
+    for (int i = 0; i < m_modbusMap->circuitCount(type); i++) {
+        const ModbusMapImage::Entry &circuit = m_modbusMap->circuit(m_modbusMap->circuitHandle(type, i));
+        NeuronSpi *spi = subNode(circuit);
+        if (!spi) {
+            continue;
+        }
+        spi->writeBit(circuit.address, value);
         QTest::qWait(1); //Wait for 10 ms
     }
 }
 
+void TestEngine::startMonitor(double deadband)
+{
+    m_processImage = new NeuronProcessImage(m_modbusMap, m_spiList, this);
+    setupExtensions();
+    foreach (NeuronCalibration *calibration, m_calibrations) {
+        m_processImage->setCalibration(calibration);
+    }
+    for (int i = 0; i < m_modbusMap->circuitCount(ModbusMapImage::CircuitTypeDigitalInput); i++) {
+        ModbusMap::CircuitHandle circuit = m_modbusMap->circuitHandle(ModbusMapImage::CircuitTypeDigitalInput, i);
+        if (isAvailable(m_modbusMap->circuit(circuit).subNode)) {
+            m_processImage->subscribe(circuit);
+        }
+    }
+    for (int i = 0; i < m_modbusMap->circuitCount(ModbusMapImage::CircuitTypeAnalogInput); i++) {
+        ModbusMap::CircuitHandle circuit = m_modbusMap->circuitHandle(ModbusMapImage::CircuitTypeAnalogInput, i);
+        if (isAvailable(m_modbusMap->circuit(circuit).subNode)) {
+            m_processImage->subscribe(circuit, deadband);
+        }
+    }
+    connect(m_processImage, &NeuronProcessImage::changed, this, [this] (const QList<NeuronProcessImage::Change> &changes) {
+        foreach (const NeuronProcessImage::Change &change, changes) {
+            qInfo() << m_modbusMap->circuitName(change.circuit) << "sub-node" << m_modbusMap->circuit(change.circuit).subNode << change.previousValue << "->" << change.value;
+        }
+    });
+    m_processImage->start();
+}
+
+void TestEngine::setupExtensions()
+{
+    if (m_extensionModels.isEmpty()) {
+        return;
+    }
+
+    NeuronModbusRtu *bus = new NeuronModbusRtu(this);
+    if (!m_simulateExtensions) {
+        NeuronUart *uart = new NeuronUart(m_spiList.first(), 0, 4096, this);
+        bus->setUart(uart);
+        uart->open();
+    }
+
+    int firstSubNode = ModbusMap::numberOfNodes(m_model) + 1;
+    for (int i = 0; i < m_extensionModels.count(); i++) {
+        int subNode = firstSubNode + i;
+        quint8 slaveAddress = i + 1;
+        if (m_simulateExtensions) {
+            RtuSlaveSimulator *slave = new RtuSlaveSimulator(slaveAddress, m_modbusMap->nodeRange(subNode).lastRegister + 1, 19200, this);
+            slave->connectBus(bus);
+            // The simulated digital inputs in register 0 count up every second
+            QTimer *inputTimer = new QTimer(this);
+            connect(inputTimer, &QTimer::timeout, slave, [slave] {
+                slave->setRegisterValue(0, slave->registerValue(0) + 1);
+            });
+            inputTimer->start(1000);
+        }
+        NeuronExtension *extension = new NeuronExtension(bus, slaveAddress, m_extensionModels.at(i), this);
+        m_processImage->addExtension(subNode, extension);
+        qDebug() << "Extension" << m_extensionModels.at(i) << "slave address" << slaveAddress << "is sub-node" << subNode;
+    }
+}
+
+NeuronSpi *TestEngine::subNode(const ModbusMapImage::Entry &circuit)
+{
+    NeuronSpi *spi = m_spiList.value(circuit.subNode-1);
+    if (!spi) {
+        qWarning() << "Subnote" << circuit.subNode << "does not exist";
+    }
+    return spi;
+}
+
+bool TestEngine::isAvailable(int subNode) const
+{
+    // Local sub-nodes need their SPI device, extensions follow the local sub-nodes of the model
+    return subNode <= m_spiList.count() || subNode > ModbusMap::numberOfNodes(m_model);
+}
 
 void TestEngine::start(Configuration *config)
 {
     foreach (TestDescriptor testDescriptor, config->testDesriptors()) {
 
-        Test *test = new Test(testDescriptor, this);
+        // Circuit names are resolved once here, the test actions only pass handles around
+        ModbusMap::CircuitHandle inputCircuit = ModbusMap::InvalidCircuitHandle;
+        ModbusMap::CircuitHandle outputCircuit = ModbusMap::InvalidCircuitHandle;
+        switch (testDescriptor.testType()) {
+        case TestDescriptor::TestType::DigitalIOConnection:
+            outputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeRelayOutput, testDescriptor.outputCircuit());
+            if (outputCircuit == ModbusMap::InvalidCircuitHandle) {
+                outputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeDigitalOutput, testDescriptor.outputCircuit());
+            }
+            if (outputCircuit == ModbusMap::InvalidCircuitHandle) {
+                qWarning() << "Digital output does not exist:" << testDescriptor.outputCircuit();
+                continue;
+            }
+            inputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeDigitalInput, testDescriptor.inputCircuit());
+            break;
+        case TestDescriptor::TestType::AnalogIOConnection:
+            outputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeAnalogOutput, testDescriptor.outputCircuit());
+            if (outputCircuit == ModbusMap::InvalidCircuitHandle) {
+                qWarning() << "Analog output does not exist:" << testDescriptor.outputCircuit();
+                continue;
+            }
+            inputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeAnalogInput, testDescriptor.inputCircuit());
+            if (inputCircuit == ModbusMap::InvalidCircuitHandle) {
+                qWarning() << "Analog input does not exist:" << testDescriptor.inputCircuit();
+                continue;
+            }
+            break;
+        case TestDescriptor::TestType::ReadDigitalInput:
+            inputCircuit = m_modbusMap->resolveCircuit(ModbusMapImage::CircuitTypeDigitalInput, testDescriptor.inputCircuit());
+            break;
+        }
+        if (testDescriptor.testType() != TestDescriptor::TestType::AnalogIOConnection && inputCircuit == ModbusMap::InvalidCircuitHandle) {
+            qWarning() << "Digital input does not exist:" << testDescriptor.inputCircuit();
+            continue;
+        }
+
+        Test *test = new Test(testDescriptor, inputCircuit, outputCircuit, this);
         m_tests.append(test);
 
         connect(test, &Test::setDigitalOutput, this, &TestEngine::onSetDigtialOutput);
@@ -113,115 +257,100 @@ void TestEngine::onTestError(const QUuid &testId, const QString &errorString)
     qDebug() << testId << errorString;
 }
 
-void TestEngine::onSetDigtialOutput(const QString &output, bool value)
+void TestEngine::onSetDigtialOutput(ModbusMap::CircuitHandle output, bool value)
 {
-    if(!m_modbusMap->relayOutputRegisters().contains(output)) {
-        qWarning() << "Digital output does not exist:" << output;
+    const ModbusMapImage::Entry &reg = m_modbusMap->circuit(output);
+    NeuronSpi *spi = subNode(reg);
+    if (!spi) {
         return;
     }
-    auto reg = m_modbusMap->relayOutputRegisters().value(output);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
-        return;
-    }
-    qDebug() << "Write bit. Subnode" << reg.subNode() << "address" << reg.address() << "value" << value;
-    m_spiList.at(reg.subNode()-1)->writeBit(reg.address(), value);
+    qDebug() << "Write bit. Subnode" << reg.subNode << "address" << reg.address << "value" << value;
+    spi->writeBit(reg.address, value);
 }
 
-void TestEngine::onSetAnalogOutput(const QString &output, double value)
+void TestEngine::onSetAnalogOutput(ModbusMap::CircuitHandle output, double value)
 {
-    if(!m_modbusMap->analogOutputRegisters().contains(output)) {
-        qWarning() << "Analog output does not exist:" << output;
+    const ModbusMapImage::Entry &reg = m_modbusMap->circuit(output);
+    NeuronSpi *spi = subNode(reg);
+    if (!spi) {
         return;
     }
-    auto reg = m_modbusMap->analogOutputRegisters().value(output);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
+
+    QVector<quint16> registers(reg.count);
+    if (reg.dataType == ModbusMapImage::DataTypeReal && reg.count == 2) {
+        Register<float, BigEndianWords>::encode(value, registers.data());
+    } else if (reg.dataType == ModbusMapImage::DataTypeWord && reg.count == 1) {
+        // Raw analog outputs map 0..4000 to 0..10 V
+        ScaledRegister<quint16, 10, 4000>::encode(value, registers.data());
+    } else {
+        qWarning() << "Unsupported analog output data type" << reg.dataType << "of" << m_modbusMap->circuitName(output);
         return;
     }
-    uint16_t regValue[2];
-    regValue[0] = ((uint32_t)value >> 16);
-    regValue[1] = ((uint32_t)value & 0xffff);
-    m_spiList.at(reg.subNode()-1)->writeRegisters(reg.address(), 2, regValue);
+    SpiReply *reply = spi->writeRegisters(reg.address, registers);
+    if (reply) {
+        connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+    }
 }
 
-bool TestEngine::onReadDigitalInput(const QString &inputCircuit)
+bool TestEngine::onReadDigitalInput(ModbusMap::CircuitHandle inputCircuit)
 {
-    if(!m_modbusMap->digitalInputRegisters().contains(inputCircuit)) {
-        qWarning() << "Analog input does not exist:" << inputCircuit;
+    const ModbusMapImage::Entry &reg = m_modbusMap->circuit(inputCircuit);
+    NeuronSpi *spi = subNode(reg);
+    if (!spi) {
         return false;
     }
-    auto reg = m_modbusMap->digitalInputRegisters().value(inputCircuit);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
-        return false;
-    }
-    uint8_t value;
-    m_spiList.at(reg.subNode()-1)->readBits(reg.address(), 1, &value);
-    return (value > 0);
+    // Answered from the Spi worker thread, so waiting here does not need the event loop
+    SpiResult result = spi->readBits(reg.address, 1)->toFuture().get();
+    return result.isSuccess() && (result.values.value(0) & 1);
 }
 
-bool TestEngine::onReadDigitalOutput(const QString &outputCircuit)
+bool TestEngine::onReadDigitalOutput(ModbusMap::CircuitHandle outputCircuit)
 {
-    if(!m_modbusMap->digitalOutputRegisters().contains(outputCircuit)) {
-        qWarning() << "Digital output does not exist:" << outputCircuit;
+    const ModbusMapImage::Entry &reg = m_modbusMap->circuit(outputCircuit);
+    NeuronSpi *spi = subNode(reg);
+    if (!spi) {
         return false;
     }
-
-    auto reg = m_modbusMap->digitalOutputRegisters().value(outputCircuit);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
-        return false;
-    }
-    uint8_t value;
-    m_spiList.at(reg.subNode()-1)->readBits(reg.address(), 1, &value);
-    return (value > 0);
+    // Answered from the Spi worker thread, so waiting here does not need the event loop
+    SpiResult result = spi->readBits(reg.address, 1)->toFuture().get();
+    return result.isSuccess() && (result.values.value(0) & 1);
 }
 
-bool TestEngine::onReadAnalogInput(const QString &inputCircuit)
+bool TestEngine::onReadAnalogInput(ModbusMap::CircuitHandle inputCircuit)
 {
-    if(!m_modbusMap->analogInputRegisters().contains(inputCircuit)) {
-        qWarning() << "Analog input does not exist:" << inputCircuit;
-        return false;
-    }
-    auto reg = m_modbusMap->analogOutputRegisters().value(inputCircuit);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
-        return false;
-    }
+    return readAnalogValue(inputCircuit);
+}
 
-    auto reply = m_spiList.at(reg.subNode()-1)->readRegisters(reg.address(), 2);
-    connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
-    connect(reply, &SpiReply::finished, this, [=] {
-        //uint16_t regValue[2];
-        //((regValue[1]<<16) & regValue[0]);
-    });
-    return true;
+bool TestEngine::onReadAnalogOutput(ModbusMap::CircuitHandle outputCircuit)
+{
+    return readAnalogValue(outputCircuit);
 }
 
-bool TestEngine::onReadAnalogOutput(const QString &outputCircuit)
+bool TestEngine::readAnalogValue(ModbusMap::CircuitHandle circuit)
 {
-    if(!m_modbusMap->analogOutputRegisters().contains(outputCircuit)) {
-        qWarning() << "Analog output does not exist:" << outputCircuit;
-        return false;
-    }
-    auto reg = m_modbusMap->analogOutputRegisters().value(outputCircuit);
-    if (m_spiList.at(reg.subNode()-1) == nullptr) {
-        qWarning() << "Subnote" << reg.subNode() << "does not exist";
+    const ModbusMapImage::Entry &reg = m_modbusMap->circuit(circuit);
+    NeuronSpi *spi = subNode(reg);
+    if (!spi) {
         return false;
     }
-    auto reply = m_spiList.at(reg.subNode()-1)->readRegisters(reg.address(), 2);
+
+    auto reply = spi->readRegisters(reg.address, reg.count);
     connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
-    connect(reply, &SpiReply::finished, this, [=] {
-        //uint16_t regValue[2];
-        //((regValue[1]<<16) & regValue[0]);
+    connect(reply, &SpiReply::finished, this, [this, reply, reg, circuit] {
+        if (reply->error() != SpiError::NoError || reply->result().count() < reg.count) {
+            qWarning() << "Could not read" << m_modbusMap->circuitName(circuit) << reply->errorString();
+            return;
+        }
+        qDebug() << "Analog value" << m_modbusMap->circuitName(circuit) << ModbusMapImage::decode(reg, reply->result().constData());
     });
     return true;
 }
 
-Test::Test(TestDescriptor testDescriptor, QObject *parent) :
+Test::Test(TestDescriptor testDescriptor, ModbusMap::CircuitHandle inputCircuit, ModbusMap::CircuitHandle outputCircuit, QObject *parent) :
     QObject{parent},
-    m_testDescriptor(testDescriptor)
+    m_testDescriptor(testDescriptor),
+    m_inputCircuit(inputCircuit),
+    m_outputCircuit(outputCircuit)
 {
     m_testId = QUuid::createUuid();
 
@@ -245,12 +374,12 @@ void Test::action()
     case TestDescriptor::TestType::DigitalIOConnection: {
         if (m_lastDigitalValue == true) {
             m_lastDigitalValue = false;
-            emit setDigitalOutput(m_testDescriptor.outputCircuit(), false);
+            emit setDigitalOutput(m_outputCircuit, false);
         } else {
             m_lastDigitalValue = true;
-            emit setDigitalOutput(m_testDescriptor.outputCircuit(), true);
+            emit setDigitalOutput(m_outputCircuit, true);
         }
-        bool value = readDigitalInput(m_testDescriptor.inputCircuit());
+        bool value = readDigitalInput(m_inputCircuit);
         if (value != m_lastDigitalValue) {
             emit testError(m_testId, "Input value differs from output value");
         }
@@ -262,12 +391,12 @@ void Test::action()
         } else {
             m_lastAnalogValue += 0.5;
         }
-        emit setAnalogOutput(m_testDescriptor.outputCircuit(), m_lastAnalogValue);
+        emit setAnalogOutput(m_outputCircuit, m_lastAnalogValue);
         //TODO read analog input and compare to output
         break;
     }
     case TestDescriptor::TestType::ReadDigitalInput: {
-        readDigitalInput(m_testDescriptor.inputCircuit());
+        readDigitalInput(m_inputCircuit);
         break;
     }
     }
@@ -33,6 +33,8 @@
 #include "neuronspi.h"
 
 class Test;
+class NeuronCalibration;
+class NeuronProcessImage;
 
 class TestEngine : public QObject
 {
@@ -40,30 +42,51 @@ class TestEngine : public QObject
 public:
     explicit TestEngine(QObject *parent = nullptr);
 
-    bool initHardware();
+    // Probes all sub-nodes concurrently, detects the model if none is given
+    bool initHardware(const QString &neuronModel = QString());
+    // Runs without SPI hardware, only simulated extensions are available, the model must be given
+    void initSimulation(const QString &neuronModel);
+    QString model() const;
     void setAllDigitalOutputs(bool value);
     void setAllRelayOutputs(bool value);
     void setAllUserLEDs(bool value);
     void start(Configuration *config);
 
+    // Extension modules on the RS485 line get the slave addresses 1, 2, ... in the order they are added
+    void addExtension(const QString &extensionModel);
+    void setSimulateExtensions(bool simulate);
     bool loadMobusMap(const QString &neuronModel);
+    // Prints every change of the digital and analog inputs, analog changes below the deadband are suppressed
+    void startMonitor(double deadband);
 private:
     QList<NeuronSpi *> m_spiList;
+    QString m_model;
+    const int m_probeTimeout = 2000; // In milliseconds
 
     ModbusMap *m_modbusMap;
+    QList<NeuronCalibration *> m_calibrations;
     QList<Test *> m_tests;
+    NeuronProcessImage *m_processImage = nullptr;
+    QStringList m_extensionModels;
+    bool m_simulateExtensions = false;
+
+    void setAllCircuits(ModbusMapImage::CircuitType type, bool value);
+    NeuronSpi *subNode(const ModbusMapImage::Entry &circuit);
+    bool isAvailable(int subNode) const;
+    void setupExtensions();
+    bool readAnalogValue(ModbusMap::CircuitHandle circuit);
 
 private slots:
     void onTestError(const QUuid &testId, const QString &errorString);
 
-    void onSetDigtialOutput(const QString &output, bool value);
-    void onSetAnalogOutput(const QString &output, double value);
+    void onSetDigtialOutput(ModbusMap::CircuitHandle output, bool value);
+    void onSetAnalogOutput(ModbusMap::CircuitHandle output, double value);
 
-    bool onReadDigitalInput(const QString &inputCircuit);
-    bool onReadDigitalOutput(const QString &outputCircuit);
+    bool onReadDigitalInput(ModbusMap::CircuitHandle inputCircuit);
+    bool onReadDigitalOutput(ModbusMap::CircuitHandle outputCircuit);
 
-    bool onReadAnalogInput(const QString &inputCircuit);
-    bool onReadAnalogOutput(const QString &outputCircuit);
+    bool onReadAnalogInput(ModbusMap::CircuitHandle inputCircuit);
+    bool onReadAnalogOutput(ModbusMap::CircuitHandle outputCircuit);
 
 signals:
     void testsFinished();
@@ -73,11 +96,13 @@ class Test : public QObject
 {
     Q_OBJECT
 public:
-    explicit Test(TestDescriptor testDescriptor, QObject *parent = nullptr);
+    explicit Test(TestDescriptor testDescriptor, ModbusMap::CircuitHandle inputCircuit, ModbusMap::CircuitHandle outputCircuit, QObject *parent = nullptr);
 
 private:
     QUuid m_testId;
     TestDescriptor m_testDescriptor;
+    ModbusMap::CircuitHandle m_inputCircuit;
+    ModbusMap::CircuitHandle m_outputCircuit;
     QTimer *m_intervalTimer;
     bool m_lastDigitalValue = false;
     double m_lastAnalogValue = 0.00;
@@ -88,14 +113,14 @@ private slots:
 signals:
     void testError(const QUuid &testId, const QString &errorString);
 
-    void setDigitalOutput(const QString &output, bool value);
-    void setAnalogOutput(const QString &output, double value);
+    void setDigitalOutput(ModbusMap::CircuitHandle output, bool value);
+    void setAnalogOutput(ModbusMap::CircuitHandle output, double value);
 
-    bool readDigitalInput(const QString &outputCircuit);
-    bool readDigitalOutput(const QString &outputCircuit);
+    bool readDigitalInput(ModbusMap::CircuitHandle inputCircuit);
+    bool readDigitalOutput(ModbusMap::CircuitHandle outputCircuit);
 
-    bool readAnalogInput(const QString &outputCircuit);
-    bool readAnalogOutput(const QString &outputCircuit);
+    bool readAnalogInput(ModbusMap::CircuitHandle inputCircuit);
+    bool readAnalogOutput(ModbusMap::CircuitHandle outputCircuit);
 };
 
 #endif // TESTENGINE_H
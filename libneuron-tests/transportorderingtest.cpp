@@ -0,0 +1,132 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "transportorderingtest.h"
+
+#include <QDebug>
+
+#include <chrono>
+
+bool TransportOrderingTest::run()
+{
+    NeuronTransport transport(this);
+    NeuronTransport::RetryPolicy policy;
+    policy.maxRetries = 0;
+    policy.resyncThreshold = 1000;
+    transport.setRetryPolicy(policy);
+    transport.setTransactionTimeout(1000);
+
+    // A read queued before a write to its registers must not answer a read queued after it
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 100, 2), 1);
+    uint16_t value = 0x1234;
+    submit(&transport, NeuronFrame(FunctionCode::WriteRegister, 100, 1, &value, sizeof(value)), 2);
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 100, 2), 3);
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 100, 2), 4);
+    // A write to other registers does not keep identical reads apart
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 300, 1), 5);
+    submit(&transport, NeuronFrame(FunctionCode::WriteRegister, 400, 1, &value, sizeof(value)), 6);
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 300, 1), 7);
+    // Coils are mirrored in the registers, a bit write keeps every register read apart
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 500, 1), 8);
+    submit(&transport, NeuronFrame(FunctionCode::WriteBit, 0, 1), 9);
+    submit(&transport, NeuronFrame(FunctionCode::ReadRegister, 500, 1), 10);
+
+    transport.start();
+    bool finished;
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        finished = m_condition.wait_for(locker, std::chrono::seconds(2), [this] { return m_finished.size() >= 8; });
+    }
+    transport.stop();
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    bool success = check(finished && m_finished == std::vector<intptr_t>({1, 2, 3, 5, 6, 8, 9, 10}), "Requests finish in the order they were queued")
+            && check(m_shared[1].empty(), "A read before a write is not shared with the read after it")
+            && check(m_shared[3] == std::vector<intptr_t>({4}), "Identical reads behind the write share one transfer")
+            && check(m_shared[5] == std::vector<intptr_t>({7}), "A write to other registers keeps identical reads together")
+            && check(m_shared[8].empty() && m_shared[10].empty(), "A bit write keeps register reads apart");
+    if (success) {
+        qInfo() << "SPI transport ordering checks passed";
+    }
+    return success;
+}
+
+void TransportOrderingTest::submit(NeuronTransport *transport, const NeuronFrame &frame, intptr_t context)
+{
+    NeuronTransport::Request request;
+    request.frame = frame;
+    request.context = reinterpret_cast<void *>(context);
+    transport->submit(request);
+}
+
+bool TransportOrderingTest::check(bool condition, const QString &description)
+{
+    if (condition) {
+        qInfo() << "Passed:" << description;
+    } else {
+        qWarning() << "Failed:" << description;
+    }
+    return condition;
+}
+
+void TransportOrderingTest::requestFinished(const NeuronTransport::Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx)
+{
+    Q_UNUSED(error)
+    Q_UNUSED(rx)
+    std::lock_guard<std::mutex> locker(m_mutex);
+    intptr_t context = reinterpret_cast<intptr_t>(request.context);
+    m_finished.push_back(context);
+    for (size_t i = 0; i < sharedContexts.size(); i++) {
+        m_shared[context].push_back(reinterpret_cast<intptr_t>(sharedContexts.at(i)));
+    }
+    m_condition.notify_all();
+}
+
+void TransportOrderingTest::transferFailed(const NeuronFrame &frame, SpiError error)
+{
+    Q_UNUSED(frame)
+    Q_UNUSED(error)
+}
+
+void TransportOrderingTest::unexpectedReply(const NeuronFrame &frame, const uint8_t *rx)
+{
+    Q_UNUSED(frame)
+    Q_UNUSED(rx)
+}
+
+void TransportOrderingTest::resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count)
+{
+    Q_UNUSED(failures)
+    Q_UNUSED(success)
+    Q_UNUSED(versionRegisters)
+    Q_UNUSED(count)
+}
+
+void TransportOrderingTest::statusReported(uint8_t status)
+{
+    Q_UNUSED(status)
+}
+
+void TransportOrderingTest::speedChanged(int speed)
+{
+    Q_UNUSED(speed)
+}
@@ -0,0 +1,61 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TRANSPORTORDERINGTEST_H
+#define TRANSPORTORDERINGTEST_H
+
+#include <QString>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "neurontransport.h"
+
+// Checks the request order of the SPI transaction engine without hardware. The requests
+// are queued before the worker starts, the transfers fail on the closed device but every
+// request still finishes together with the reads that shared its transfer.
+class TransportOrderingTest : private NeuronTransport::Listener
+{
+public:
+    // Returns false on the first failed check
+    bool run();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<intptr_t> m_finished; // Contexts in the order they finished
+    std::map<intptr_t, std::vector<intptr_t> > m_shared; // Contexts that shared the transfer of a request
+
+    void submit(NeuronTransport *transport, const NeuronFrame &frame, intptr_t context);
+    bool check(bool condition, const QString &description);
+
+    void requestFinished(const NeuronTransport::Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx) override;
+    void transferFailed(const NeuronFrame &frame, SpiError error) override;
+    void unexpectedReply(const NeuronFrame &frame, const uint8_t *rx) override;
+    void resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count) override;
+    void statusReported(uint8_t status) override;
+    void speedChanged(int speed) override;
+};
+
+#endif // TRANSPORTORDERINGTEST_H
@@ -1,3 +1,7 @@
 TEMPLATE = subdirs
-SUBDIRS = libneuron libneuron-tests
+SUBDIRS = libneuron-core libneuron libneuron-tests libneuron-mapcompiler neurond neuron-read
+libneuron.depends = libneuron-core
 libneuron-tests.depends = libneuron
+libneuron-mapcompiler.depends = libneuron
+neurond.depends = libneuron
+neuron-read.depends = libneuron-core
@@ -0,0 +1,167 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "csvtokenizer.h"
+
+#include <string.h>
+
+bool CsvTokenizer::Field::equals(const char *text) const
+{
+    return (int)strlen(text) == size && memcmp(data, text, size) == 0;
+}
+
+bool CsvTokenizer::Field::startsWith(const char *text) const
+{
+    int length = strlen(text);
+    return length <= size && memcmp(data, text, length) == 0;
+}
+
+static char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+bool CsvTokenizer::Field::contains(const char *text) const
+{
+    int length = strlen(text);
+    for (int start = 0; start + length <= size; start++) {
+        int i = 0;
+        while (i < length && toLower(data[start + i]) == toLower(text[i])) {
+            i++;
+        }
+        if (i == length) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CsvTokenizer::Field CsvTokenizer::Field::lastWord() const
+{
+    int start = size;
+    while (start > 0 && data[start - 1] != ' ') {
+        start--;
+    }
+    Field word;
+    word.data = data + start;
+    word.size = size - start;
+    return word;
+}
+
+int CsvTokenizer::Field::toInt(bool *ok) const
+{
+    int i = 0;
+    bool negative = false;
+    if (size > 0 && data[0] == '-') {
+        negative = true;
+        i++;
+    }
+    int value = 0;
+    bool valid = i < size;
+    for (; i < size; i++) {
+        if (data[i] < '0' || data[i] > '9') {
+            valid = false;
+            break;
+        }
+        value = value * 10 + (data[i] - '0');
+    }
+    if (ok) {
+        *ok = valid;
+    }
+    if (!valid) {
+        return 0;
+    }
+    return negative ? -value : value;
+}
+
+QString CsvTokenizer::Field::toString() const
+{
+    return QString::fromLatin1(data, size);
+}
+
+CsvTokenizer::CsvTokenizer(const char *data, qint64 size) :
+    m_position(data),
+    m_end(data + size)
+{
+}
+
+bool CsvTokenizer::readRow()
+{
+    m_fields.clear();
+    while (m_position < m_end) {
+        const char *lineEnd = (const char *)memchr(m_position, '\n', m_end - m_position);
+        if (!lineEnd) {
+            lineEnd = m_end;
+        }
+        const char *line = m_position;
+        m_position = lineEnd < m_end ? lineEnd + 1 : m_end;
+        m_lineNumber++;
+
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+        if (lineEnd == line) {
+            continue;
+        }
+
+        const char *fieldStart = line;
+        for (const char *c = line; c <= lineEnd; c++) {
+            if (c == lineEnd || *c == ',') {
+                Field field;
+                field.data = fieldStart;
+                field.size = c - fieldStart;
+                m_fields.append(field);
+                fieldStart = c + 1;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+int CsvTokenizer::fieldCount() const
+{
+    return m_fields.count();
+}
+
+CsvTokenizer::Field CsvTokenizer::field(int index) const
+{
+    if (index < 0 || index >= m_fields.count()) {
+        return Field();
+    }
+    return m_fields.at(index);
+}
+
+int CsvTokenizer::lineNumber() const
+{
+    return m_lineNumber;
+}
+
+int CsvTokenizer::indexOf(const char *name) const
+{
+    for (int i = 0; i < m_fields.count(); i++) {
+        if (m_fields.at(i).equals(name)) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,68 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef CSVTOKENIZER_H
+#define CSVTOKENIZER_H
+
+#include <QString>
+#include <QVarLengthArray>
+
+// Splits a CSV buffer into rows and fields without copying, the fields point into the buffer.
+// Quoting is not supported, the modbus map files do not use it.
+class CsvTokenizer
+{
+public:
+    struct Field {
+        const char *data = nullptr;
+        int size = 0;
+
+        bool isEmpty() const { return size == 0; }
+        bool equals(const char *text) const;
+        bool startsWith(const char *text) const;
+        // Case insensitive
+        bool contains(const char *text) const;
+        // Text after the last space
+        Field lastWord() const;
+        int toInt(bool *ok = nullptr) const;
+        QString toString() const;
+    };
+
+    CsvTokenizer(const char *data, qint64 size);
+
+    // Splits the next non empty line into fields, returns false at the end of the buffer
+    bool readRow();
+    int fieldCount() const;
+    // Returns an empty field if the row has no such column
+    Field field(int index) const;
+    int lineNumber() const;
+
+    // Column of the current row equal to name, -1 if there is none
+    int indexOf(const char *name) const;
+
+private:
+    const char *m_position;
+    const char *m_end;
+    int m_lineNumber = 0;
+    QVarLengthArray<Field, 8> m_fields;
+};
+
+#endif // CSVTOKENIZER_H
@@ -7,17 +7,42 @@ QT += core serialport
 QMAKE_CXXFLAGS *= -Werror -std=c++11 -g
 QMAKE_LFLAGS *= -std=c++11
 
+INCLUDEPATH += $$top_srcdir/libneuron-core/
+
 DEFINES += VERSION_STRING=\\\"$${VERSION_STRING}\\\"
 
 HEADERS += \
-    neurondefines.h \
+    csvtokenizer.h \
+    modbusmap.h \
+    neuroncalibration.h \
+    neuroncounters.h \
+    neuronextension.h \
+    neuronidentitycache.h \
+    neuronmodbusrtu.h \
+    neuronmodbustcpserver.h \
+    neuronprocessimage.h \
+    neuronsharedimage.h \
     neuronspi.h \
+    neurontopology.h \
+    neuronuart.h \
     neuronutil.h \
     spi.h \
     spimessage.h
 
 SOURCES += \
+    csvtokenizer.cpp \
+    modbusmap.cpp \
+    neuroncalibration.cpp \
+    neuroncounters.cpp \
+    neuronextension.cpp \
+    neuronidentitycache.cpp \
+    neuronmodbusrtu.cpp \
+    neuronmodbustcpserver.cpp \
+    neuronprocessimage.cpp \
+    neuronsharedimage.cpp \
     neuronspi.cpp \
+    neurontopology.cpp \
+    neuronuart.cpp \
     neuronutil.cpp \
     spi.cpp \
     spimessage.cpp
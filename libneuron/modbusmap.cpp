@@ -0,0 +1,611 @@
+// MIT Licen"e
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "modbusmap.h"
+#include "neuronboardprofile.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+#include <QStandardPaths>
+
+ModbusMap::ModbusMap(const QString &neuronModel, QObject *parent)
+    : QObject{parent},
+      m_model(neuronModel)
+{
+
+}
+
+int ModbusMap::numberOfNodes()
+{
+    return numberOfNodes(m_model) + m_boards.count();
+}
+
+int ModbusMap::numberOfNodes(const QString &neuronModel)
+{
+    const NeuronBoardProfile *profile = NeuronBoardProfiles::find(neuronModel.toLatin1().constData());
+    if (profile) {
+        return profile->nodeCount;
+    }
+
+    // Models without a profile are guessed from their series
+    if (neuronModel.startsWith('S')) {
+        return 1;
+    } else if (neuronModel.startsWith('M')) {
+        return 2;
+    } else if (neuronModel.startsWith('L')) {
+        return 3;
+    } else if (isExtensionModel(neuronModel)) {
+        return 1;
+    }
+    return 0;
+}
+
+int ModbusMap::addExtension(const QString &extensionModel)
+{
+    if (!isExtensionModel(extensionModel)) {
+        qWarning() << "Not an extension module" << extensionModel;
+        return -1;
+    }
+    return addBoard(extensionModel, 1);
+}
+
+int ModbusMap::addBoard(const QString &model, int group)
+{
+    if (group < 1 || group > numberOfNodes(model)) {
+        qWarning() << "The modbus map of" << model << "has no group" << group;
+        return -1;
+    }
+    Board board;
+    board.model = model;
+    board.group = group;
+    m_boards.append(board);
+    return numberOfNodes();
+}
+
+QStringList ModbusMap::extensions() const
+{
+    QStringList extensions;
+    foreach (const Board &board, m_boards) {
+        if (isExtensionModel(board.model)) {
+            extensions.append(board.model);
+        }
+    }
+    return extensions;
+}
+
+bool ModbusMap::isExtensionModel(const QString &model)
+{
+    return model.startsWith("xS");
+}
+
+static int countOnNode(const QHash<QString, RegisterDescriptor> &registers, int subNode)
+{
+    int count = 0;
+    foreach (RegisterDescriptor descriptor, registers.values()) {
+        if (descriptor.subNode() == subNode) {
+            count++;
+        }
+    }
+    return count;
+}
+
+QString ModbusMap::detectModel(const QList<NeuronUtil::BoardVersion> &boards)
+{
+    QString mainDir = mapDirectory();
+    if (mainDir.isEmpty() || boards.isEmpty()) {
+        return QString();
+    }
+
+    QStringList candidates;
+    foreach (const QString &directory, QDir(mainDir).entryList(QStringList() << "Neuron_*", QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QString model = directory.mid(QString("Neuron_").length());
+        if (isExtensionModel(model) || numberOfNodes(model) != boards.count()) {
+            continue;
+        }
+        ModbusMap map(model);
+        if (!map.loadModbusMap()) {
+            continue;
+        }
+
+        bool matches = true;
+        for (int node = 1; node <= boards.count() && matches; node++) {
+            const NeuronUtil::BoardVersion &board = boards.at(node - 1);
+            int outputs = countOnNode(map.digitalOutputRegisters(), node) + countOnNode(map.relayOutputRegisters(), node);
+            matches = countOnNode(map.digitalInputRegisters(), node) == board.DiCount &&
+                    outputs == board.DoCount &&
+                    countOnNode(map.analogInputRegisters(), node) == board.AiCount &&
+                    countOnNode(map.analogOutputRegisters(), node) == board.AoCount;
+        }
+        if (matches) {
+            candidates.append(model);
+        }
+    }
+
+    if (candidates.count() > 1) {
+        qWarning() << "Hardware matches several Neuron models" << candidates << "using" << candidates.first();
+    }
+    return candidates.value(0);
+}
+
+static QString customMapDirectory;
+
+QString ModbusMap::mapDirectory()
+{
+    if (!customMapDirectory.isEmpty()) {
+        return customMapDirectory;
+    }
+    const QString relativePath = "./modbus_maps/";
+    if (QDir(relativePath).exists()) {
+        return relativePath;
+    }
+    qDebug() << "Could not find modbus maps at relative path:" << relativePath;
+    const QString installationPath = "/usr/share/libneuron/maps/";
+    if (!QFile(installationPath).exists()) {
+        qDebug() << "Could not find modbus maps at installation path:" << installationPath;
+        return QString();
+    }
+    return installationPath;
+}
+
+
+void ModbusMap::setMapDirectory(const QString &directory)
+{
+    customMapDirectory = directory.endsWith('/') || directory.isEmpty() ? directory : directory + '/';
+}
+
+QString ModbusMap::imageFileName(const QString &neuronModel)
+{
+    return QString("%1/%1.nmap").arg(modelDirectory(neuronModel));
+}
+
+QString ModbusMap::modelDirectory(const QString &model)
+{
+    QString extensionDirectory = QString("Extension_%1").arg(model);
+    if (isExtensionModel(model) && QDir(mapDirectory() + extensionDirectory).exists()) {
+        return extensionDirectory;
+    }
+    return QString("Neuron_%1").arg(model);
+}
+
+bool ModbusMap::loadModbusMap()
+{
+    QString mainDir = mapDirectory();
+    if (mainDir.isEmpty()) {
+        return false;
+    }
+
+    // Compiled images only cover the Neuron itself
+    QString imagePath = mainDir + imageFileName(m_model);
+    if (m_boards.isEmpty() && QFile::exists(imagePath)) {
+        if (loadImage(imagePath)) {
+            return true;
+        }
+        qWarning() << "Could not load compiled modbus map, falling back to CSV files:" << imagePath;
+    }
+    return loadCsvMap();
+}
+
+bool ModbusMap::loadImage(const QString &fileName)
+{
+    qDebug() << "Load compiled modbus map" << fileName;
+    m_image = ModbusMapImage();
+    m_imageData.clear();
+    if (m_imageFile.isOpen()) {
+        m_imageFile.close();
+    }
+
+    m_imageFile.setFileName(fileName);
+    if (!m_imageFile.open(QIODevice::ReadOnly)) {
+        qWarning() << m_imageFile.errorString();
+        return false;
+    }
+
+    // The mapping stays valid until the file is closed, no data is copied or parsed
+    uchar *data = m_imageFile.map(0, m_imageFile.size());
+    if (!data) {
+        qWarning() << "Could not map modbus map image" << m_imageFile.errorString();
+        m_imageFile.close();
+        return false;
+    }
+    if (!m_image.setData(data, m_imageFile.size())) {
+        qWarning() << m_image.errorString();
+        m_imageFile.close();
+        return false;
+    }
+    if (m_image.nodeCount() != numberOfNodes()) {
+        qWarning() << "Compiled modbus map does not match the model" << m_model;
+        m_image = ModbusMapImage();
+        m_imageFile.close();
+        return false;
+    }
+    return true;
+}
+
+bool ModbusMap::saveImage(const QString &fileName) const
+{
+    if (!m_image.isValid()) {
+        return false;
+    }
+
+    QFile imageFile(fileName);
+    if (!imageFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write modbus map image" << fileName << imageFile.errorString();
+        return false;
+    }
+    return imageFile.write((const char *)m_image.data(), m_image.size()) == m_image.size();
+}
+
+const ModbusMapImage &ModbusMap::image() const
+{
+    return m_image;
+}
+
+ModbusMapImage::NodeRange ModbusMap::nodeRange(int subNode) const
+{
+    return m_image.nodeRange(subNode);
+}
+
+ModbusMap::CircuitHandle ModbusMap::resolveCircuit(ModbusMapImage::CircuitType type, const QString &circuit, int subNode) const
+{
+    int index = m_image.indexOf(type, circuit.toLatin1().constData(), subNode);
+    if (index < 0) {
+        return InvalidCircuitHandle;
+    }
+    return circuitHandle(type, index);
+}
+
+ModbusMap::CircuitHandle ModbusMap::circuitHandle(ModbusMapImage::CircuitType type, int index) const
+{
+    // Upper 16 bits hold the circuit type, lower 16 bits the index into its table
+    return ((CircuitHandle)type << 16) | (CircuitHandle)(index & 0xffff);
+}
+
+int ModbusMap::circuitCount(ModbusMapImage::CircuitType type) const
+{
+    return m_image.count(type);
+}
+
+bool ModbusMap::isValidCircuit(CircuitHandle handle) const
+{
+    if (handle == InvalidCircuitHandle || (handle >> 16) >= ModbusMapImage::CircuitTypeCount) {
+        return false;
+    }
+    return (int)(handle & 0xffff) < m_image.count(circuitType(handle));
+}
+
+const ModbusMapImage::Entry &ModbusMap::circuit(CircuitHandle handle) const
+{
+    return m_image.entry(circuitType(handle), handle & 0xffff);
+}
+
+QString ModbusMap::circuitName(CircuitHandle handle) const
+{
+    if (!isValidCircuit(handle)) {
+        return QString();
+    }
+    return QString::fromLatin1(m_image.name(circuit(handle)));
+}
+
+ModbusMapImage::CircuitType ModbusMap::circuitType(CircuitHandle handle)
+{
+    return (ModbusMapImage::CircuitType)(handle >> 16);
+}
+
+bool ModbusMap::loadCsvMap()
+{
+    qDebug() << "Load modbus map";
+
+    int subUnits = numberOfNodes();
+    int neuronNodes = numberOfNodes(m_model);
+
+    if (subUnits < 1) {
+        qDebug() << "Unknown Neuron model";
+        return false;
+    }
+
+    QString mainDir = mapDirectory();
+    if (mainDir.isEmpty()) {
+        return false;
+    }
+
+    std::vector<ModbusMapImage::Circuit> circuits;
+    QHash<QString, int> bitCircuits;
+    for(int i = 1; i <= subUnits; i++) {
+        // Added boards and extension modules take one group of the map of their model
+        QString directory = i <= neuronNodes ? modelDirectory(m_model) : modelDirectory(m_boards.at(i - neuronNodes - 1).model);
+        int group = i <= neuronNodes ? i : m_boards.at(i - neuronNodes - 1).group;
+        // The coils define the bit circuits, the register file adds their MixedBits register bit
+        if (!loadCsvFile(mainDir + QString("%1/%1-Coils-group-%2.csv").arg(directory).arg(group, 0, 10), i, &circuits, &bitCircuits)) {
+            return false;
+        }
+        if (!loadCsvFile(mainDir + QString("%1/%1-Registers-group-%2.csv").arg(directory).arg(group, 0, 10), i, &circuits, &bitCircuits)) {
+            return false;
+        }
+    }
+
+    if (m_imageFile.isOpen()) {
+        m_imageFile.close();
+    }
+    m_imageData = ModbusMapImage::build(subUnits, circuits);
+    if (!m_image.setData(m_imageData.data(), m_imageData.size())) {
+        qWarning() << m_image.errorString();
+        return false;
+    }
+    return true;
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::relayOutputRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeRelayOutput);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::digitalOutputRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeDigitalOutput);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::digitalInputRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeDigitalInput);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::userLEDRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeUserLED);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::analogInputRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeAnalogInput);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::analogOutputRegisters()
+{
+    return registers(ModbusMapImage::CircuitTypeAnalogOutput);
+}
+
+QHash<QString, RegisterDescriptor> ModbusMap::registers(ModbusMapImage::CircuitType type) const
+{
+    QHash<QString, RegisterDescriptor> registers;
+    for (int i = 0; i < m_image.count(type); i++) {
+        const ModbusMapImage::Entry &entry = m_image.entry(type, i);
+        registers.insert(QString::fromLatin1(m_image.name(entry)), RegisterDescriptor(entry.subNode, entry.address, entry.count, (RegisterDescriptor::RWPermission)entry.permission));
+    }
+    return registers;
+}
+
+bool ModbusMap::loadCsvFile(const QString &path, int subNode, std::vector<ModbusMapImage::Circuit> *circuits, QHash<QString, int> *bitCircuits)
+{
+    qDebug() << "Open CSV File:" << path;
+    QFile csvFile(path);
+    if (!csvFile.open(QIODevice::ReadOnly)) {
+        qWarning() << csvFile.errorString();
+        return false;
+    }
+
+    // The tokenizer works on the mapped file, reading it is the fallback if it cannot be mapped
+    QByteArray buffer;
+    qint64 size = csvFile.size();
+    const char *data = (const char *)csvFile.map(0, size);
+    if (!data) {
+        buffer = csvFile.readAll();
+        data = buffer.constData();
+        size = buffer.size();
+    }
+    CsvTokenizer tokenizer(data, size);
+
+    // The header selects the schema, only the register files have a register count
+    if (!tokenizer.readRow()) {
+        qWarning() << "Empty CSV file:" << path;
+        return false;
+    }
+    CsvColumns columns;
+    for (int i = 0; i < tokenizer.fieldCount(); i++) {
+        if (tokenizer.field(i).startsWith("Via Unit ") && !tokenizer.field(i).equals("Via Unit 0")) {
+            columns.address = i;
+        }
+    }
+    columns.unitZeroAddress = tokenizer.indexOf("Via Unit 0");
+    columns.count = tokenizer.indexOf("Register Count");
+    columns.permission = tokenizer.indexOf("R/W");
+    columns.dataType = tokenizer.indexOf("Data Type");
+    columns.content = tokenizer.indexOf("Content");
+    columns.startBit = tokenizer.indexOf("Start Bit Nr.");
+    columns.category = tokenizer.indexOf("Category");
+    int columnCount = tokenizer.fieldCount();
+    if (columns.address < 0 || columns.permission < 0 || columns.content < 0 || columns.category < 0) {
+        qWarning() << "Corrupted CSV file header:" << path;
+        return false;
+    }
+    bool registers = columns.count >= 0;
+
+    while (tokenizer.readRow()) {
+        if (tokenizer.fieldCount() != columnCount) {
+            qWarning() << "Corrupted CSV file:" << path << "line" << tokenizer.lineNumber();
+            return false;
+        }
+
+        ModbusMapImage::Category category;
+        if (!categoryFromField(tokenizer.field(columns.category), &category)) {
+            qWarning() << "Unknown category in" << path << "line" << tokenizer.lineNumber() << tokenizer.field(columns.category).toString();
+            continue;
+        }
+        if (category == ModbusMapImage::CategoryReserved) {
+            continue;
+        }
+
+        ModbusMapImage::DataType dataType = ModbusMapImage::DataTypeBit;
+        if (registers && !dataTypeFromField(tokenizer.field(columns.dataType), &dataType)) {
+            qWarning() << "Unknown data type in" << path << "line" << tokenizer.lineNumber() << tokenizer.field(columns.dataType).toString();
+            continue;
+        }
+
+        bool ok;
+        CsvTokenizer::Field content = tokenizer.field(columns.content);
+        ModbusMapImage::Circuit row;
+        row.name = content.toString().toLatin1().constData();
+        row.type = registers ? ModbusMapImage::CircuitTypeRegister : ModbusMapImage::CircuitTypeCoil;
+        row.subNode = subNode;
+        row.address = tokenizer.field(columns.address).toInt(&ok);
+        row.count = registers ? tokenizer.field(columns.count).toInt() : 1;
+        row.permission = permissionFromField(tokenizer.field(columns.permission));
+        row.dataType = dataType;
+        row.category = category;
+        row.registerAddress = registers ? row.address : 0;
+        row.startBit = tokenizer.field(columns.startBit).toInt();
+        row.unitZeroAddress = columns.unitZeroAddress >= 0 ? tokenizer.field(columns.unitZeroAddress).toInt() : row.address;
+        if (!ok) {
+            qWarning() << "Corrupted CSV file:" << path << "line" << tokenizer.lineNumber();
+            return false;
+        }
+        circuits->push_back(row);
+
+        if (category != ModbusMapImage::CategoryBasic) {
+            continue;
+        }
+        ModbusMapImage::CircuitType type = circuitTypeFromContent(content, registers, dataType);
+        if (type == ModbusMapImage::CircuitTypeCount) {
+            continue;
+        }
+
+        ModbusMapImage::Circuit circuit = row;
+        QString number = circuitNumber(content).toString();
+        circuit.name = number.toLatin1().constData();
+        circuit.type = type;
+        QString key = QString("%1:%2:%3").arg(type).arg(subNode).arg(number);
+        if (dataType == ModbusMapImage::DataTypeMixedBits) {
+            int index = bitCircuits->value(key, -1);
+            if (index < 0) {
+                qDebug() << "Register bit without coil" << row.name.c_str() << "node" << subNode;
+                continue;
+            }
+            // Bit circuits with a MixedBits data type can also be read through their register word
+            (*circuits)[index].dataType = ModbusMapImage::DataTypeMixedBits;
+            (*circuits)[index].registerAddress = row.address;
+            (*circuits)[index].startBit = row.startBit;
+            continue;
+        }
+        if (!registers) {
+            bitCircuits->insert(key, circuits->size());
+        }
+        qDebug() << "Found circuit" << number << "type" << type << "node" << subNode << "address" << circuit.address;
+        circuits->push_back(circuit);
+    }
+    return true;
+}
+
+ModbusMapImage::CircuitType ModbusMap::circuitTypeFromContent(const CsvTokenizer::Field &content, bool registers, ModbusMapImage::DataType dataType)
+{
+    if (!registers) {
+        if (content.contains("Digital Input")) {
+            return ModbusMapImage::CircuitTypeDigitalInput;
+        } else if (content.contains("Digital Output")) {
+            return ModbusMapImage::CircuitTypeDigitalOutput;
+        } else if (content.contains("Relay Output")) {
+            return ModbusMapImage::CircuitTypeRelayOutput;
+        } else if (content.contains("User Programmable LED")) {
+            return ModbusMapImage::CircuitTypeUserLED;
+        }
+    } else if (dataType == ModbusMapImage::DataTypeMixedBits) {
+        if (content.startsWith("Digital Input ")) {
+            return ModbusMapImage::CircuitTypeDigitalInput;
+        } else if (content.startsWith("Digital Output ")) {
+            return ModbusMapImage::CircuitTypeDigitalOutput;
+        } else if (content.startsWith("Relay Output ")) {
+            return ModbusMapImage::CircuitTypeRelayOutput;
+        } else if (content.startsWith("User LED ")) {
+            return ModbusMapImage::CircuitTypeUserLED;
+        }
+    } else if (content.contains("Analog Input Value")) {
+        return ModbusMapImage::CircuitTypeAnalogInput;
+    } else if (content.contains("Analog Output Value")) {
+        return ModbusMapImage::CircuitTypeAnalogOutput;
+    }
+    return ModbusMapImage::CircuitTypeCount;
+}
+
+CsvTokenizer::Field ModbusMap::circuitNumber(const CsvTokenizer::Field &content)
+{
+    // The first word starting with a digit, "2.1" in "Analog Output Value 2.1 (0..4000 ~ 0..10V)"
+    int start = 0;
+    while (start < content.size) {
+        int end = start;
+        while (end < content.size && content.data[end] != ' ') {
+            end++;
+        }
+        if (content.data[start] >= '0' && content.data[start] <= '9') {
+            CsvTokenizer::Field number;
+            number.data = content.data + start;
+            number.size = end - start;
+            return number;
+        }
+        start = end + 1;
+    }
+    return content.lastWord();
+}
+
+bool ModbusMap::categoryFromField(const CsvTokenizer::Field &field, ModbusMapImage::Category *category)
+{
+    if (field.equals("Basic")) {
+        *category = ModbusMapImage::CategoryBasic;
+    } else if (field.equals("Advanced")) {
+        *category = ModbusMapImage::CategoryAdvanced;
+    } else if (field.equals("Expert")) {
+        *category = ModbusMapImage::CategoryExpert;
+    } else if (field.equals("Obsolete")) {
+        *category = ModbusMapImage::CategoryObsolete;
+    } else if (field.startsWith("Reserved")) {
+        *category = ModbusMapImage::CategoryReserved;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ModbusMap::dataTypeFromField(const CsvTokenizer::Field &field, ModbusMapImage::DataType *dataType)
+{
+    if (field.equals("MixedBits")) {
+        *dataType = ModbusMapImage::DataTypeMixedBits;
+    } else if (field.equals("Word")) {
+        *dataType = ModbusMapImage::DataTypeWord;
+    } else if (field.equals("DWord")) {
+        *dataType = ModbusMapImage::DataTypeDWord;
+    } else if (field.equals("Real")) {
+        *dataType = ModbusMapImage::DataTypeReal;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+quint8 ModbusMap::permissionFromField(const CsvTokenizer::Field &field)
+{
+    if (field.equals("RW")) {
+        return RegisterDescriptor::RWPermissionReadWrite;
+    } else if (field.equals("W")) {
+        return RegisterDescriptor::RWPermissionWrite;
+    } else if (field.equals("R")) {
+        return RegisterDescriptor::RWPermissionRead;
+    }
+    return RegisterDescriptor::RWPermissionNone;
+}
@@ -0,0 +1,161 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MODBUSMAP_H
+#define MODBUSMAP_H
+
+#include <QObject>
+#include <QHash>
+#include <QFile>
+#include <QStringList>
+
+#include "neuronutil.h"
+#include "modbusmapimage.h"
+#include "csvtokenizer.h"
+
+class RegisterDescriptor;
+
+class ModbusMap : public QObject
+{
+    Q_OBJECT
+public:
+    // A circuit handle is resolved once from a circuit name and afterwards indexes the flat
+    // circuit tables of the map image directly, without any string hashing or container copies
+    typedef quint32 CircuitHandle;
+    static const CircuitHandle InvalidCircuitHandle = 0xffffffff;
+
+    explicit ModbusMap(const QString &neuronModel, QObject *parent = nullptr);
+
+    // Sub-nodes of the Neuron model plus the added boards and extension modules
+    int numberOfNodes();
+    static int numberOfNodes(const QString &neuronModel);
+    // Boards beyond the sub-nodes of the Neuron, e.g. on a second SPI controller, follow its
+    // sub-nodes and are described by one group of the map of their model. Returns the sub-node
+    // of the board, must be called before the map is loaded.
+    int addBoard(const QString &model, int group = 1);
+    // Extension modules on the RS485 bus, e.g. "xS11", are boards with a single group
+    int addExtension(const QString &extensionModel);
+    QStringList extensions() const;
+    static bool isExtensionModel(const QString &model);
+    // Loads the compiled map image if available, the CSV files otherwise
+    bool loadModbusMap();
+    bool loadCsvMap();
+    bool loadImage(const QString &fileName);
+    bool saveImage(const QString &fileName) const;
+
+    const ModbusMapImage &image() const;
+    ModbusMapImage::NodeRange nodeRange(int subNode) const;
+
+    // Coils and registers are resolved by their content and sub-node, e.g. "Counter of Digital Input 2.3"
+    CircuitHandle resolveCircuit(ModbusMapImage::CircuitType type, const QString &circuit, int subNode = 0) const;
+    // Circuits of a type are ordered by sub-node and address
+    CircuitHandle circuitHandle(ModbusMapImage::CircuitType type, int index) const;
+    int circuitCount(ModbusMapImage::CircuitType type) const;
+    bool isValidCircuit(CircuitHandle handle) const;
+    const ModbusMapImage::Entry &circuit(CircuitHandle handle) const;
+    QString circuitName(CircuitHandle handle) const;
+    static ModbusMapImage::CircuitType circuitType(CircuitHandle handle);
+
+    // Returns the Neuron model whose modbus map matches the I/O counts reported by the boards
+    static QString detectModel(const QList<NeuronUtil::BoardVersion> &boards);
+    static QString mapDirectory();
+    static void setMapDirectory(const QString &directory);
+    static QString imageFileName(const QString &neuronModel);
+    // Extension maps are in Extension_<model> or Neuron_<model>, Neuron maps in Neuron_<model>
+    static QString modelDirectory(const QString &model);
+
+    QHash<QString, RegisterDescriptor> relayOutputRegisters();
+    QHash<QString, RegisterDescriptor> digitalOutputRegisters();
+    QHash<QString, RegisterDescriptor> digitalInputRegisters();
+    QHash<QString, RegisterDescriptor> userLEDRegisters();
+    QHash<QString, RegisterDescriptor> analogInputRegisters();
+    QHash<QString, RegisterDescriptor> analogOutputRegisters();
+
+private:
+    struct Board {
+        QString model;
+        int group;
+    };
+
+    QString m_model;
+    QList<Board> m_boards;
+
+    // The image either points into m_imageFile, mapped into memory, or into m_imageData
+    ModbusMapImage m_image;
+    QFile m_imageFile;
+    std::vector<uint8_t> m_imageData;
+
+    // Column indices of a CSV file, -1 if the schema has no such column
+    struct CsvColumns {
+        int address = -1;
+        int unitZeroAddress = -1;
+        int count = -1;
+        int permission = -1;
+        int dataType = -1;
+        int content = -1;
+        int startBit = -1;
+        int category = -1;
+    };
+
+    QHash<QString, RegisterDescriptor> registers(ModbusMapImage::CircuitType type) const;
+    bool loadCsvFile(const QString &path, int subNode, std::vector<ModbusMapImage::Circuit> *circuits, QHash<QString, int> *bitCircuits);
+    static ModbusMapImage::CircuitType circuitTypeFromContent(const CsvTokenizer::Field &content, bool registers, ModbusMapImage::DataType dataType);
+    static CsvTokenizer::Field circuitNumber(const CsvTokenizer::Field &content);
+    static bool categoryFromField(const CsvTokenizer::Field &field, ModbusMapImage::Category *category);
+    static bool dataTypeFromField(const CsvTokenizer::Field &field, ModbusMapImage::DataType *dataType);
+    static quint8 permissionFromField(const CsvTokenizer::Field &field);
+};
+
+class RegisterDescriptor
+{
+public:
+    enum RWPermission {
+        RWPermissionNone,
+        RWPermissionRead,
+        RWPermissionReadWrite,
+        RWPermissionWrite
+    };
+    RegisterDescriptor() {}
+    RegisterDescriptor(int subNode, int address, int count = 1, RWPermission readWrite = RWPermissionRead) :
+        m_address(address),
+        m_subNode(subNode),
+        m_count(count),
+        m_readWrite(readWrite)
+    {};
+
+    int address() { return m_address; }
+    void setAddress(int address) { m_address = address; }
+    int subNode() { return m_subNode; }
+    void setSubNode(int subNode) { m_subNode = subNode; }
+    int count() { return m_count; }
+    void setCount(int count) { m_count = count; }
+    RWPermission permission() { return m_readWrite; }
+    void setPermission(RWPermission readWrite) { m_readWrite = readWrite; }
+
+private:
+    int m_address;
+    int m_subNode; // 1 to 3
+    int m_count = 1;
+    RWPermission m_readWrite;
+};
+
+#endif // MODBUSMAP_H
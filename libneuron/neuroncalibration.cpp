@@ -0,0 +1,348 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuroncalibration.h"
+#include "neuronregister.h"
+#include "neuronspi.h"
+
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(dcNeuronCalibration, "NeuronCalibration")
+
+// Configuration registers of one sub-node are read together, like the merged reads of the process image
+static const int maxMergeGap = 8;
+static const int maxRegistersPerRead = 126;
+
+static NeuronCalibration::Unit unitFromName(const QString &name)
+{
+    if (name == "V" || name.startsWith("U")) {
+        return NeuronCalibration::UnitVolt;
+    } else if (name == "mA" || name.startsWith("I")) {
+        return NeuronCalibration::UnitMilliAmpere;
+    } else if (name == "Ohm" || name.startsWith("R")) {
+        return NeuronCalibration::UnitOhm;
+    }
+    return NeuronCalibration::UnitUnknown;
+}
+
+// "(0..4000 ~ 0..10V)" documents value = word * 10 / 4000 in volts
+static bool parseScale(const QString &name, float *scale, NeuronCalibration::Unit *unit)
+{
+    int open = name.indexOf("(0..");
+    int tilde = open < 0 ? -1 : name.indexOf("~ 0..", open);
+    int close = tilde < 0 ? -1 : name.indexOf(QChar(')'), tilde);
+    if (close < 0) {
+        return false;
+    }
+    QString range = name.mid(tilde + 5, close - tilde - 5).trimmed();
+    int digits = 0;
+    while (digits < range.length() && (range.at(digits).isDigit() || range.at(digits) == '.')) {
+        digits++;
+    }
+    bool rawValid = false;
+    bool valueValid = false;
+    double raw = name.mid(open + 4, tilde - open - 4).trimmed().toDouble(&rawValid);
+    double value = range.left(digits).toDouble(&valueValid);
+    if (!rawValid || !valueValid || raw <= 0) {
+        return false;
+    }
+    *scale = value / raw;
+    *unit = unitFromName(range.mid(digits));
+    return true;
+}
+
+NeuronCalibration::NeuronCalibration(NeuronSpi *spi, ModbusMap *modbusMap, int subNode, QObject *parent) :
+    QObject{parent},
+    m_spi(spi),
+    m_modbusMap(modbusMap),
+    m_subNode(subNode)
+{
+    m_inputs = channels("analog input value ", "Analog Input Configuration(");
+    m_outputs = channels("analog output value ", "Analog Output Configuration(");
+    m_inputGroups = groups(m_inputs);
+    m_outputGroups = groups(m_outputs);
+    m_inputUnits = units(m_inputs);
+    m_outputUnits = units(m_outputs);
+}
+
+int NeuronCalibration::subNode() const
+{
+    return m_subNode;
+}
+
+void NeuronCalibration::load()
+{
+    m_isLoaded = false;
+    m_readFailed = false;
+    m_configuration.clear();
+
+    QList<int> addresses;
+    foreach (const Channel &channel, m_inputs + m_outputs) {
+        if (channel.configurationAddress >= 0 && !addresses.contains(channel.configurationAddress)) {
+            addresses.append(channel.configurationAddress);
+        }
+    }
+    std::sort(addresses.begin(), addresses.end());
+
+    // Neighbouring configuration registers are merged into one read, e.g. 1019 to 1024 of the base group
+    QList<QPair<int, int> > ranges;
+    foreach (int address, addresses) {
+        if (!ranges.isEmpty() && address <= ranges.last().second + 1 + maxMergeGap && address - ranges.last().first < maxRegistersPerRead) {
+            ranges.last().second = address;
+        } else {
+            ranges.append(qMakePair(address, address));
+        }
+    }
+
+    m_pendingReads = ranges.count();
+    if (m_pendingReads == 0) {
+        finishLoad();
+        return;
+    }
+    for (int i = 0; i < ranges.count(); i++) {
+        readConfiguration(ranges.at(i).first, ranges.at(i).second - ranges.at(i).first + 1);
+    }
+}
+
+bool NeuronCalibration::isLoaded() const
+{
+    return m_isLoaded;
+}
+
+QStringList NeuronCalibration::analogInputChannels() const
+{
+    QStringList names;
+    foreach (const Channel &channel, m_inputs) {
+        names.append(channel.name);
+    }
+    return names;
+}
+
+QStringList NeuronCalibration::analogOutputChannels() const
+{
+    QStringList names;
+    foreach (const Channel &channel, m_outputs) {
+        names.append(channel.name);
+    }
+    return names;
+}
+
+NeuronCalibration::Unit NeuronCalibration::analogInputUnit(int channel) const
+{
+    return m_inputUnits.value(channel, UnitUnknown);
+}
+
+NeuronCalibration::Unit NeuronCalibration::analogOutputUnit(int channel) const
+{
+    return m_outputUnits.value(channel, UnitUnknown);
+}
+
+QList<NeuronCalibration::Group> NeuronCalibration::analogInputGroups() const
+{
+    return m_inputGroups;
+}
+
+QList<NeuronCalibration::Group> NeuronCalibration::analogOutputGroups() const
+{
+    return m_outputGroups;
+}
+
+QList<ModbusMap::CircuitHandle> NeuronCalibration::circuits() const
+{
+    QList<ModbusMap::CircuitHandle> circuits;
+    foreach (const Channel &channel, m_inputs + m_outputs) {
+        circuits.append(channel.circuit);
+    }
+    return circuits;
+}
+
+void NeuronCalibration::analogInputValues(const quint16 *registers, float *values) const
+{
+    convert(m_inputGroups, registers, values);
+}
+
+void NeuronCalibration::analogOutputValues(const quint16 *registers, float *values) const
+{
+    convert(m_outputGroups, registers, values);
+}
+
+void NeuronCalibration::analogOutputRegisters(const Group &group, const float *values, quint16 *words) const
+{
+    if (group.dataType == ModbusMapImage::DataTypeReal) {
+        encodeRegisters<RegisterForDataType<ModbusMapImage::DataTypeReal>::Type>(values, group.count, words);
+        return;
+    }
+    for (int i = 0; i < group.count; i++) {
+        words[i] = qBound<qint64>(0, qRound64(values[i] / group.scale), 0xffff);
+    }
+}
+
+int NeuronCalibration::wordCount(const Group &group)
+{
+    return group.count * (group.dataType == ModbusMapImage::DataTypeReal ? 2 : 1);
+}
+
+QString NeuronCalibration::unitName(Unit unit)
+{
+    switch (unit) {
+    case UnitVolt:
+        return "V";
+    case UnitMilliAmpere:
+        return "mA";
+    case UnitOhm:
+        return "Ohm";
+    default:
+        return QString();
+    }
+}
+
+QVector<NeuronCalibration::Channel> NeuronCalibration::channels(const QString &valuePrefix, const QString &configurationPrefix) const
+{
+    // The register table is ordered by address, which is the channel order. The
+    // configuration register names the channel last, "Analog Input Configuration(U/I/R) 2.1".
+    QHash<QString, ModbusMap::CircuitHandle> configurations;
+    QList<ModbusMap::CircuitHandle> values;
+    for (int i = 0; i < m_modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        ModbusMap::CircuitHandle handle = m_modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i);
+        if (m_modbusMap->circuit(handle).subNode != m_subNode) {
+            continue;
+        }
+        QString name = m_modbusMap->circuitName(handle);
+        if (name.startsWith(configurationPrefix)) {
+            configurations.insert(name.section(' ', -1), handle);
+        } else if (name.toLower().startsWith(valuePrefix)) {
+            values.append(handle);
+        }
+    }
+
+    QVector<Channel> channels;
+    foreach (ModbusMap::CircuitHandle handle, values) {
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(handle);
+        QString name = m_modbusMap->circuitName(handle);
+        Channel channel;
+        channel.name = name.mid(valuePrefix.length()).section(' ', 0, 0);
+        channel.circuit = handle;
+        channel.dataType = static_cast<ModbusMapImage::DataType>(entry.dataType);
+        channel.scale = 1;
+        channel.scaleUnit = UnitUnknown;
+        channel.configurationAddress = -1;
+        if (channel.dataType == ModbusMapImage::DataTypeWord && !parseScale(name, &channel.scale, &channel.scaleUnit)) {
+            qCWarning(dcNeuronCalibration()) << "Analog register" << name << "of sub-node" << m_subNode << "documents no scale";
+            continue;
+        } else if (channel.dataType != ModbusMapImage::DataTypeWord && channel.dataType != ModbusMapImage::DataTypeReal) {
+            continue;
+        }
+        if (configurations.contains(channel.name)) {
+            ModbusMap::CircuitHandle configuration = configurations.value(channel.name);
+            QString configurationName = m_modbusMap->circuitName(configuration);
+            channel.configurationAddress = m_modbusMap->circuit(configuration).address;
+            channel.modes = configurationName.mid(configurationPrefix.length()).section(')', 0, 0).split('/');
+        }
+        channels.append(channel);
+    }
+    return channels;
+}
+
+QList<NeuronCalibration::Group> NeuronCalibration::groups(const QVector<Channel> &channels) const
+{
+    QList<Group> groups;
+    for (int i = 0; i < channels.count(); i++) {
+        const Channel &channel = channels.at(i);
+        quint16 address = m_modbusMap->circuit(channel.circuit).registerAddress;
+        if (!groups.isEmpty()) {
+            Group &group = groups.last();
+            if (group.dataType == channel.dataType && group.scale == channel.scale && group.address + wordCount(group) == address) {
+                group.count++;
+                continue;
+            }
+        }
+        Group group;
+        group.address = address;
+        group.count = 1;
+        group.firstChannel = i;
+        group.dataType = channel.dataType;
+        group.scale = channel.scale;
+        groups.append(group);
+    }
+    return groups;
+}
+
+QVector<NeuronCalibration::Unit> NeuronCalibration::units(const QVector<Channel> &channels) const
+{
+    // Without configuration the unit documented by the scale applies, e.g. the voltage outputs of the E-4Ai4Ao groups
+    QVector<Unit> units;
+    foreach (const Channel &channel, channels) {
+        if (channel.configurationAddress < 0) {
+            units.append(channel.scaleUnit);
+        } else if (!m_configuration.contains(channel.configurationAddress)) {
+            units.append(UnitUnknown);
+        } else {
+            units.append(unitFromName(channel.modes.value(m_configuration.value(channel.configurationAddress))));
+        }
+    }
+    return units;
+}
+
+void NeuronCalibration::convert(const QList<Group> &groups, const quint16 *registers, float *values) const
+{
+    foreach (const Group &group, groups) {
+        const quint16 *words = registers + group.address;
+        float *groupValues = values + group.firstChannel;
+        if (group.dataType == ModbusMapImage::DataTypeReal) {
+            decodeRegisters<RegisterForDataType<ModbusMapImage::DataTypeReal>::Type>(words, group.count, groupValues);
+            continue;
+        }
+        decodeRegisters<Register<quint16> >(words, group.count, groupValues);
+        for (int i = 0; i < group.count; i++) {
+            groupValues[i] *= group.scale;
+        }
+    }
+}
+
+void NeuronCalibration::readConfiguration(quint16 address, int count)
+{
+    SpiReply *reply = m_spi->readRegisters(address, count);
+    connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+    connect(reply, &SpiReply::finished, this, [this, reply, address, count] {
+        QVector<quint16> result = reply->result();
+        if (reply->error() != SpiError::NoError || result.count() < count) {
+            qCWarning(dcNeuronCalibration()) << "Could not read the configuration registers" << address << "of sub-node" << m_subNode << reply->errorString();
+            m_readFailed = true;
+        } else {
+            for (int i = 0; i < count; i++) {
+                m_configuration.insert(address + i, result.at(i));
+            }
+        }
+        if (--m_pendingReads == 0) {
+            finishLoad();
+        }
+    });
+}
+
+void NeuronCalibration::finishLoad()
+{
+    m_inputUnits = units(m_inputs);
+    m_outputUnits = units(m_outputs);
+    m_isLoaded = !m_readFailed;
+    qCDebug(dcNeuronCalibration()) << "Sub-node" << m_subNode << m_inputs.count() << "analog inputs in" << m_inputGroups.count() << "groups," << m_outputs.count() << "analog outputs in" << m_outputGroups.count() << "groups";
+    emit loaded(m_isLoaded);
+}
@@ -0,0 +1,134 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONCALIBRATION_H
+#define NEURONCALIBRATION_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+
+#include <QLoggingCategory>
+
+#include "modbusmap.h"
+
+Q_DECLARE_LOGGING_CATEGORY(dcNeuronCalibration)
+
+class NeuronSpi;
+
+// Engineering values of the analog channels of one sub-node.
+//
+// The boards apply their factory calibration themselves: the Basic analog
+// registers hold calibrated Real values, the outputs of the E-4Ai4Ao groups
+// are Words with the scale documented in their name, "(0..4000 ~ 0..10V)".
+// The unit of a channel follows its configuration register, whose modes are
+// listed in value order by its name, "Configuration(U/I/R)" is 0 for volts,
+// 1 for milliamperes and 2 for ohms.
+//
+// load() reads the configuration registers of the sub-node with one merged
+// read, afterwards whole groups are converted from the register image.
+class NeuronCalibration : public QObject
+{
+    Q_OBJECT
+public:
+    enum Unit {
+        UnitVolt,
+        UnitMilliAmpere,
+        UnitOhm,
+        UnitUnknown
+    };
+
+    // Channels of one data type whose value registers are stored back to back
+    struct Group {
+        quint16 address = 0; // Value register of the first channel
+        int count = 0;
+        int firstChannel = 0;
+        ModbusMapImage::DataType dataType = ModbusMapImage::DataTypeReal;
+        float scale = 1; // Word groups, value = word * scale
+    };
+
+    explicit NeuronCalibration(NeuronSpi *spi, ModbusMap *modbusMap, int subNode, QObject *parent = nullptr);
+
+    int subNode() const;
+
+    // Emits loaded() once the configuration registers are read
+    void load();
+    bool isLoaded() const;
+
+    // Channels are named by circuit, e.g. "1.1", in register order
+    QStringList analogInputChannels() const;
+    QStringList analogOutputChannels() const;
+    Unit analogInputUnit(int channel) const;
+    Unit analogOutputUnit(int channel) const;
+    QList<Group> analogInputGroups() const;
+    QList<Group> analogOutputGroups() const;
+    // Value register circuits of all channels, to be read by the process image
+    QList<ModbusMap::CircuitHandle> circuits() const;
+
+    // Converts all channels, registers is the image of the sub-node indexed by register address
+    // and values holds one entry per channel
+    void analogInputValues(const quint16 *registers, float *values) const;
+    void analogOutputValues(const quint16 *registers, float *values) const;
+    // Encodes the output group into words, written back to back starting at group.address
+    void analogOutputRegisters(const Group &group, const float *values, quint16 *words) const;
+    static int wordCount(const Group &group);
+
+    static QString unitName(Unit unit);
+
+private:
+    struct Channel {
+        QString name;
+        ModbusMap::CircuitHandle circuit;
+        ModbusMapImage::DataType dataType;
+        float scale;
+        Unit scaleUnit; // Documented by the scale of the value register
+        int configurationAddress; // -1 without configuration register
+        QStringList modes; // Listed by the configuration register
+    };
+
+    NeuronSpi *m_spi;
+    ModbusMap *m_modbusMap;
+    int m_subNode;
+    bool m_isLoaded = false;
+    int m_pendingReads = 0;
+    bool m_readFailed = false;
+
+    QVector<Channel> m_inputs;
+    QVector<Channel> m_outputs;
+    QList<Group> m_inputGroups;
+    QList<Group> m_outputGroups;
+    QVector<Unit> m_inputUnits;
+    QVector<Unit> m_outputUnits;
+    QHash<quint16, quint16> m_configuration;
+
+    QVector<Channel> channels(const QString &valuePrefix, const QString &configurationPrefix) const;
+    QList<Group> groups(const QVector<Channel> &channels) const;
+    QVector<Unit> units(const QVector<Channel> &channels) const;
+    void convert(const QList<Group> &groups, const quint16 *registers, float *values) const;
+    void readConfiguration(quint16 address, int count);
+    void finishLoad();
+
+signals:
+    void loaded(bool success);
+};
+
+#endif // NEURONCALIBRATION_H
@@ -0,0 +1,137 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuroncounters.h"
+#include "neuronprocessimage.h"
+#include "neuronregister.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(dcNeuronCounters, "NeuronCounters")
+
+static const QString counterPrefix = "Counter of Digital Input ";
+
+NeuronCounters::NeuronCounters(NeuronProcessImage *processImage, ModbusMap *modbusMap, QObject *parent) :
+    QObject{parent},
+    m_processImage(processImage),
+    m_modbusMap(modbusMap)
+{
+    for (int i = 0; i < m_modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        ModbusMap::CircuitHandle handle = m_modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i);
+        QString name = m_modbusMap->circuitName(handle);
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(handle);
+        if (!name.startsWith(counterPrefix) || entry.dataType != ModbusMapImage::DataTypeDWord) {
+            continue;
+        }
+        if (!m_processImage->watch(handle)) {
+            continue;
+        }
+        Counter counter;
+        counter.circuit = handle;
+        counter.name = name.mid(counterPrefix.length());
+        counter.subNode = entry.subNode;
+        m_counters.append(counter);
+    }
+    qCDebug(dcNeuronCounters()) << "Found" << m_counters.count() << "digital input counters";
+
+    connect(m_processImage, &NeuronProcessImage::cycleFinished, this, &NeuronCounters::update);
+}
+
+int NeuronCounters::count() const
+{
+    return m_counters.count();
+}
+
+QStringList NeuronCounters::names() const
+{
+    QStringList names;
+    foreach (const Counter &counter, m_counters) {
+        names.append(counter.name);
+    }
+    return names;
+}
+
+int NeuronCounters::indexOf(const QString &name, int subNode) const
+{
+    for (int i = 0; i < m_counters.count(); i++) {
+        if (m_counters.at(i).name == name && (subNode == 0 || m_counters.at(i).subNode == subNode)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const NeuronCounters::Counter &NeuronCounters::counter(int index) const
+{
+    return m_counters.at(index);
+}
+
+quint64 NeuronCounters::wraps() const
+{
+    return m_wraps;
+}
+
+quint64 NeuronCounters::resets() const
+{
+    return m_resets;
+}
+
+void NeuronCounters::update()
+{
+    // A failed read leaves stale registers in the image, the next complete cycle catches up
+    if (m_processImage->cycleErrors() > 0) {
+        return;
+    }
+
+    qint64 timestamp = m_processImage->cycleTimestamp();
+    double interval = (timestamp - m_lastTimestamp) / 1000.0;
+    for (int i = 0; i < m_counters.count(); i++) {
+        Counter &counter = m_counters[i];
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(counter.circuit);
+        const quint16 *words = m_processImage->registers(entry.subNode, entry.registerAddress);
+        if (!words) {
+            continue;
+        }
+        quint32 raw = Register<quint32, LittleEndianWords>::decode(words);
+        if (!counter.valid) {
+            counter.value = raw;
+            counter.lastRaw = raw;
+            counter.valid = true;
+            continue;
+        }
+
+        // Counters only move forward, a difference in the upper half of the range is a reset
+        quint32 delta = raw - counter.lastRaw;
+        if (delta > 0x7fffffff) {
+            qCDebug(dcNeuronCounters()) << "Counter" << counter.name << "of sub-node" << counter.subNode << "was reset";
+            m_resets++;
+            delta = raw;
+        } else if (raw < counter.lastRaw) {
+            m_wraps++;
+        }
+        counter.value += delta;
+        counter.rate = interval > 0 ? delta / interval : 0;
+        counter.lastRaw = raw;
+    }
+    m_lastTimestamp = timestamp;
+    emit updated();
+}
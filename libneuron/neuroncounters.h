@@ -0,0 +1,80 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONCOUNTERS_H
+#define NEURONCOUNTERS_H
+
+#include <QObject>
+#include <QVector>
+
+#include "modbusmap.h"
+
+class NeuronProcessImage;
+
+// Pulse counters of the digital inputs.
+//
+// The 32 bit counter registers of all sub-nodes are scanned by the process
+// image, which merges the consecutive counters of a sub-node into one read.
+// Every cycle the counters are extended to 64 bit and their rate is calculated
+// over the time since the previous cycle.
+class NeuronCounters : public QObject
+{
+    Q_OBJECT
+public:
+    struct Counter {
+        ModbusMap::CircuitHandle circuit = ModbusMap::InvalidCircuitHandle;
+        QString name; // The digital input, e.g. "1.1"
+        int subNode = 0;
+        quint64 value = 0;
+        double rate = 0; // In pulses per second
+        quint32 lastRaw = 0;
+        bool valid = false; // The counter was read at least once
+    };
+
+    explicit NeuronCounters(NeuronProcessImage *processImage, ModbusMap *modbusMap, QObject *parent = nullptr);
+
+    int count() const;
+    QStringList names() const;
+    int indexOf(const QString &name, int subNode = 0) const;
+    const Counter &counter(int index) const;
+
+    // Counter wraps detected since the counters were created
+    quint64 wraps() const;
+    // Counters which were set back on the board, e.g. by writing the register
+    quint64 resets() const;
+
+private:
+    NeuronProcessImage *m_processImage;
+    ModbusMap *m_modbusMap;
+    QVector<Counter> m_counters;
+    qint64 m_lastTimestamp = 0;
+    quint64 m_wraps = 0;
+    quint64 m_resets = 0;
+
+    void update();
+
+signals:
+    // Emitted after every cycle in which the counters were read
+    void updated();
+};
+
+#endif // NEURONCOUNTERS_H
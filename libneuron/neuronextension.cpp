@@ -0,0 +1,63 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronextension.h"
+#include "neuronmodbusrtu.h"
+
+NeuronExtension::NeuronExtension(NeuronModbusRtu *bus, quint8 slaveAddress, const QString &model, QObject *parent) :
+    QObject{parent},
+    m_bus(bus),
+    m_slaveAddress(slaveAddress),
+    m_model(model)
+{
+
+}
+
+QString NeuronExtension::model() const
+{
+    return m_model;
+}
+
+quint8 NeuronExtension::slaveAddress() const
+{
+    return m_slaveAddress;
+}
+
+SpiReply *NeuronExtension::readRegisters(quint16 reg, quint8 cnt)
+{
+    return m_bus->readRegisters(m_slaveAddress, reg, cnt);
+}
+
+SpiReply *NeuronExtension::writeRegister(quint16 reg, quint16 value)
+{
+    return m_bus->writeRegister(m_slaveAddress, reg, value);
+}
+
+SpiReply *NeuronExtension::writeRegisters(quint16 reg, const QVector<quint16> &values)
+{
+    return m_bus->writeRegisters(m_slaveAddress, reg, values);
+}
+
+SpiReply *NeuronExtension::writeBit(quint16 reg, quint8 value)
+{
+    return m_bus->writeCoil(m_slaveAddress, reg, value);
+}
@@ -0,0 +1,54 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONEXTENSION_H
+#define NEURONEXTENSION_H
+
+#include <QObject>
+
+#include "spimessage.h"
+
+class NeuronModbusRtu;
+
+// Extension module, e.g. a xS11, as Modbus RTU slave on the RS485 line.
+// The register and coil addresses are the ones of its map, see ModbusMap::addExtension().
+class NeuronExtension : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NeuronExtension(NeuronModbusRtu *bus, quint8 slaveAddress, const QString &model, QObject *parent = nullptr);
+
+    QString model() const;
+    quint8 slaveAddress() const;
+
+    SpiReply *readRegisters(quint16 reg, quint8 cnt);
+    SpiReply *writeRegister(quint16 reg, quint16 value);
+    SpiReply *writeRegisters(quint16 reg, const QVector<quint16> &values);
+    SpiReply *writeBit(quint16 reg, quint8 value);
+
+private:
+    NeuronModbusRtu *m_bus;
+    quint8 m_slaveAddress;
+    QString m_model;
+};
+
+#endif // NEURONEXTENSION_H
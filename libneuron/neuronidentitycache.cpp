@@ -0,0 +1,128 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronidentitycache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(dcNeuronIdentityCache, "NeuronIdentityCache")
+
+NeuronIdentityCache::NeuronIdentityCache(const QString &fileName, QObject *parent) :
+    QObject{parent},
+    m_fileName(fileName)
+{
+
+}
+
+QString NeuronIdentityCache::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/libneuron/identity.json";
+}
+
+NeuronIdentityCache::Identity NeuronIdentityCache::identity(const QString &devicePath) const
+{
+    Identity identity;
+    QJsonObject object = load().value(devicePath).toObject();
+    if (object.isEmpty()) {
+        return identity;
+    }
+
+    identity.boardVersion.SwVersion = object.value("swVersion").toInt();
+    identity.boardVersion.HwVersion = object.value("hwVersion").toInt();
+    identity.boardVersion.BaseHwVersion = object.value("baseHwVersion").toInt();
+    identity.boardVersion.DiCount = object.value("diCount").toInt();
+    identity.boardVersion.DoCount = object.value("doCount").toInt();
+    identity.boardVersion.AiCount = object.value("aiCount").toInt();
+    identity.boardVersion.AoCount = object.value("aoCount").toInt();
+    identity.boardVersion.UartCount = object.value("uartCount").toInt();
+    identity.boardVersion.uLedCount = object.value("uLedCount").toInt();
+    identity.boardVersion.IntMaskRegister = object.value("intMaskRegister").toInt();
+    identity.speed = object.value("speed").toInt();
+    identity.isValid = (identity.speed > 0);
+    return identity;
+}
+
+bool NeuronIdentityCache::storeIdentity(const QString &devicePath, const Identity &identity)
+{
+    QJsonObject object;
+    object.insert("swVersion", identity.boardVersion.SwVersion);
+    object.insert("hwVersion", identity.boardVersion.HwVersion);
+    object.insert("baseHwVersion", identity.boardVersion.BaseHwVersion);
+    object.insert("diCount", identity.boardVersion.DiCount);
+    object.insert("doCount", identity.boardVersion.DoCount);
+    object.insert("aiCount", identity.boardVersion.AiCount);
+    object.insert("aoCount", identity.boardVersion.AoCount);
+    object.insert("uartCount", identity.boardVersion.UartCount);
+    object.insert("uLedCount", identity.boardVersion.uLedCount);
+    object.insert("intMaskRegister", identity.boardVersion.IntMaskRegister);
+    object.insert("speed", identity.speed);
+
+    QJsonObject cache = load();
+    cache.insert(devicePath, object);
+    return save(cache);
+}
+
+bool NeuronIdentityCache::removeIdentity(const QString &devicePath)
+{
+    QJsonObject cache = load();
+    if (!cache.contains(devicePath)) {
+        return true;
+    }
+    cache.remove(devicePath);
+    return save(cache);
+}
+
+QJsonObject NeuronIdentityCache::load() const
+{
+    QFile cacheFile(m_fileName);
+    if (!cacheFile.open(QIODevice::ReadOnly)) {
+        return QJsonObject();
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(cacheFile.readAll(), &error);
+    if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+        qCWarning(dcNeuronIdentityCache()) << "Ignoring corrupted identity cache" << m_fileName;
+        return QJsonObject();
+    }
+    return doc.object();
+}
+
+bool NeuronIdentityCache::save(const QJsonObject &object)
+{
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+
+    // Written to a temporary file first, an interrupted write never leaves a broken cache behind
+    QSaveFile cacheFile(m_fileName);
+    if (!cacheFile.open(QIODevice::WriteOnly)) {
+        qCWarning(dcNeuronIdentityCache()) << "Could not write identity cache" << m_fileName << cacheFile.errorString();
+        return false;
+    }
+    cacheFile.write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    return cacheFile.commit();
+}
@@ -0,0 +1,58 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONIDENTITYCACHE_H
+#define NEURONIDENTITYCACHE_H
+
+#include <QObject>
+#include <QJsonObject>
+
+#include "neuronutil.h"
+
+// Remembers the detected board of every SPI device across restarts, so
+// the next start only needs to confirm it with a single register read.
+class NeuronIdentityCache : public QObject
+{
+    Q_OBJECT
+public:
+    struct Identity {
+        NeuronUtil::BoardVersion boardVersion = {};
+        int speed = 0;
+        bool isValid = false;
+    };
+
+    explicit NeuronIdentityCache(const QString &fileName = defaultFileName(), QObject *parent = nullptr);
+
+    static QString defaultFileName();
+
+    Identity identity(const QString &devicePath) const;
+    bool storeIdentity(const QString &devicePath, const Identity &identity);
+    bool removeIdentity(const QString &devicePath);
+
+private:
+    QString m_fileName;
+
+    QJsonObject load() const;
+    bool save(const QJsonObject &object);
+};
+
+#endif // NEURONIDENTITYCACHE_H
@@ -0,0 +1,253 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronmodbusrtu.h"
+#include "neuronuart.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(dcNeuronModbusRtu, "NeuronModbusRtu")
+
+NeuronModbusRtu::NeuronModbusRtu(QObject *parent) :
+    QObject{parent}
+{
+    m_responseTimer.setSingleShot(true);
+    m_responseTimer.setInterval(200);
+    connect(&m_responseTimer, &QTimer::timeout, this, [this] {
+        m_statistics.timeouts++;
+        finishRequest(SpiError::TimeoutError, "Timeout");
+    });
+    m_silenceTimer.setSingleShot(true);
+    m_silenceTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_silenceTimer, &QTimer::timeout, this, &NeuronModbusRtu::sendNext);
+}
+
+void NeuronModbusRtu::setUart(NeuronUart *uart)
+{
+    connect(uart, &NeuronUart::readyRead, this, [this, uart] {
+        receive(uart->readAll());
+    });
+    connect(this, &NeuronModbusRtu::transmit, uart, [uart] (const QByteArray &frame) {
+        if (uart->write(frame) != frame.size()) {
+            qCWarning(dcNeuronModbusRtu()) << "UART transmit buffer full, frame truncated";
+        }
+    });
+}
+
+int NeuronModbusRtu::responseTimeout() const
+{
+    return m_responseTimer.interval();
+}
+
+void NeuronModbusRtu::setResponseTimeout(int milliseconds)
+{
+    m_responseTimer.setInterval(milliseconds);
+}
+
+int NeuronModbusRtu::baudRate() const
+{
+    return m_baudRate;
+}
+
+void NeuronModbusRtu::setBaudRate(int baudRate)
+{
+    if (baudRate > 0) {
+        m_baudRate = baudRate;
+    }
+}
+
+SpiReply *NeuronModbusRtu::readRegisters(quint8 slave, quint16 reg, quint8 cnt)
+{
+    QByteArray data;
+    appendWord(&data, reg);
+    appendWord(&data, qMin<int>(cnt, maxReadRegisters));
+    return enqueue(slave, FunctionReadHoldingRegisters, data, 5 + 2 * qMin<int>(cnt, maxReadRegisters));
+}
+
+SpiReply *NeuronModbusRtu::writeRegister(quint8 slave, quint16 reg, quint16 value)
+{
+    QByteArray data;
+    appendWord(&data, reg);
+    appendWord(&data, value);
+    return enqueue(slave, FunctionWriteSingleRegister, data, 8);
+}
+
+SpiReply *NeuronModbusRtu::writeRegisters(quint8 slave, quint16 reg, const QVector<quint16> &values)
+{
+    if (values.isEmpty() || values.count() > maxWriteRegisters) {
+        qCWarning(dcNeuronModbusRtu()) << "Invalid number of registers to write" << values.count();
+        return nullptr;
+    }
+    QByteArray data;
+    appendWord(&data, reg);
+    appendWord(&data, values.count());
+    data.append((char)(values.count() * 2));
+    foreach (quint16 value, values) {
+        appendWord(&data, value);
+    }
+    return enqueue(slave, FunctionWriteMultipleRegisters, data, 8);
+}
+
+SpiReply *NeuronModbusRtu::writeCoil(quint8 slave, quint16 coil, bool value)
+{
+    QByteArray data;
+    appendWord(&data, coil);
+    appendWord(&data, value ? 0xff00 : 0x0000);
+    return enqueue(slave, FunctionWriteSingleCoil, data, 8);
+}
+
+NeuronModbusRtu::Statistics NeuronModbusRtu::statistics() const
+{
+    return m_statistics;
+}
+
+quint16 NeuronModbusRtu::crc(const char *data, int length)
+{
+    quint16 crc = 0xffff;
+    for (int i = 0; i < length; i++) {
+        crc ^= (quint8)data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+void NeuronModbusRtu::appendWord(QByteArray *data, quint16 value)
+{
+    data->append((char)(value >> 8)).append((char)(value & 0xff));
+}
+
+SpiReply *NeuronModbusRtu::enqueue(quint8 slave, Function function, const QByteArray &data, int responseLength)
+{
+    Request request;
+    request.frame.append((char)slave).append((char)function).append(data);
+    // The CRC is the only little endian word of a frame
+    quint16 checksum = crc(request.frame.constData(), request.frame.size());
+    request.frame.append((char)(checksum & 0xff)).append((char)(checksum >> 8));
+    request.responseLength = responseLength;
+    request.reply = new SpiReply(this);
+    m_queue.enqueue(request);
+    m_statistics.requests++;
+
+    if (!m_current.reply) {
+        // Sent from the event loop, the caller connects to the reply first
+        QTimer::singleShot(0, this, &NeuronModbusRtu::sendNext);
+    }
+    return request.reply;
+}
+
+int NeuronModbusRtu::frameGap() const
+{
+    // 11 bits per character, above 19200 baud the gap is fixed to 1750 us
+    int microseconds = m_baudRate > 19200 ? 1750 : 38500000 / m_baudRate;
+    return (microseconds + 999) / 1000;
+}
+
+void NeuronModbusRtu::waitForSilence(int milliseconds)
+{
+    m_silenceStart.start();
+    m_silenceTimer.start(milliseconds);
+}
+
+void NeuronModbusRtu::sendNext()
+{
+    if (m_current.reply || m_queue.isEmpty() || m_silenceTimer.isActive()) {
+        return;
+    }
+    m_current = m_queue.dequeue();
+    m_rxBuffer.clear();
+    m_responseTimer.start();
+    emit transmit(m_current.frame);
+}
+
+void NeuronModbusRtu::receive(const QByteArray &data)
+{
+    if (!m_current.reply) {
+        qCDebug(dcNeuronModbusRtu()) << "Discarding unexpected data" << data.toHex();
+        m_statistics.discardedBytes += data.size();
+        // The line is not silent yet, a babbling slave holds back the next frame for a limited time only
+        if (!m_silenceTimer.isActive()) {
+            waitForSilence(frameGap());
+        } else if (m_silenceStart.elapsed() < 4 * m_responseTimer.interval()) {
+            m_silenceTimer.start();
+        }
+        return;
+    }
+    m_rxBuffer.append(data);
+
+    // Exception responses are address, function | 0x80, exception code and CRC
+    int expected = m_current.responseLength;
+    if (m_rxBuffer.size() >= 2 && ((quint8)m_rxBuffer.at(1) & 0x80)) {
+        expected = 5;
+    }
+    if (m_rxBuffer.size() < expected) {
+        return;
+    }
+
+    const char *frame = m_rxBuffer.constData();
+    quint16 checksum = (quint8)frame[expected - 2] | ((quint8)frame[expected - 1] << 8);
+    if (checksum != crc(frame, expected - 2)) {
+        m_statistics.crcErrors++;
+        finishRequest(SpiError::CrcError, "CRC error");
+        return;
+    }
+    if (frame[0] != m_current.frame.at(0) || ((quint8)frame[1] & 0x7f) != (quint8)m_current.frame.at(1)) {
+        finishRequest(SpiError::ProtocolError, "Unexpected response");
+        return;
+    }
+    if ((quint8)frame[1] & 0x80) {
+        m_statistics.exceptions++;
+        finishRequest(SpiError::ProtocolError, QString("Modbus exception %1").arg((quint8)frame[2]));
+        return;
+    }
+
+    if ((quint8)frame[1] == FunctionReadHoldingRegisters) {
+        // The byte count must match the registers requested, the response length was derived from them
+        if ((quint8)frame[2] != expected - 5) {
+            finishRequest(SpiError::ProtocolError, QString("Unexpected byte count %1").arg((quint8)frame[2]));
+            return;
+        }
+        QVector<quint16> result((quint8)frame[2] / 2);
+        for (int i = 0; i < result.count(); i++) {
+            result[i] = ((quint8)frame[3 + 2 * i] << 8) | (quint8)frame[4 + 2 * i];
+        }
+        m_current.reply->setResult(result);
+    }
+    finishRequest(SpiError::NoError);
+}
+
+void NeuronModbusRtu::finishRequest(SpiError error, const QString &errorText)
+{
+    m_responseTimer.stop();
+    Request request = m_current;
+    m_current = Request();
+    m_rxBuffer.clear();
+    // The slave may still answer an abandoned request, its late bytes must not start the next response
+    waitForSilence(error == SpiError::NoError ? frameGap() : qMax(frameGap(), m_responseTimer.interval()));
+
+    if (error != SpiError::NoError) {
+        qCDebug(dcNeuronModbusRtu()) << "Request to slave" << (quint8)request.frame.at(0) << "failed:" << errorText;
+        request.reply->setError(error, errorText);
+    }
+    request.reply->setFinished(true);
+}
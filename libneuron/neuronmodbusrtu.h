@@ -0,0 +1,118 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONMODBUSRTU_H
+#define NEURONMODBUSRTU_H
+
+#include <QObject>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "spimessage.h"
+
+class NeuronUart;
+
+// Modbus RTU master for the extension modules on a RS485 line.
+//
+// Requests are queued and the next frame is handed to the transport once the
+// response of the previous one is complete and the line was silent for 3.5
+// characters, so the line does not wait for the caller between two requests.
+// After a failed request the line must be quiet for the response timeout, late
+// bytes of the abandoned response are dropped meanwhile. Frames are exchanged through
+// transmit() and receive(), either with a NeuronUart or with a simulated slave.
+// Replies are SpiReply objects like the ones of the local sub-nodes.
+class NeuronModbusRtu : public QObject
+{
+    Q_OBJECT
+public:
+    struct Statistics {
+        quint64 requests = 0;
+        quint64 timeouts = 0;
+        quint64 crcErrors = 0;
+        quint64 exceptions = 0;
+        quint64 discardedBytes = 0; // Received while no request was waiting for a response
+    };
+
+    static const int maxReadRegisters = 125;
+    static const int maxWriteRegisters = 123;
+
+    explicit NeuronModbusRtu(QObject *parent = nullptr);
+
+    void setUart(NeuronUart *uart);
+
+    // Time the slave has to complete its response
+    int responseTimeout() const;
+    void setResponseTimeout(int milliseconds);
+
+    // Sets the silent interval of 3.5 characters between two frames
+    int baudRate() const;
+    void setBaudRate(int baudRate);
+
+    SpiReply *readRegisters(quint8 slave, quint16 reg, quint8 cnt);
+    SpiReply *writeRegister(quint8 slave, quint16 reg, quint16 value);
+    // Returns nullptr if the values do not fit into one frame
+    SpiReply *writeRegisters(quint8 slave, quint16 reg, const QVector<quint16> &values);
+    SpiReply *writeCoil(quint8 slave, quint16 coil, bool value);
+
+    Statistics statistics() const;
+
+    static quint16 crc(const char *data, int length);
+
+private:
+    enum Function {
+        FunctionReadHoldingRegisters = 0x03,
+        FunctionWriteSingleCoil = 0x05,
+        FunctionWriteSingleRegister = 0x06,
+        FunctionWriteMultipleRegisters = 0x10
+    };
+
+    struct Request {
+        QByteArray frame;
+        int responseLength = 0; // Including address, function and CRC
+        SpiReply *reply = nullptr;
+    };
+
+    QQueue<Request> m_queue;
+    Request m_current;
+    QByteArray m_rxBuffer;
+    QTimer m_responseTimer;
+    QTimer m_silenceTimer; // Runs while the line must stay silent before the next frame
+    QElapsedTimer m_silenceStart;
+    int m_baudRate = 19200;
+    Statistics m_statistics;
+
+    static void appendWord(QByteArray *data, quint16 value);
+    SpiReply *enqueue(quint8 slave, Function function, const QByteArray &data, int responseLength);
+    int frameGap() const; // In milliseconds, 3.5 characters rounded up
+    void waitForSilence(int milliseconds);
+    void sendNext();
+    void finishRequest(SpiError error, const QString &errorText = QString());
+
+public slots:
+    void receive(const QByteArray &data);
+
+signals:
+    void transmit(const QByteArray &frame);
+};
+
+#endif // NEURONMODBUSRTU_H
@@ -0,0 +1,572 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "neuronmodbustcpserver.h"
+#include "neuronsharedimage.h"
+#include "modbusmap.h"
+
+#include <QLoggingCategory>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+Q_LOGGING_CATEGORY(dcNeuronModbusTcp, "NeuronModbusTcp")
+
+static quint16 bigEndianWord(const QByteArray &data, int index)
+{
+    return (static_cast<quint8>(data.at(index)) << 8) | static_cast<quint8>(data.at(index + 1));
+}
+
+static void appendWord(QByteArray *data, quint16 value)
+{
+    data->append(static_cast<char>(value >> 8));
+    data->append(static_cast<char>(value & 0xff));
+}
+
+NeuronModbusTcpServer::NeuronModbusTcpServer(NeuronSharedImage *sharedImage, const ModbusMap *modbusMap, QObject *parent) :
+    QThread{parent},
+    m_sharedImage(sharedImage)
+{
+    // Copied here, the map is not touched from the server thread
+    m_nodeRanges.resize(sharedImage->unitCount());
+    m_coils.resize(sharedImage->unitCount());
+    m_publishedRegisters.resize(sharedImage->unitCount());
+    for (int unit = 1; unit <= m_nodeRanges.count(); unit++) {
+        m_nodeRanges[unit - 1] = modbusMap->nodeRange(unit);
+        m_publishedRegisters[unit - 1].fill(false, sharedImage->registersPerUnit());
+    }
+    // neurond publishes the basic registers, the others stay 0 in the image and are not answered
+    for (int i = 0; i < modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i));
+        if (entry.category != ModbusMapImage::CategoryBasic || entry.subNode < 1 || entry.subNode > m_publishedRegisters.count()) {
+            continue;
+        }
+        QVector<bool> &published = m_publishedRegisters[entry.subNode - 1];
+        for (int j = entry.address; j < entry.address + qMax<int>(entry.count, 1) && j < published.count(); j++) {
+            published[j] = true;
+        }
+    }
+    for (int type = ModbusMapImage::CircuitTypeDigitalInput; type <= ModbusMapImage::CircuitTypeUserLED; type++) {
+        for (int i = 0; i < modbusMap->circuitCount(static_cast<ModbusMapImage::CircuitType>(type)); i++) {
+            const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(static_cast<ModbusMapImage::CircuitType>(type), i));
+            if (entry.dataType != ModbusMapImage::DataTypeMixedBits || entry.subNode < 1 || entry.subNode > m_coils.count()
+                    || !isPublished(entry.subNode, entry.registerAddress)) {
+                continue;
+            }
+            m_coils[entry.subNode - 1].insert(entry.address, (static_cast<quint32>(entry.registerAddress) << 8) | entry.startBit);
+        }
+    }
+    // The "Via Unit 0" layout of the registers and coils of all sub-nodes
+    for (int type = ModbusMapImage::CircuitTypeCoil; type <= ModbusMapImage::CircuitTypeRegister; type++) {
+        QHash<quint16, quint32> &addresses = type == ModbusMapImage::CircuitTypeCoil ? m_unitZeroCoils : m_unitZeroRegisters;
+        for (int i = 0; i < modbusMap->circuitCount(static_cast<ModbusMapImage::CircuitType>(type)); i++) {
+            const ModbusMapImage::Entry &entry = modbusMap->circuit(modbusMap->circuitHandle(static_cast<ModbusMapImage::CircuitType>(type), i));
+            if (entry.subNode < 1 || entry.subNode > m_nodeRanges.count()) {
+                continue;
+            }
+            for (int j = 0; j < qMax<int>(entry.count, 1); j++) {
+                addresses.insert(entry.unitZeroAddress + j, (static_cast<quint32>(entry.subNode) << 16) | static_cast<quint16>(entry.address + j));
+            }
+        }
+    }
+    m_registers.resize(sharedImage->registersPerUnit());
+    m_image.resize(sharedImage->unitCount() * sharedImage->registersPerUnit());
+}
+
+NeuronModbusTcpServer::~NeuronModbusTcpServer()
+{
+    requestInterruption();
+    wait();
+    if (m_epollFd >= 0) {
+        ::close(m_epollFd);
+    }
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+    }
+}
+
+bool NeuronModbusTcpServer::listen(quint16 port, int maxClients)
+{
+    m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0) {
+        qCWarning(dcNeuronModbusTcp()) << "Could not create socket:" << strerror(errno);
+        return false;
+    }
+    int enable = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 || ::listen(m_listenFd, 16) < 0) {
+        qCWarning(dcNeuronModbusTcp()) << "Could not listen on port" << port << strerror(errno);
+        return false;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(m_listenFd, reinterpret_cast<struct sockaddr *>(&address), &length);
+    m_port = ntohs(address.sin_port);
+    m_maxClients = maxClients;
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = m_listenFd;
+    if (m_epollFd < 0 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &event) < 0) {
+        qCWarning(dcNeuronModbusTcp()) << "Could not create epoll instance:" << strerror(errno);
+        return false;
+    }
+    qCDebug(dcNeuronModbusTcp()) << "Listening on port" << m_port;
+    return true;
+}
+
+quint16 NeuronModbusTcpServer::port() const
+{
+    return m_port;
+}
+
+NeuronModbusTcpServer::Statistics NeuronModbusTcpServer::statistics() const
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_statistics;
+}
+
+void NeuronModbusTcpServer::run()
+{
+    struct epoll_event events[32];
+    while (!isInterruptionRequested()) {
+        int count = epoll_wait(m_epollFd, events, 32, m_maxWait);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qCWarning(dcNeuronModbusTcp()) << "Could not wait for clients:" << strerror(errno);
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_listenFd) {
+                acceptClients();
+                continue;
+            }
+            QHash<int, Client>::iterator client = m_clients.find(fd);
+            if (client == m_clients.end()) {
+                continue;
+            }
+            bool open = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                open = readClient(fd, &client.value());
+            }
+            if (open && (events[i].events & EPOLLOUT)) {
+                open = flushClient(fd, &client.value());
+            }
+            if (!open) {
+                closeClient(fd);
+            }
+        }
+    }
+    foreach (int fd, m_clients.keys()) {
+        closeClient(fd);
+    }
+}
+
+void NeuronModbusTcpServer::acceptClients()
+{
+    forever {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                qCWarning(dcNeuronModbusTcp()) << "Could not accept client:" << strerror(errno);
+            }
+            return;
+        }
+        if (m_clients.count() >= m_maxClients) {
+            qCWarning(dcNeuronModbusTcp()) << "Rejecting client, already serving" << m_clients.count();
+            ::close(fd);
+            continue;
+        }
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ::close(fd);
+            continue;
+        }
+        m_clients.insert(fd, Client());
+        QMutexLocker locker(&m_statisticsMutex);
+        m_statistics.connections++;
+    }
+}
+
+bool NeuronModbusTcpServer::readClient(int fd, Client *client)
+{
+    char buffer[1024];
+    forever {
+        ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if (length == 0) {
+            return false;
+        }
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        client->rx.append(buffer, length);
+    }
+
+    // MBAP header: transaction, protocol, length of unit and PDU, unit
+    int offset = 0;
+    while (client->rx.size() - offset >= 8) {
+        quint16 protocol = bigEndianWord(client->rx, offset + 2);
+        int length = bigEndianWord(client->rx, offset + 4);
+        if (protocol != 0 || length < 2 || length > m_maxPduLength + 1) {
+            qCDebug(dcNeuronModbusTcp()) << "Closing client sending an invalid frame header";
+            return false;
+        }
+        if (client->rx.size() - offset < 6 + length) {
+            break;
+        }
+        bool exception = false;
+        QByteArray pdu = processRequest(client->rx.at(offset + 6), client->rx.mid(offset + 7, length - 1), &exception);
+        client->tx.append(client->rx.constData() + offset, 4);
+        appendWord(&client->tx, pdu.size() + 1);
+        client->tx.append(client->rx.at(offset + 6));
+        client->tx.append(pdu);
+        offset += 6 + length;
+
+        QMutexLocker locker(&m_statisticsMutex);
+        m_statistics.requests++;
+        if (exception) {
+            m_statistics.exceptions++;
+        }
+    }
+    client->rx.remove(0, offset);
+
+    if (client->tx.size() > m_maxPendingResponses) {
+        qCDebug(dcNeuronModbusTcp()) << "Closing client not reading its responses";
+        return false;
+    }
+    return flushClient(fd, client);
+}
+
+bool NeuronModbusTcpServer::flushClient(int fd, Client *client)
+{
+    bool pending = !client->tx.isEmpty();
+    while (!client->tx.isEmpty()) {
+        ssize_t length = ::send(fd, client->tx.constData(), client->tx.size(), MSG_NOSIGNAL);
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        client->tx.remove(0, length);
+    }
+    if (!pending) {
+        return true;
+    }
+
+    // Only wait for the socket to become writable while responses are left over
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = client->tx.isEmpty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    return epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void NeuronModbusTcpServer::closeClient(int fd)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    m_clients.remove(fd);
+}
+
+QByteArray NeuronModbusTcpServer::processRequest(quint8 unitId, const QByteArray &pdu, bool *exception)
+{
+    quint8 function = pdu.at(0);
+    // Unit 0 addresses all sub-nodes in the "Via Unit 0" layout
+    int unit = unitId == 255 ? 0 : unitId;
+    Exception code = ExceptionIllegalFunction;
+    QByteArray response;
+
+    if (unit > m_nodeRanges.count()) {
+        code = ExceptionGatewayTargetFailed;
+    } else if (function < FunctionReadCoils || (function > FunctionWriteSingleRegister && function != FunctionWriteMultipleCoils && function != FunctionWriteMultipleRegisters)) {
+        code = ExceptionIllegalFunction;
+    } else if (pdu.size() < 5) {
+        code = ExceptionIllegalDataValue;
+    } else {
+        quint16 address = bigEndianWord(pdu, 1);
+        quint16 value = bigEndianWord(pdu, 3);
+        switch (function) {
+        case FunctionReadCoils:
+        case FunctionReadDiscreteInputs:
+            response = readBits(unit, address, value, &code);
+            break;
+        case FunctionReadHoldingRegisters:
+        case FunctionReadInputRegisters:
+            response = readRegisters(unit, address, value, &code);
+            break;
+        case FunctionWriteSingleCoil:
+            if (value != 0xff00 && value != 0x0000) {
+                code = ExceptionIllegalDataValue;
+                break;
+            }
+            if (writeBits(unit, address, QVector<bool>() << (value == 0xff00), &code)) {
+                response = pdu.mid(1, 4);
+            }
+            break;
+        case FunctionWriteSingleRegister:
+            if (writeRegisters(unit, address, QVector<quint16>() << value, &code)) {
+                response = pdu.mid(1, 4);
+            }
+            break;
+        case FunctionWriteMultipleCoils: {
+            int byteCount = pdu.size() > 5 ? static_cast<quint8>(pdu.at(5)) : -1;
+            if (value < 1 || value > 1968 || byteCount != (value + 7) / 8 || pdu.size() != 6 + byteCount) {
+                code = ExceptionIllegalDataValue;
+                break;
+            }
+            QVector<bool> values(value);
+            for (int i = 0; i < value; i++) {
+                values[i] = pdu.at(6 + i / 8) & (1 << (i % 8));
+            }
+            if (writeBits(unit, address, values, &code)) {
+                response = pdu.mid(1, 4);
+            }
+            break;
+        }
+        case FunctionWriteMultipleRegisters: {
+            int byteCount = pdu.size() > 5 ? static_cast<quint8>(pdu.at(5)) : -1;
+            if (value < 1 || value > 123 || byteCount != value * 2 || pdu.size() != 6 + byteCount) {
+                code = ExceptionIllegalDataValue;
+                break;
+            }
+            QVector<quint16> values(value);
+            for (int i = 0; i < value; i++) {
+                values[i] = bigEndianWord(pdu, 6 + i * 2);
+            }
+            if (writeRegisters(unit, address, values, &code)) {
+                response = pdu.mid(1, 4);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Write responses echo address and value or quantity of the request
+    if (!response.isEmpty()) {
+        response.prepend(function);
+        return response;
+    }
+    *exception = true;
+    qCDebug(dcNeuronModbusTcp()) << "Exception" << code << "for function" << function << "of unit" << unitId;
+    response.append(static_cast<char>(function | 0x80));
+    response.append(static_cast<char>(code));
+    return response;
+}
+
+bool NeuronModbusTcpServer::resolveUnitZero(const QHash<quint16, quint32> &addresses, quint16 address, int count, QVector<quint32> *locations, Exception *exception) const
+{
+    // Every address of the request must exist, there are gaps between the sub-nodes
+    locations->resize(count);
+    for (int i = 0; i < count; i++) {
+        if (address + i > 0xffff || !addresses.contains(address + i)) {
+            *exception = ExceptionIllegalDataAddress;
+            return false;
+        }
+        (*locations)[i] = addresses.value(address + i);
+    }
+    return true;
+}
+
+bool NeuronModbusTcpServer::isPublished(int unit, int address) const
+{
+    const QVector<bool> &published = m_publishedRegisters.at(unit - 1);
+    return address < published.count() && published.at(address);
+}
+
+bool NeuronModbusTcpServer::readBit(int unit, const quint16 *registers, quint16 coil) const
+{
+    quint32 location = m_coils.at(unit - 1).value(coil);
+    quint16 reg = location >> 8;
+    return reg < m_registers.count() && (registers[reg] & (1 << (location & 0xff)));
+}
+
+QByteArray NeuronModbusTcpServer::readBits(int unit, quint16 address, quint16 count, Exception *exception)
+{
+    if (count < 1 || count > 2000) {
+        *exception = ExceptionIllegalDataValue;
+        return QByteArray();
+    }
+    QVector<quint32> locations(count);
+    if (unit == 0) {
+        if (!resolveUnitZero(m_unitZeroCoils, address, count, &locations, exception)) {
+            return QByteArray();
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            locations[i] = (static_cast<quint32>(unit) << 16) | static_cast<quint16>(address + i);
+        }
+    }
+    foreach (quint32 location, locations) {
+        if (!m_coils.at((location >> 16) - 1).contains(location & 0xffff)) {
+            *exception = ExceptionIllegalDataAddress;
+            return QByteArray();
+        }
+    }
+
+    // One copy of the unit, or of all units for unit 0, keeps all bits of the response from the same cycle
+    bool copied = unit == 0 ? m_sharedImage->snapshot(m_image.data(), m_image.count()) : m_sharedImage->readRegisters(unit, 0, m_registers.count(), m_registers.data());
+    if (!copied) {
+        *exception = ExceptionServerDeviceBusy;
+        return QByteArray();
+    }
+    QByteArray response(1 + (count + 7) / 8, 0);
+    response[0] = static_cast<char>(response.size() - 1);
+    for (int i = 0; i < count; i++) {
+        int locationUnit = locations.at(i) >> 16;
+        const quint16 *registers = unit == 0 ? m_image.constData() + (locationUnit - 1) * m_registers.count() : m_registers.constData();
+        if (readBit(locationUnit, registers, locations.at(i) & 0xffff)) {
+            response[1 + i / 8] = static_cast<char>(response.at(1 + i / 8) | (1 << (i % 8)));
+        }
+    }
+    return response;
+}
+
+QByteArray NeuronModbusTcpServer::readRegisters(int unit, quint16 address, quint16 count, Exception *exception)
+{
+    if (count < 1 || count > 125) {
+        *exception = ExceptionIllegalDataValue;
+        return QByteArray();
+    }
+    QByteArray response;
+    response.reserve(1 + count * 2);
+    response.append(static_cast<char>(count * 2));
+
+    if (unit == 0) {
+        // The registers may belong to several sub-nodes, all of them are taken from one snapshot
+        QVector<quint32> locations;
+        if (!resolveUnitZero(m_unitZeroRegisters, address, count, &locations, exception)) {
+            return QByteArray();
+        }
+        foreach (quint32 location, locations) {
+            if (!isPublished(location >> 16, location & 0xffff)) {
+                *exception = ExceptionIllegalDataAddress;
+                return QByteArray();
+            }
+        }
+        if (!m_sharedImage->snapshot(m_image.data(), m_image.count())) {
+            *exception = ExceptionServerDeviceBusy;
+            return QByteArray();
+        }
+        foreach (quint32 location, locations) {
+            appendWord(&response, m_image.at(((location >> 16) - 1) * m_registers.count() + (location & 0xffff)));
+        }
+        return response;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!isPublished(unit, address + i)) {
+            *exception = ExceptionIllegalDataAddress;
+            return QByteArray();
+        }
+    }
+    if (!m_sharedImage->readRegisters(unit, address, count, m_registers.data())) {
+        *exception = ExceptionIllegalDataAddress;
+        return QByteArray();
+    }
+    for (int i = 0; i < count; i++) {
+        appendWord(&response, m_registers.at(i));
+    }
+    return response;
+}
+
+bool NeuronModbusTcpServer::writeBits(int unit, quint16 address, const QVector<bool> &values, Exception *exception)
+{
+    QVector<quint32> locations;
+    if (unit == 0) {
+        if (!resolveUnitZero(m_unitZeroCoils, address, values.count(), &locations, exception)) {
+            return false;
+        }
+    } else {
+        const ModbusMapImage::NodeRange &range = m_nodeRanges.at(unit - 1);
+        if (address < range.firstCoil || address + values.count() - 1 > range.lastCoil) {
+            *exception = ExceptionIllegalDataAddress;
+            return false;
+        }
+    }
+    for (int i = 0; i < values.count(); i++) {
+        bool posted = unit == 0 ? m_sharedImage->postWriteBit(locations.at(i) >> 16, locations.at(i) & 0xffff, values.at(i)) : m_sharedImage->postWriteBit(unit, address + i, values.at(i));
+        if (!posted) {
+            *exception = ExceptionServerDeviceBusy;
+            return false;
+        }
+    }
+    QMutexLocker locker(&m_statisticsMutex);
+    m_statistics.writes += values.count();
+    return true;
+}
+
+bool NeuronModbusTcpServer::writeRegisters(int unit, quint16 address, const QVector<quint16> &values, Exception *exception)
+{
+    QVector<quint32> locations;
+    if (unit == 0) {
+        if (!resolveUnitZero(m_unitZeroRegisters, address, values.count(), &locations, exception)) {
+            return false;
+        }
+    } else {
+        const ModbusMapImage::NodeRange &range = m_nodeRanges.at(unit - 1);
+        if (address < range.firstRegister || address + values.count() - 1 > range.lastRegister) {
+            *exception = ExceptionIllegalDataAddress;
+            return false;
+        }
+    }
+    for (int i = 0; i < values.count(); i++) {
+        bool posted = unit == 0 ? m_sharedImage->postWriteRegister(locations.at(i) >> 16, locations.at(i) & 0xffff, values.at(i)) : m_sharedImage->postWriteRegister(unit, address + i, values.at(i));
+        if (!posted) {
+            *exception = ExceptionServerDeviceBusy;
+            return false;
+        }
+    }
+    QMutexLocker locker(&m_statisticsMutex);
+    m_statistics.writes += values.count();
+    return true;
+}
@@ -0,0 +1,133 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef NEURONMODBUSTCPSERVER_H
+#define NEURONMODBUSTCPSERVER_H
+
+#include <QThread>
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+
+#include "modbusmapimage.h"
+
+class ModbusMap;
+class NeuronSharedImage;
+
+// Modbus TCP server answering from the shared process image.
+//
+// All clients are served by one epoll loop on its own thread. Reads are
+// answered from a consistent copy of the published image, so polling clients
+// cause no SPI transfers at all. Writes are posted into the command ring of the
+// image and executed by the daemon with its next commands. The unit identifier
+// selects the sub-node, addresses are the ones of the "Via Unit N" columns of
+// the modbus map. Unit 0 and 255 address all sub-nodes in the "Via Unit 0"
+// layout, e.g. 100 for the first digital input of the second sub-node.
+// Reads are limited to the basic registers neurond publishes, any other
+// address is answered with an illegal data address exception.
+class NeuronModbusTcpServer : public QThread
+{
+    Q_OBJECT
+public:
+    struct Statistics {
+        quint64 connections = 0;
+        quint64 requests = 0;
+        quint64 exceptions = 0;
+        quint64 writes = 0;
+    };
+
+    // The map is only used in the constructor
+    explicit NeuronModbusTcpServer(NeuronSharedImage *sharedImage, const ModbusMap *modbusMap, QObject *parent = nullptr);
+    ~NeuronModbusTcpServer() override;
+
+    // Binds the listening socket, start() serves the clients afterwards
+    bool listen(quint16 port, int maxClients = 32);
+    quint16 port() const;
+
+    Statistics statistics() const;
+
+    void run() override;
+
+private:
+    enum Function {
+        FunctionReadCoils = 0x01,
+        FunctionReadDiscreteInputs = 0x02,
+        FunctionReadHoldingRegisters = 0x03,
+        FunctionReadInputRegisters = 0x04,
+        FunctionWriteSingleCoil = 0x05,
+        FunctionWriteSingleRegister = 0x06,
+        FunctionWriteMultipleCoils = 0x0f,
+        FunctionWriteMultipleRegisters = 0x10
+    };
+
+    enum Exception {
+        ExceptionIllegalFunction = 0x01,
+        ExceptionIllegalDataAddress = 0x02,
+        ExceptionIllegalDataValue = 0x03,
+        ExceptionServerDeviceBusy = 0x06,
+        ExceptionGatewayTargetFailed = 0x0b
+    };
+
+    struct Client {
+        QByteArray rx;
+        QByteArray tx;
+    };
+
+    NeuronSharedImage *m_sharedImage;
+    QVector<ModbusMapImage::NodeRange> m_nodeRanges;
+    QVector<QVector<bool> > m_publishedRegisters; // Per unit, the registers published in the image
+    QVector<QHash<quint16, quint32> > m_coils; // Per unit, coil to register << 8 | bit of the MixedBits word of a published register
+    QHash<quint16, quint32> m_unitZeroRegisters; // "Via Unit 0" register to unit << 16 | register
+    QHash<quint16, quint32> m_unitZeroCoils; // "Via Unit 0" coil to unit << 16 | coil
+
+    int m_listenFd = -1;
+    int m_epollFd = -1;
+    quint16 m_port = 0;
+    int m_maxClients = 32;
+    QHash<int, Client> m_clients;
+    QVector<quint16> m_registers; // Unit copy of the image while a request is answered
+    QVector<quint16> m_image; // Copy of all units while a request of unit 0 is answered
+
+    mutable QMutex m_statisticsMutex;
+    Statistics m_statistics;
+
+    const int m_maxWait = 100; // In milliseconds, upper bound to notice interruption requests
+    const int m_maxPduLength = 253;
+    const int m_maxPendingResponses = 16 * 1024; // Bytes queued for a client that does not read
+
+    void acceptClients();
+    bool readClient(int fd, Client *client);
+    bool flushClient(int fd, Client *client);
+    void closeClient(int fd);
+
+    QByteArray processRequest(quint8 unitId, const QByteArray &pdu, bool *exception);
+    // Unit 0 requests are resolved to the units and addresses of the sub-nodes first
+    bool resolveUnitZero(const QHash<quint16, quint32> &addresses, quint16 address, int count, QVector<quint32> *locations, Exception *exception) const;
+    bool isPublished(int unit, int address) const;
+    bool readBit(int unit, const quint16 *registers, quint16 coil) const;
+    QByteArray readBits(int unit, quint16 address, quint16 count, Exception *exception);
+    QByteArray readRegisters(int unit, quint16 address, quint16 count, Exception *exception);
+    bool writeBits(int unit, quint16 address, const QVector<bool> &values, Exception *exception);
+    bool writeRegisters(int unit, quint16 address, const QVector<quint16> &values, Exception *exception);
+};
+
+#endif // NEURONMODBUSTCPSERVER_H
@@ -0,0 +1,766 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronprocessimage.h"
+#include "neuronspi.h"
+#include "neuronextension.h"
+#include "neuronmodbusrtu.h"
+#include "neuroncalibration.h"
+
+#include <QThread>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QVarLengthArray>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+Q_LOGGING_CATEGORY(dcNeuronProcessImage, "NeuronProcessImage")
+
+NeuronProcessImage::NeuronProcessImage(ModbusMap *modbusMap, const QList<NeuronSpi *> &subNodes, QObject *parent) :
+    QObject{parent},
+    m_modbusMap(modbusMap),
+    m_subNodes(subNodes)
+{
+    for (int i = 0; i < subNodes.count(); i++) {
+        resizeImage(i + 1);
+    }
+    m_lastRead.fill(0, subNodes.count());
+
+    m_scanTimer.setInterval(100);
+    connect(&m_scanTimer, &QTimer::timeout, this, &NeuronProcessImage::scan);
+}
+
+NeuronProcessImage::~NeuronProcessImage()
+{
+    // Nothing is committed while the image goes away
+    m_tasksRunning = false;
+    stopTaskThread();
+}
+
+bool NeuronProcessImage::addExtension(int subNode, NeuronExtension *extension)
+{
+    if (subNode <= m_subNodes.count() || subNode > m_modbusMap->numberOfNodes()) {
+        qCWarning(dcNeuronProcessImage()) << "Sub-node" << subNode << "of extension" << extension->model() << "is not an extension of the modbus map";
+        return false;
+    }
+    m_extensions.insert(subNode, extension);
+    resizeImage(subNode);
+    return true;
+}
+
+bool NeuronProcessImage::subscribe(ModbusMap::CircuitHandle circuit, double deadband)
+{
+    return addSubscription(circuit, deadband, true);
+}
+
+bool NeuronProcessImage::watch(ModbusMap::CircuitHandle circuit)
+{
+    return addSubscription(circuit, 0, false);
+}
+
+bool NeuronProcessImage::addSubscription(ModbusMap::CircuitHandle circuit, double deadband, bool publish)
+{
+    if (!m_modbusMap->isValidCircuit(circuit)) {
+        qCWarning(dcNeuronProcessImage()) << "Invalid circuit handle" << circuit;
+        return false;
+    }
+    const ModbusMapImage::Entry &entry = m_modbusMap->circuit(circuit);
+    if (entry.dataType == ModbusMapImage::DataTypeBit) {
+        qCWarning(dcNeuronProcessImage()) << "Circuit" << m_modbusMap->circuitName(circuit) << "has no register";
+        return false;
+    }
+    if (!isExtension(entry.subNode) && (entry.subNode < 1 || entry.subNode > m_subNodes.count())) {
+        qCWarning(dcNeuronProcessImage()) << "Sub-node" << entry.subNode << "does not exist";
+        return false;
+    }
+
+    Subscription subscription;
+    subscription.circuit = circuit;
+    subscription.deadband = qAbs(deadband);
+    subscription.publish = publish;
+    if (m_subscriptionIndex.contains(circuit)) {
+        m_subscriptions[m_subscriptionIndex.value(circuit)] = subscription;
+    } else {
+        m_subscriptionIndex.insert(circuit, m_subscriptions.count());
+        m_subscriptions.append(subscription);
+    }
+    m_readRangesDirty = true;
+    return true;
+}
+
+void NeuronProcessImage::unsubscribe(ModbusMap::CircuitHandle circuit)
+{
+    if (!m_subscriptionIndex.contains(circuit)) {
+        return;
+    }
+    m_subscriptions.remove(m_subscriptionIndex.take(circuit));
+    m_subscriptionIndex.clear();
+    for (int i = 0; i < m_subscriptions.count(); i++) {
+        m_subscriptionIndex.insert(m_subscriptions.at(i).circuit, i);
+    }
+    m_readRangesDirty = true;
+}
+
+int NeuronProcessImage::scanInterval() const
+{
+    return m_scanTimer.interval();
+}
+
+void NeuronProcessImage::setScanInterval(int milliseconds)
+{
+    m_scanTimer.setInterval(milliseconds);
+    if (m_changeDrivenScan) {
+        foreach (NeuronSpi *spi, m_subNodes) {
+            spi->setIdleInterval(milliseconds);
+        }
+    }
+}
+
+void NeuronProcessImage::setChangeDrivenScan(bool enabled, int refreshInterval)
+{
+    m_changeDrivenScan = enabled;
+    m_refreshInterval = refreshInterval;
+    m_lastRead.fill(0);
+    for (int i = 0; i < m_subNodes.count(); i++) {
+        NeuronSpi *spi = m_subNodes.at(i);
+        spi->takeStatus();
+        spi->setIdleInterval(enabled ? m_scanTimer.interval() : 0);
+        setInputInterrupts(i + 1, enabled);
+    }
+}
+
+bool NeuronProcessImage::isChangeDrivenScan() const
+{
+    return m_changeDrivenScan;
+}
+
+void NeuronProcessImage::start()
+{
+    m_scanTimer.start();
+}
+
+void NeuronProcessImage::stop()
+{
+    m_scanTimer.stop();
+}
+
+quint64 NeuronProcessImage::cycles() const
+{
+    return m_cycles;
+}
+
+quint64 NeuronProcessImage::overruns() const
+{
+    return m_overruns;
+}
+
+int NeuronProcessImage::cycleErrors() const
+{
+    return m_cycleErrors;
+}
+
+quint64 NeuronProcessImage::skippedReads() const
+{
+    return m_skippedReads;
+}
+
+qint64 NeuronProcessImage::cycleTimestamp() const
+{
+    return m_cycleTimestamp;
+}
+
+const quint16 *NeuronProcessImage::registers(int subNode, quint16 address) const
+{
+    if (subNode < 1 || subNode > m_image.count() || address >= m_image.at(subNode - 1).count()) {
+        return nullptr;
+    }
+    return m_image.at(subNode - 1).constData() + address;
+}
+
+double NeuronProcessImage::value(ModbusMap::CircuitHandle circuit) const
+{
+    const ModbusMapImage::Entry &entry = m_modbusMap->circuit(circuit);
+    const quint16 *words = registers(entry.subNode, entry.registerAddress);
+    if (!words || entry.registerAddress + entry.count > m_image.at(entry.subNode - 1).count()) {
+        return 0;
+    }
+    return ModbusMapImage::decode(entry, words);
+}
+
+bool NeuronProcessImage::setCalibration(NeuronCalibration *calibration)
+{
+    int subNode = calibration->subNode();
+    if (subNode < 1 || subNode > m_subNodes.count()) {
+        qCWarning(dcNeuronProcessImage()) << "Calibration of sub-node" << subNode << "does not belong to a local sub-node";
+        return false;
+    }
+    foreach (ModbusMap::CircuitHandle circuit, calibration->circuits()) {
+        if (!m_subscriptionIndex.contains(circuit)) {
+            watch(circuit);
+        }
+    }
+    m_calibrations.insert(subNode, calibration);
+    m_analogInputs[subNode].fill(0, calibration->analogInputChannels().count());
+    m_analogOutputs[subNode].fill(0, calibration->analogOutputChannels().count());
+    return true;
+}
+
+const float *NeuronProcessImage::analogInputs(int subNode) const
+{
+    if (!m_calibrations.contains(subNode)) {
+        return nullptr;
+    }
+    return m_analogInputs.value(subNode).constData();
+}
+
+const float *NeuronProcessImage::analogOutputs(int subNode) const
+{
+    if (!m_calibrations.contains(subNode)) {
+        return nullptr;
+    }
+    return m_analogOutputs.value(subNode).constData();
+}
+
+void NeuronProcessImage::updateReadRanges()
+{
+    // Collect the register span of every subscription, then merge neighbours per sub-node
+    QList<QPair<int, int> > spans; // (subNode << 16 | first register, last register)
+    foreach (const Subscription &subscription, m_subscriptions) {
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(subscription.circuit);
+        int first = (entry.subNode << 16) | entry.registerAddress;
+        spans.append(qMakePair(first, first + qMax<int>(entry.count, 1) - 1));
+    }
+    std::sort(spans.begin(), spans.end());
+
+    m_readRanges.clear();
+    for (int i = 0; i < spans.count(); i++) {
+        int subNode = spans.at(i).first >> 16;
+        int first = spans.at(i).first & 0xffff;
+        int last = spans.at(i).second & 0xffff;
+        if (!m_readRanges.isEmpty()) {
+            ReadRange &range = m_readRanges.last();
+            int rangeLast = range.address + range.count - 1;
+            int maxRegisters = isExtension(subNode) ? NeuronModbusRtu::maxReadRegisters : m_maxRegistersPerRead;
+            if (range.subNode == subNode && first <= rangeLast + 1 + m_maxMergeGap && qMax(last, rangeLast) - range.address < maxRegisters) {
+                range.count = qMax(last, rangeLast) - range.address + 1;
+                continue;
+            }
+        }
+        ReadRange range;
+        range.subNode = subNode;
+        range.address = first;
+        range.count = last - first + 1;
+        m_readRanges.append(range);
+    }
+    m_readRangesDirty = false;
+    m_lastRead.fill(0);
+    qCDebug(dcNeuronProcessImage()) << m_subscriptions.count() << "subscriptions read with" << m_readRanges.count() << "register reads per cycle";
+}
+
+void NeuronProcessImage::scan()
+{
+    if (m_pendingReads > 0 || m_tasksRunning) {
+        m_overruns++;
+        return;
+    }
+    // Without subscriptions the cycle still runs the tasks and commits the staged writes
+    if (m_readRangesDirty) {
+        updateReadRanges();
+    }
+
+    // Extension modules are read at the pace of their RS485 line and never delay the local cycle,
+    // an extension still busy with its previous reads is skipped
+    for (int i = 0; i < m_subscriptions.count(); i++) {
+        int subNode = m_modbusMap->circuit(m_subscriptions.at(i).circuit).subNode;
+        if (m_extensionPendingReads.value(subNode) == 0) {
+            m_subscriptions[i].requested = true;
+        }
+    }
+
+    // The status is taken before the reads, flags raised while reading trigger the next cycle
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<bool> quiet(m_subNodes.count() + 1, false);
+    for (int subNode = 1; subNode <= m_subNodes.count(); subNode++) {
+        quiet[subNode] = isQuiet(subNode, now);
+    }
+
+    QList<ReadRange> extensionRanges;
+    m_pendingReads = 0;
+    m_errors = 0;
+    foreach (const ReadRange &range, m_readRanges) {
+        if (!isExtension(range.subNode)) {
+            if (quiet.at(range.subNode)) {
+                m_skippedReads++;
+            } else {
+                m_pendingReads++;
+            }
+        } else if (m_extensionPendingReads.value(range.subNode) == 0) {
+            extensionRanges.append(range);
+        }
+    }
+    foreach (const ReadRange &range, extensionRanges) {
+        m_extensionPendingReads[range.subNode]++;
+    }
+
+    foreach (const ReadRange &range, m_readRanges) {
+        SpiReply *reply;
+        if (!isExtension(range.subNode)) {
+            if (quiet.at(range.subNode)) {
+                continue;
+            }
+            m_lastRead[range.subNode - 1] = now;
+            reply = m_subNodes.at(range.subNode - 1)->readRegisters(range.address, range.count);
+        } else if (extensionRanges.contains(range)) {
+            reply = m_extensions.value(range.subNode)->readRegisters(range.address, range.count);
+        } else {
+            continue;
+        }
+        connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+        connect(reply, &SpiReply::finished, this, [this, reply, range] {
+            readFinished(reply, range);
+        });
+    }
+
+    if (m_pendingReads == 0) {
+        finishCycle();
+    }
+}
+
+void NeuronProcessImage::readFinished(SpiReply *reply, const ReadRange &range)
+{
+    bool extension = isExtension(range.subNode);
+    if (reply->error() != SpiError::NoError) {
+        qCDebug(dcNeuronProcessImage()) << "Could not read registers" << range.address << "of sub-node" << range.subNode << reply->errorString();
+        if (!extension) {
+            m_errors++;
+            m_lastRead[range.subNode - 1] = 0;
+        }
+    } else if (extension && m_tasksRunning) {
+        // The tasks read the image on their thread, applied with the commit of the cycle
+        ExtensionResult result;
+        result.range = range;
+        result.values = reply->result();
+        m_extensionResults.append(result);
+    } else {
+        storeResult(range, reply->result());
+    }
+
+    if (extension) {
+        // Published with the next local cycle
+        m_extensionPendingReads[range.subNode]--;
+        return;
+    }
+    m_pendingReads--;
+    if (m_pendingReads == 0) {
+        finishCycle();
+    }
+}
+
+void NeuronProcessImage::storeResult(const ReadRange &range, const QVector<quint16> &result)
+{
+    QVector<quint16> &image = m_image[range.subNode - 1];
+    int count = qMin(result.count(), image.count() - range.address);
+    std::copy(result.constBegin(), result.constBegin() + qMax(count, 0), image.begin() + range.address);
+    markScanned(range);
+}
+
+bool NeuronProcessImage::isQuiet(int subNode, qint64 now)
+{
+    if (!m_changeDrivenScan) {
+        return false;
+    }
+    quint8 status = m_subNodes.at(subNode - 1)->takeStatus();
+    qint64 lastRead = m_lastRead.at(subNode - 1);
+    return status == 0 && lastRead > 0 && now - lastRead < m_refreshInterval;
+}
+
+void NeuronProcessImage::markScanned(const ReadRange &range)
+{
+    for (int i = 0; i < m_subscriptions.count(); i++) {
+        Subscription &subscription = m_subscriptions[i];
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(subscription.circuit);
+        if (subscription.requested && entry.subNode == range.subNode && entry.registerAddress >= range.address
+                && entry.registerAddress + qMax<int>(entry.count, 1) <= range.address + range.count) {
+            subscription.scanned = true;
+        }
+    }
+}
+
+bool NeuronProcessImage::isExtension(int subNode) const
+{
+    return m_extensions.contains(subNode);
+}
+
+void NeuronProcessImage::setInputInterrupts(int subNode, bool enabled)
+{
+    NeuronSpi *spi = m_subNodes.at(subNode - 1);
+    quint16 maskRegister = spi->boardVersion().IntMaskRegister;
+    if (maskRegister == 0) {
+        return;
+    }
+    if (!enabled) {
+        if (m_savedInterruptMasks.contains(subNode)) {
+            SpiReply *reply = spi->writeRegister(maskRegister, m_savedInterruptMasks.take(subNode));
+            connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+        }
+        return;
+    }
+    if (m_savedInterruptMasks.contains(subNode)) {
+        return;
+    }
+    // The current mask is kept, e.g. the UART events of a Modbus RTU master
+    SpiReply *reply = spi->readRegisters(maskRegister, 1);
+    connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+    connect(reply, &SpiReply::finished, this, [this, reply, spi, subNode, maskRegister] {
+        if (reply->error() != SpiError::NoError || reply->result().isEmpty()) {
+            qCWarning(dcNeuronProcessImage()) << "Could not read the interrupt mask of sub-node" << subNode << reply->errorString();
+            return;
+        }
+        // Disabled again before the mask was read
+        if (!m_changeDrivenScan || m_savedInterruptMasks.contains(subNode)) {
+            return;
+        }
+        quint16 mask = reply->result().first();
+        m_savedInterruptMasks.insert(subNode, mask);
+        SpiReply *writeReply = spi->writeRegister(maskRegister, mask | INT_DI_CHANGED);
+        connect(writeReply, &SpiReply::finished, writeReply, &SpiReply::deleteLater);
+        connect(writeReply, &SpiReply::finished, this, [writeReply, subNode] {
+            if (writeReply->error() != SpiError::NoError) {
+                qCWarning(dcNeuronProcessImage()) << "Could not enable the input interrupts of sub-node" << subNode << writeReply->errorString();
+            }
+        });
+    });
+}
+
+void NeuronProcessImage::resizeImage(int subNode)
+{
+    if (m_image.count() < subNode) {
+        m_image.resize(subNode);
+        m_previousImage.resize(subNode);
+    }
+    int size = m_modbusMap->nodeRange(subNode).lastRegister + 2;
+    m_image[subNode - 1].fill(0, size);
+    m_previousImage[subNode - 1].fill(0, size);
+}
+
+void NeuronProcessImage::finishCycle()
+{
+    m_cycles++;
+    m_cycleErrors = m_errors;
+    m_cycleTimestamp = QDateTime::currentMSecsSinceEpoch();
+    convertAnalogValues();
+
+    QList<Change> changes;
+    for (int i = 0; i < m_subscriptions.count(); i++) {
+        Subscription &subscription = m_subscriptions[i];
+        if (!subscription.scanned || !subscription.publish) {
+            continue;
+        }
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(subscription.circuit);
+        // Unchanged words cannot move a value out of its deadband since it was last checked
+        if (subscription.published && !wordsChanged(entry)) {
+            continue;
+        }
+
+        double current = ModbusMapImage::decode(entry, m_image.at(entry.subNode - 1).constData() + entry.registerAddress);
+        bool digital = entry.dataType == ModbusMapImage::DataTypeMixedBits;
+        if (subscription.published) {
+            if (digital ? current == subscription.publishedValue : qAbs(current - subscription.publishedValue) <= subscription.deadband) {
+                continue;
+            }
+        }
+
+        Change change;
+        change.circuit = subscription.circuit;
+        change.value = current;
+        change.previousValue = subscription.publishedValue;
+        changes.append(change);
+        subscription.publishedValue = current;
+        subscription.published = true;
+    }
+
+    for (int i = 0; i < m_image.count(); i++) {
+        m_previousImage[i] = m_image.at(i);
+    }
+    m_cycleChanges = changes;
+
+    bool hasTasks;
+    {
+        QMutexLocker locker(&m_taskMutex);
+        hasTasks = !m_tasks.isEmpty();
+    }
+    if (!hasTasks) {
+        commitCycle();
+    } else if (m_taskThread) {
+        // The next scan waits until the tasks are done, the image does not change under them
+        m_tasksRunning = true;
+        QMetaObject::invokeMethod(m_taskContext, [this] {
+            runTasks();
+            QMetaObject::invokeMethod(this, [this] {
+                // Already committed if the task thread was stopped meanwhile
+                if (!m_tasksRunning) {
+                    return;
+                }
+                m_tasksRunning = false;
+                commitCycle();
+            }, Qt::QueuedConnection);
+        }, Qt::QueuedConnection);
+    } else {
+        runTasks();
+        commitCycle();
+    }
+}
+
+int NeuronProcessImage::addTask(const QString &name, const Task &task, int budget)
+{
+    TaskEntry entry;
+    entry.task = task;
+    entry.statistics.name = name;
+    entry.statistics.budget = budget;
+
+    QMutexLocker locker(&m_taskMutex);
+    entry.id = m_nextTaskId++;
+    m_tasks.append(entry);
+    return entry.id;
+}
+
+void NeuronProcessImage::removeTask(int id)
+{
+    QMutexLocker locker(&m_taskMutex);
+    for (int i = 0; i < m_tasks.count(); i++) {
+        if (m_tasks.at(i).id == id) {
+            m_tasks.removeAt(i);
+            return;
+        }
+    }
+}
+
+QList<NeuronProcessImage::TaskStatistics> NeuronProcessImage::taskStatistics() const
+{
+    QList<TaskStatistics> statistics;
+    QMutexLocker locker(&m_taskMutex);
+    foreach (const TaskEntry &entry, m_tasks) {
+        statistics.append(entry.statistics);
+    }
+    return statistics;
+}
+
+bool NeuronProcessImage::setTaskCore(int core)
+{
+    stopTaskThread();
+    if (core < 0) {
+        return true;
+    }
+    if (core >= QThread::idealThreadCount()) {
+        qCWarning(dcNeuronProcessImage()) << "CPU core" << core << "does not exist";
+        return false;
+    }
+
+    m_taskThread = new QThread(this);
+    m_taskContext = new QObject();
+    m_taskContext->moveToThread(m_taskThread);
+    m_taskThread->start();
+
+    int error = 0;
+    QMetaObject::invokeMethod(m_taskContext, [core, &error] {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }, Qt::BlockingQueuedConnection);
+    if (error != 0) {
+        qCWarning(dcNeuronProcessImage()) << "Could not pin the task thread to CPU core" << core << strerror(error);
+        stopTaskThread();
+        return false;
+    }
+    qCDebug(dcNeuronProcessImage()) << "Running the tasks on CPU core" << core;
+    return true;
+}
+
+void NeuronProcessImage::stopTaskThread()
+{
+    if (!m_taskThread) {
+        return;
+    }
+    m_taskThread->quit();
+    m_taskThread->wait();
+    delete m_taskContext;
+    delete m_taskThread;
+    m_taskContext = nullptr;
+    m_taskThread = nullptr;
+    if (m_tasksRunning) {
+        // The tasks of this cycle ran or were dropped with the thread, the cycle is committed anyway
+        m_tasksRunning = false;
+        commitCycle();
+    }
+}
+
+void NeuronProcessImage::writeRegister(int subNode, quint16 address, quint16 value)
+{
+    if (subNode < 1 || subNode > m_subNodes.count()) {
+        qCWarning(dcNeuronProcessImage()) << "Cannot write register" << address << "of sub-node" << subNode;
+        return;
+    }
+    Write write = {subNode, address, value, false};
+    QMutexLocker locker(&m_taskMutex);
+    m_writes.append(write);
+}
+
+void NeuronProcessImage::writeBit(int subNode, quint16 coil, bool value)
+{
+    if (subNode < 1 || subNode > m_subNodes.count()) {
+        qCWarning(dcNeuronProcessImage()) << "Cannot write coil" << coil << "of sub-node" << subNode;
+        return;
+    }
+    Write write = {subNode, coil, static_cast<quint16>(value ? 1 : 0), true};
+    QMutexLocker locker(&m_taskMutex);
+    m_writes.append(write);
+}
+
+void NeuronProcessImage::writeAnalogOutputs(int subNode, int firstChannel, int count, const float *values)
+{
+    NeuronCalibration *calibration = m_calibrations.value(subNode);
+    if (!calibration) {
+        qCWarning(dcNeuronProcessImage()) << "Sub-node" << subNode << "has no calibration for its analog outputs";
+        return;
+    }
+    // Every group holding some of the channels is encoded in one go
+    foreach (NeuronCalibration::Group group, calibration->analogOutputGroups()) {
+        int first = qMax(firstChannel, group.firstChannel);
+        int last = qMin(firstChannel + count, group.firstChannel + group.count);
+        if (first >= last) {
+            continue;
+        }
+        int wordsPerChannel = NeuronCalibration::wordCount(group) / group.count;
+        group.address += (first - group.firstChannel) * wordsPerChannel;
+        group.count = last - first;
+        group.firstChannel = first;
+        QVarLengthArray<quint16, 16> words(NeuronCalibration::wordCount(group));
+        calibration->analogOutputRegisters(group, values + first - firstChannel, words.data());
+        for (int i = 0; i < words.count(); i++) {
+            writeRegister(subNode, group.address + i, words.at(i));
+        }
+    }
+}
+
+void NeuronProcessImage::runTasks()
+{
+    QList<TaskEntry> tasks;
+    {
+        QMutexLocker locker(&m_taskMutex);
+        tasks = m_tasks;
+    }
+
+    QElapsedTimer timer;
+    foreach (const TaskEntry &task, tasks) {
+        timer.start();
+        task.task(this);
+        qint64 duration = timer.nsecsElapsed() / 1000;
+
+        // The task may have been removed while it was running
+        QMutexLocker locker(&m_taskMutex);
+        for (int i = 0; i < m_tasks.count(); i++) {
+            if (m_tasks.at(i).id != task.id) {
+                continue;
+            }
+            TaskStatistics &statistics = m_tasks[i].statistics;
+            statistics.runs++;
+            statistics.lastDuration = duration;
+            statistics.maxDuration = qMax(statistics.maxDuration, duration);
+            statistics.overrun = statistics.budget > 0 && duration > statistics.budget;
+            if (statistics.overrun) {
+                statistics.overruns++;
+                m_taskOverruns.append(statistics);
+            }
+            break;
+        }
+    }
+}
+
+void NeuronProcessImage::commitCycle()
+{
+    foreach (const ExtensionResult &result, m_extensionResults) {
+        storeResult(result.range, result.values);
+    }
+    m_extensionResults.clear();
+
+    QVector<Write> writes;
+    QList<TaskStatistics> overruns;
+    {
+        QMutexLocker locker(&m_taskMutex);
+        writes = m_writes;
+        m_writes.clear();
+        overruns = m_taskOverruns;
+        m_taskOverruns.clear();
+    }
+
+    // Queued back to back, the SPI worker merges neighbouring writes into one transfer
+    foreach (const Write &write, writes) {
+        NeuronSpi *spi = m_subNodes.at(write.subNode - 1);
+        SpiReply *reply = write.bit ? spi->writeBit(write.address, write.value) : spi->writeRegister(write.address, write.value);
+        connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+        connect(reply, &SpiReply::finished, this, [reply, write] {
+            if (reply->error() != SpiError::NoError) {
+                qCWarning(dcNeuronProcessImage()) << "Could not write" << (write.bit ? "coil" : "register") << write.address << "of sub-node" << write.subNode << reply->errorString();
+            }
+        });
+    }
+
+    foreach (const TaskStatistics &statistics, overruns) {
+        qCDebug(dcNeuronProcessImage()) << "Task" << statistics.name << "took" << statistics.lastDuration << "us, budget" << statistics.budget << "us";
+        emit taskOverrun(statistics.name, statistics.lastDuration);
+    }
+
+    QList<Change> changes = m_cycleChanges;
+    m_cycleChanges.clear();
+    if (!changes.isEmpty()) {
+        emit changed(changes);
+    }
+    emit cycleFinished(m_cycles);
+}
+
+void NeuronProcessImage::convertAnalogValues()
+{
+    foreach (int subNode, m_calibrations.keys()) {
+        NeuronCalibration *calibration = m_calibrations.value(subNode);
+        const quint16 *image = m_image.at(subNode - 1).constData();
+        calibration->analogInputValues(image, m_analogInputs[subNode].data());
+        calibration->analogOutputValues(image, m_analogOutputs[subNode].data());
+    }
+}
+
+bool NeuronProcessImage::wordsChanged(const ModbusMapImage::Entry &entry) const
+{
+    const QVector<quint16> &image = m_image.at(entry.subNode - 1);
+    const QVector<quint16> &previous = m_previousImage.at(entry.subNode - 1);
+    for (int i = entry.registerAddress; i < entry.registerAddress + qMax<int>(entry.count, 1); i++) {
+        if (image.at(i) != previous.at(i)) {
+            return true;
+        }
+    }
+    return false;
+}
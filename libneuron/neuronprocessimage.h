@@ -0,0 +1,249 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONPROCESSIMAGE_H
+#define NEURONPROCESSIMAGE_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+
+#include <functional>
+
+#include "modbusmap.h"
+
+class NeuronSpi;
+class NeuronExtension;
+class NeuronCalibration;
+class SpiReply;
+class QThread;
+
+// Cyclic image of the registers of all sub-nodes.
+//
+// Every scan cycle reads the registers of the subscribed circuits with as few
+// merged register reads as possible, decodes them by their data type and
+// publishes the circuits that changed in one change list per cycle. Analog
+// circuits change once they leave their deadband around the last published
+// value, digital circuits on every change of state.
+//
+// Extension modules added to the modbus map are further units of the image.
+// Their reads run besides the cycle of the local sub-nodes and are published
+// with the first local cycle after they completed.
+//
+// Registered tasks run once per cycle right after the inputs were read. Their
+// output writes are committed together when all tasks are done, before the
+// changes of the cycle are published.
+//
+// The analog channels of sub-nodes with a calibration are converted to their
+// engineering values every cycle, group by group, before the tasks run.
+class NeuronProcessImage : public QObject
+{
+    Q_OBJECT
+public:
+    struct Change {
+        ModbusMap::CircuitHandle circuit = ModbusMap::InvalidCircuitHandle;
+        double value = 0;
+        double previousValue = 0;
+    };
+
+    struct TaskStatistics {
+        QString name;
+        int budget = 0; // In microseconds, 0 for none
+        qint64 lastDuration = 0; // In microseconds
+        qint64 maxDuration = 0; // In microseconds
+        quint64 runs = 0;
+        quint64 overruns = 0; // Runs that took longer than the budget
+        bool overrun = false; // The last run took longer than the budget
+    };
+
+    // Reads the image and stages outputs with writeRegister() and writeBit()
+    typedef std::function<void(NeuronProcessImage *image)> Task;
+
+    explicit NeuronProcessImage(ModbusMap *modbusMap, const QList<NeuronSpi *> &subNodes, QObject *parent = nullptr);
+    ~NeuronProcessImage() override;
+
+    // The sub-node returned by ModbusMap::addExtension()
+    bool addExtension(int subNode, NeuronExtension *extension);
+
+    // The first cycle after subscribing always reports the current value
+    bool subscribe(ModbusMap::CircuitHandle circuit, double deadband = 0);
+    void unsubscribe(ModbusMap::CircuitHandle circuit);
+    // Reads the circuit every cycle without publishing its changes, e.g. to evaluate it in cycleFinished()
+    bool watch(ModbusMap::CircuitHandle circuit);
+
+    int scanInterval() const;
+    void setScanInterval(int milliseconds);
+
+    // Reads a local sub-node only if its board reported status flags since the last cycle, the
+    // sub-nodes are polled with idle frames at the scan interval meanwhile. Registers changing
+    // without a flag, like analog inputs or outputs written by others, are read at least every
+    // refresh interval. The boards report changed inputs while enabled, their interrupt mask is
+    // restored when it is disabled again.
+    void setChangeDrivenScan(bool enabled, int refreshInterval = 1000);
+    bool isChangeDrivenScan() const;
+    void start();
+    void stop();
+
+    quint64 cycles() const;
+    // Cycles skipped because the previous one was still being read
+    quint64 overruns() const;
+    // Register reads of the local sub-nodes in the last cycle which failed, their registers keep the previous values
+    int cycleErrors() const;
+    // Sub-node reads left out because the board reported no change
+    quint64 skippedReads() const;
+    qint64 cycleTimestamp() const; // In milliseconds since epoch, when the last cycle completed
+
+    // Raw register words of a sub-node, as read by the last cycle
+    const quint16 *registers(int subNode, quint16 address) const;
+    double value(ModbusMap::CircuitHandle circuit) const;
+
+    // Reads the analog channels of the calibrated local sub-node every cycle
+    bool setCalibration(NeuronCalibration *calibration);
+    // Engineering values of the last cycle in the channel order of the calibration, nullptr without calibration
+    const float *analogInputs(int subNode) const;
+    const float *analogOutputs(int subNode) const;
+
+    // Tasks run in the order they were added, returns the id of the task
+    int addTask(const QString &name, const Task &task, int budget = 0);
+    void removeTask(int id);
+    QList<TaskStatistics> taskStatistics() const;
+    // Runs the tasks on a thread pinned to the CPU core, -1 runs them in the thread of this object
+    bool setTaskCore(int core);
+
+    // Output writes of local sub-nodes, sent with the commit of the current or next cycle.
+    // Writes of one cycle are merged into as few transfers as possible, see Spi.
+    void writeRegister(int subNode, quint16 address, quint16 value);
+    void writeBit(int subNode, quint16 coil, bool value);
+    // Encodes count analog outputs starting at firstChannel with the calibration of the sub-node
+    void writeAnalogOutputs(int subNode, int firstChannel, int count, const float *values);
+
+private:
+    struct Subscription {
+        ModbusMap::CircuitHandle circuit;
+        double deadband = 0;
+        double publishedValue = 0;
+        bool published = false;
+        bool requested = false; // A read of the registers is running
+        bool scanned = false; // The registers were read at least once
+        bool publish = true;
+    };
+
+    struct TaskEntry {
+        int id;
+        Task task;
+        TaskStatistics statistics;
+    };
+
+    struct Write {
+        int subNode;
+        quint16 address;
+        quint16 value;
+        bool bit;
+    };
+
+    struct ReadRange {
+        int subNode;
+        quint16 address;
+        quint8 count;
+        bool operator==(const ReadRange &other) const {
+            return subNode == other.subNode && address == other.address && count == other.count;
+        }
+    };
+
+    struct ExtensionResult {
+        ReadRange range;
+        QVector<quint16> values;
+    };
+
+    ModbusMap *m_modbusMap;
+    QList<NeuronSpi *> m_subNodes;
+    QHash<int, NeuronExtension *> m_extensions;
+    QHash<int, int> m_extensionPendingReads;
+    QList<ExtensionResult> m_extensionResults; // Completed while the tasks were running
+    QHash<int, NeuronCalibration *> m_calibrations;
+    QHash<int, QVector<float> > m_analogInputs;
+    QHash<int, QVector<float> > m_analogOutputs;
+    QTimer m_scanTimer;
+    bool m_changeDrivenScan = false;
+    int m_refreshInterval = 1000; // In milliseconds
+    QVector<qint64> m_lastRead; // Per local sub-node in milliseconds since epoch, 0 reads it in the next cycle
+    quint64 m_skippedReads = 0;
+    QHash<int, quint16> m_savedInterruptMasks; // Per local sub-node, while change driven scan is enabled
+
+    // Guards the tasks, their statistics and the staged writes, tasks may run on m_taskThread
+    mutable QMutex m_taskMutex;
+    QList<TaskEntry> m_tasks;
+    int m_nextTaskId = 1;
+    QVector<Write> m_writes;
+    QList<TaskStatistics> m_taskOverruns;
+    QThread *m_taskThread = nullptr;
+    QObject *m_taskContext = nullptr;
+    bool m_tasksRunning = false;
+    QList<NeuronProcessImage::Change> m_cycleChanges;
+    const int m_maxRegistersPerRead = 126;
+    const int m_maxMergeGap = 8; // Unused registers read to merge two ranges into one transfer
+
+    QVector<Subscription> m_subscriptions;
+    QHash<ModbusMap::CircuitHandle, int> m_subscriptionIndex;
+    QList<ReadRange> m_readRanges;
+    bool m_readRangesDirty = false;
+
+    // One image per sub-node, indexed by register address, and the image of the previous cycle
+    QVector<QVector<quint16> > m_image;
+    QVector<QVector<quint16> > m_previousImage;
+
+    int m_pendingReads = 0;
+    int m_cycleErrors = 0;
+    int m_errors = 0;
+    quint64 m_cycles = 0;
+    quint64 m_overruns = 0;
+    qint64 m_cycleTimestamp = 0;
+
+    bool addSubscription(ModbusMap::CircuitHandle circuit, double deadband, bool publish);
+    void updateReadRanges();
+    void scan();
+    bool isQuiet(int subNode, qint64 now);
+    void readFinished(SpiReply *reply, const ReadRange &range);
+    // Subscriptions within the range, once its read succeeded
+    void markScanned(const ReadRange &range);
+    bool isExtension(int subNode) const;
+    void setInputInterrupts(int subNode, bool enabled);
+    void storeResult(const ReadRange &range, const QVector<quint16> &result);
+    void resizeImage(int subNode);
+    void finishCycle();
+    void convertAnalogValues();
+    void runTasks();
+    // Sends the staged writes and publishes the cycle
+    void commitCycle();
+    void stopTaskThread();
+    bool wordsChanged(const ModbusMapImage::Entry &entry) const;
+
+signals:
+    // Emitted once per cycle if any subscribed circuit changed, in the thread of this object
+    void changed(const QList<NeuronProcessImage::Change> &changes);
+    void cycleFinished(quint64 cycle);
+    void taskOverrun(const QString &name, qint64 duration);
+};
+
+#endif // NEURONPROCESSIMAGE_H
@@ -0,0 +1,414 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronsharedimage.h"
+
+#include <QLoggingCategory>
+
+#include <atomic>
+#include <new>
+#include <climits>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+}
+
+Q_LOGGING_CATEGORY(dcNeuronSharedImage, "NeuronSharedImage")
+
+const char *NeuronSharedImage::defaultName = "/neurond";
+
+NeuronSharedImage::NeuronSharedImage()
+{
+
+}
+
+NeuronSharedImage::~NeuronSharedImage()
+{
+    detach();
+}
+
+bool NeuronSharedImage::create(const QString &name, const QString &model, int unitCount, int registersPerUnit, int commandCapacity)
+{
+    detach();
+
+    quint32 capacity = 1;
+    while (capacity < (quint32)qMax(commandCapacity, 1)) {
+        capacity <<= 1;
+    }
+    qint64 size = sizeOf(unitCount, registersPerUnit, capacity);
+
+    // The owner holds an exclusive lock on the pid file, the lock is released by the kernel when
+    // the daemon dies. An object without a locked pid file was left behind and is replaced.
+    QByteArray pidFile = pidFileName(name);
+    int pidFd = open(pidFile.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (pidFd < 0) {
+        qCWarning(dcNeuronSharedImage()) << "Could not open pid file" << pidFile << strerror(errno);
+        return false;
+    }
+    if (flock(pidFd, LOCK_EX | LOCK_NB) < 0) {
+        qCWarning(dcNeuronSharedImage()) << "Shared memory" << name << "is owned by a running daemon, see" << pidFile;
+        close(pidFd);
+        return false;
+    }
+    QByteArray pid = QByteArray::number(getpid()) + '\n';
+    if (ftruncate(pidFd, 0) < 0 || write(pidFd, pid.constData(), pid.size()) != pid.size()) {
+        qCWarning(dcNeuronSharedImage()) << "Could not write pid file" << pidFile << strerror(errno);
+    }
+
+    shm_unlink(name.toLocal8Bit().constData());
+    int fd = shm_open(name.toLocal8Bit().constData(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+        qCWarning(dcNeuronSharedImage()) << "Could not create shared memory" << name << strerror(errno);
+        unlink(pidFile.constData());
+        close(pidFd);
+        return false;
+    }
+    if (ftruncate(fd, size) < 0 || !map(fd, size)) {
+        qCWarning(dcNeuronSharedImage()) << "Could not map shared memory" << name << strerror(errno);
+        close(fd);
+        shm_unlink(name.toLocal8Bit().constData());
+        unlink(pidFile.constData());
+        close(pidFd);
+        return false;
+    }
+    close(fd);
+    m_name = name;
+    m_owner = true;
+    m_pidFile = pidFd;
+
+    // The memory is zeroed by ftruncate, the magic is written last so clients never see a partial header
+    m_header = new (m_data) Header();
+    m_header->version = currentVersion;
+    m_header->unitCount = unitCount;
+    m_header->registersPerUnit = registersPerUnit;
+    m_header->commandCapacity = capacity;
+    strncpy(m_header->model, model.toLatin1().constData(), sizeof(m_header->model) - 1);
+    setPointers();
+    for (quint32 i = 0; i < capacity; i++) {
+        new (&m_slots[i]) Slot();
+        m_slots[i].sequence.storeRelaxed(i);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = magic;
+    return true;
+}
+
+void NeuronSharedImage::beginPublish()
+{
+    m_header->sequence.fetchAndAddRelaxed(1);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void NeuronSharedImage::publishUnit(int unit, const quint16 *registers, int count)
+{
+    if (unit < 1 || unit > (int)m_header->unitCount) {
+        return;
+    }
+    memcpy(m_registers + (unit - 1) * m_header->registersPerUnit, registers, qMin<int>(count, m_header->registersPerUnit) * sizeof(quint16));
+}
+
+void NeuronSharedImage::endPublish(quint64 cycle, qint64 timestamp)
+{
+    m_header->cycle = cycle;
+    m_header->timestamp = timestamp;
+    m_header->sequence.fetchAndAddRelease(1);
+    m_header->cycleFutex.storeRelease(cycle);
+    futexWake(&m_header->cycleFutex, INT_MAX);
+}
+
+int NeuronSharedImage::takeCommands(Command *commands, int maxCount)
+{
+    quint32 mask = m_header->commandCapacity - 1;
+    quint32 tail = m_header->commandTail.loadRelaxed();
+    int count = 0;
+    while (count < maxCount) {
+        Slot &slot = m_slots[tail & mask];
+        if (slot.sequence.loadAcquire() != tail + 1) {
+            break;
+        }
+        commands[count++] = slot.command;
+        // Free the slot for the producer one lap ahead
+        slot.sequence.storeRelease(tail + mask + 1);
+        tail++;
+    }
+    m_header->commandTail.storeRelease(tail);
+    return count;
+}
+
+bool NeuronSharedImage::waitForCommands(int timeout)
+{
+    quint32 observed = m_header->commandFutex.loadAcquire();
+    quint32 tail = m_header->commandTail.loadRelaxed();
+    if (m_slots[tail & (m_header->commandCapacity - 1)].sequence.loadAcquire() == tail + 1) {
+        return true;
+    }
+    return futexWait(&m_header->commandFutex, observed, timeout);
+}
+
+bool NeuronSharedImage::attach(const QString &name)
+{
+    detach();
+    int fd = shm_open(name.toLocal8Bit().constData(), O_RDWR, 0);
+    if (fd < 0) {
+        qCWarning(dcNeuronSharedImage()) << "Could not open shared memory" << name << strerror(errno);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) < 0 || status.st_size < (qint64)sizeof(Header) || !map(fd, status.st_size)) {
+        qCWarning(dcNeuronSharedImage()) << "Could not map shared memory" << name;
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    m_header = reinterpret_cast<Header *>(m_data);
+    if (m_header->magic != magic || m_header->version != currentVersion ||
+            sizeOf(m_header->unitCount, m_header->registersPerUnit, m_header->commandCapacity) > m_size) {
+        qCWarning(dcNeuronSharedImage()) << "Shared memory" << name << "is not a Neuron image of version" << currentVersion;
+        detach();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_name = name;
+    setPointers();
+    return true;
+}
+
+void NeuronSharedImage::detach()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+    if (m_owner) {
+        shm_unlink(m_name.toLocal8Bit().constData());
+        unlink(pidFileName(m_name).constData());
+        close(m_pidFile);
+    }
+    m_owner = false;
+    m_pidFile = -1;
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+    m_registers = nullptr;
+    m_slots = nullptr;
+}
+
+bool NeuronSharedImage::isValid() const
+{
+    return m_header != nullptr;
+}
+
+QString NeuronSharedImage::model() const
+{
+    return m_header ? QString::fromLatin1(m_header->model) : QString();
+}
+
+int NeuronSharedImage::unitCount() const
+{
+    return m_header ? m_header->unitCount : 0;
+}
+
+int NeuronSharedImage::registersPerUnit() const
+{
+    return m_header ? m_header->registersPerUnit : 0;
+}
+
+bool NeuronSharedImage::isOwnerAlive() const
+{
+    int fd = open(pidFileName(m_name).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    // A shared lock is only refused while the owner holds its exclusive one
+    bool locked = flock(fd, LOCK_SH | LOCK_NB) < 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return locked;
+}
+
+bool NeuronSharedImage::snapshot(quint16 *registers, int count, quint64 *cycle, qint64 *timestamp) const
+{
+    count = qMin<int>(count, m_header->unitCount * m_header->registersPerUnit);
+    quint32 sequence;
+    while (waitForSequence(&sequence)) {
+        memcpy(registers, m_registers, count * sizeof(quint16));
+        quint64 cycleNumber = m_header->cycle;
+        qint64 cycleTimestamp = m_header->timestamp;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->sequence.loadRelaxed() == sequence) {
+            if (cycle) {
+                *cycle = cycleNumber;
+            }
+            if (timestamp) {
+                *timestamp = cycleTimestamp;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NeuronSharedImage::readRegisters(int unit, int address, int count, quint16 *registers) const
+{
+    if (unit < 1 || unit > (int)m_header->unitCount || address < 0 || count < 0 || address + count > (int)m_header->registersPerUnit) {
+        return false;
+    }
+    const quint16 *source = m_registers + (unit - 1) * m_header->registersPerUnit + address;
+    quint32 sequence;
+    while (waitForSequence(&sequence)) {
+        memcpy(registers, source, count * sizeof(quint16));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->sequence.loadRelaxed() == sequence) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NeuronSharedImage::waitForSequence(quint32 *sequence) const
+{
+    // Publishing takes microseconds, readers spin first and yield the CPU afterwards. A sequence
+    // that stays odd is only checked against the owner now and then, that costs system calls.
+    for (int attempt = 1; ; attempt++) {
+        *sequence = m_header->sequence.loadAcquire();
+        if (!(*sequence & 1)) {
+            return true;
+        }
+        if (attempt < m_spinLimit) {
+            continue;
+        }
+        sched_yield();
+        if (attempt % m_ownerCheckInterval == 0 && !isOwnerAlive()) {
+            qCWarning(dcNeuronSharedImage()) << "The daemon owning" << m_name << "died while publishing";
+            return false;
+        }
+    }
+}
+
+bool NeuronSharedImage::postCommand(const Command &command)
+{
+    quint32 mask = m_header->commandCapacity - 1;
+    quint32 head = m_header->commandHead.loadRelaxed();
+    forever {
+        Slot &slot = m_slots[head & mask];
+        qint32 difference = slot.sequence.loadAcquire() - head;
+        if (difference == 0) {
+            // The slot is free, claim it before any other client does
+            if (m_header->commandHead.testAndSetRelaxed(head, head + 1, head)) {
+                slot.command = command;
+                slot.sequence.storeRelease(head + 1);
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            head = m_header->commandHead.loadRelaxed();
+        }
+    }
+    m_header->commandFutex.fetchAndAddRelease(1);
+    futexWake(&m_header->commandFutex, 1);
+    return true;
+}
+
+bool NeuronSharedImage::postWriteRegister(int unit, quint16 address, quint16 value)
+{
+    Command command;
+    command.unit = unit;
+    command.type = CommandWriteRegister;
+    command.address = address;
+    command.value = value;
+    return postCommand(command);
+}
+
+bool NeuronSharedImage::postWriteBit(int unit, quint16 address, bool value)
+{
+    Command command;
+    command.unit = unit;
+    command.type = CommandWriteBit;
+    command.address = address;
+    command.value = value;
+    return postCommand(command);
+}
+
+bool NeuronSharedImage::waitForCycle(quint64 cycle, int timeout) const
+{
+    quint32 observed = m_header->cycleFutex.loadAcquire();
+    if (observed != (quint32)cycle) {
+        return true;
+    }
+    return futexWait(&m_header->cycleFutex, observed, timeout);
+}
+
+QByteArray NeuronSharedImage::pidFileName(const QString &name)
+{
+    // Next to the shared memory objects, which live in /dev/shm on Linux
+    return QString("/dev/shm" + name + ".pid").toLocal8Bit();
+}
+
+qint64 NeuronSharedImage::sizeOf(int unitCount, int registersPerUnit, int commandCapacity)
+{
+    qint64 registers = (qint64)unitCount * registersPerUnit * sizeof(quint16);
+    // Slots start on an 8 byte boundary
+    registers = (registers + 7) & ~7;
+    return sizeof(Header) + registers + (qint64)commandCapacity * sizeof(Slot);
+}
+
+bool NeuronSharedImage::map(int fd, qint64 size)
+{
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    m_data = static_cast<uchar *>(data);
+    m_size = size;
+    return true;
+}
+
+void NeuronSharedImage::setPointers()
+{
+    m_registers = reinterpret_cast<quint16 *>(m_data + sizeof(Header));
+    qint64 registers = ((qint64)m_header->unitCount * m_header->registersPerUnit * sizeof(quint16) + 7) & ~7;
+    m_slots = reinterpret_cast<Slot *>(m_data + sizeof(Header) + registers);
+}
+
+bool NeuronSharedImage::futexWait(QAtomicInteger<quint32> *futex, quint32 value, int timeout)
+{
+    // QAtomicInteger holds nothing but the 32 bit value, the futex word is the integer itself
+    struct timespec time;
+    time.tv_sec = timeout / 1000;
+    time.tv_nsec = (timeout % 1000) * 1000000L;
+    long result = syscall(SYS_futex, reinterpret_cast<quint32 *>(futex), FUTEX_WAIT, value, timeout < 0 ? nullptr : &time, nullptr, 0);
+    return result == 0 || errno != ETIMEDOUT;
+}
+
+void NeuronSharedImage::futexWake(QAtomicInteger<quint32> *futex, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<quint32 *>(futex), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
@@ -0,0 +1,144 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONSHAREDIMAGE_H
+#define NEURONSHAREDIMAGE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QAtomicInteger>
+
+/*
+ * Process image shared between the neurond daemon and its clients through POSIX shared memory.
+ *
+ * Layout, host byte order:
+ *   Header
+ *   quint16 registers[unitCount][registersPerUnit]   unit 1 is the first sub-node
+ *   Slot commands[commandCapacity]
+ *
+ * The daemon publishes the registers after every cycle under a sequence lock, so clients copy
+ * consistent snapshots without any system call. Output writes are posted by any number of
+ * clients into a bounded lock-free command ring, which is drained by the daemon only. Both
+ * sides sleep on futexes inside the shared memory.
+ */
+class NeuronSharedImage
+{
+public:
+    enum CommandType {
+        CommandWriteRegister,
+        CommandWriteBit
+    };
+
+    typedef struct {
+        quint8 unit;
+        quint8 type;
+        quint16 address;
+        quint16 value;
+    } __attribute__((packed)) Command;
+
+    static const char *defaultName;
+    static const quint32 magic = 0x4d48534e; // "NSHM"
+    static const quint32 currentVersion = 1;
+
+    NeuronSharedImage();
+    ~NeuronSharedImage();
+
+    // Daemon side, the shared memory object is removed again when the image is destroyed. Fails if
+    // another daemon owns the object, a stale object of a crashed daemon is replaced.
+    bool create(const QString &name, const QString &model, int unitCount, int registersPerUnit, int commandCapacity = 256);
+    void beginPublish();
+    void publishUnit(int unit, const quint16 *registers, int count);
+    void endPublish(quint64 cycle, qint64 timestamp);
+    int takeCommands(Command *commands, int maxCount);
+    // Returns false if no command was posted within timeout milliseconds
+    bool waitForCommands(int timeout);
+
+    // Client side
+    bool attach(const QString &name = QString(defaultName));
+    void detach();
+    bool isValid() const;
+
+    QString model() const;
+    int unitCount() const;
+    int registersPerUnit() const;
+
+    // Whether the daemon owning the image still runs
+    bool isOwnerAlive() const;
+
+    // Copies the registers of all units, count must be unitCount() * registersPerUnit(), and
+    // the cycle the snapshot belongs to. Returns false if the daemon died while publishing.
+    bool snapshot(quint16 *registers, int count, quint64 *cycle = nullptr, qint64 *timestamp = nullptr) const;
+    // Consistent copy of count registers of one unit, returns false if they are outside of the
+    // image or the daemon died while publishing
+    bool readRegisters(int unit, int address, int count, quint16 *registers) const;
+    // Returns false if the command ring is full
+    bool postCommand(const Command &command);
+    bool postWriteRegister(int unit, quint16 address, quint16 value);
+    bool postWriteBit(int unit, quint16 address, bool value);
+    // Sleeps until a cycle newer than cycle is published, returns false on timeout
+    bool waitForCycle(quint64 cycle, int timeout) const;
+
+private:
+    struct Header {
+        quint32 magic;
+        quint32 version;
+        quint32 unitCount;
+        quint32 registersPerUnit;
+        quint32 commandCapacity; // Power of two
+        char model[32];
+        QAtomicInteger<quint32> sequence; // Odd while the daemon writes the image
+        QAtomicInteger<quint32> cycleFutex; // Lower 32 bits of the cycle, woken after every cycle
+        quint64 cycle;
+        qint64 timestamp; // In milliseconds since epoch
+
+        // Producers and the consumer of the command ring on separate cache lines
+        alignas(64) QAtomicInteger<quint32> commandHead;
+        alignas(64) QAtomicInteger<quint32> commandTail;
+        QAtomicInteger<quint32> commandFutex;
+    };
+
+    struct Slot {
+        QAtomicInteger<quint32> sequence; // Position the slot is free for, or position + 1 once written
+        Command command;
+    };
+
+    QString m_name;
+    bool m_owner = false;
+    int m_pidFile = -1; // Locked by the owner
+    const int m_spinLimit = 1000; // Reads of an odd sequence before yielding
+    const int m_ownerCheckInterval = 1000; // Yields between two checks of the owner
+    uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    Header *m_header = nullptr;
+    quint16 *m_registers = nullptr;
+    Slot *m_slots = nullptr;
+
+    static QByteArray pidFileName(const QString &name);
+    bool waitForSequence(quint32 *sequence) const;
+    static qint64 sizeOf(int unitCount, int registersPerUnit, int commandCapacity);
+    bool map(int fd, qint64 size);
+    void setPointers();
+    static bool futexWait(QAtomicInteger<quint32> *futex, quint32 value, int timeout);
+    static void futexWake(QAtomicInteger<quint32> *futex, int count);
+};
+
+#endif // NEURONSHAREDIMAGE_H
@@ -22,31 +22,33 @@
 
 #include "neuronspi.h"
 #include "neuronutil.h"
+#include "neuronbits.h"
+#include "neuronboardprofile.h"
+#include "modbusmap.h"
 
 #include <QDebug>
+#include <QEventLoop>
+#include <QTimer>
 
 Q_LOGGING_CATEGORY(dcNeuronSpi, "NeuronSpi")
 
 NeuronSpi::NeuronSpi(int index, QObject *parent) :
+    NeuronSpi(NeuronTopology::defaultTopology().node(index), index, parent)
+{
+
+}
+
+NeuronSpi::NeuronSpi(const NeuronTopology::Node &node, int index, QObject *parent) :
     QObject{parent},
-    m_index(index)
-{
-    switch (index) {
-    case 0:
-        m_spi = new Spi("/dev/spidev0.1", this);
-        m_gpio = 27;
-        break;
-    case 1:
-        m_spi = new Spi("/dev/spidev0.3", this);
-        m_gpio = 23;
-        break;
-    case 2:
-        m_spi = new Spi("/dev/spidev0.2", this);
-        m_gpio = 22;
-        break;
-    default:
-        m_spi = new Spi("", this);
-        qCWarning(dcNeuronSpi()) << "Index out of range [0, 2]";
+    m_index(index),
+    m_configuredSpeed(node.speed),
+    m_boardModel(node.model),
+    m_boardGroup(node.group),
+    m_gpio(node.gpio)
+{
+    m_spi = new Spi(node.devicePath, this);
+    if (node.devicePath.isEmpty()) {
+        qCWarning(dcNeuronSpi()) << "No SPI device for node" << index;
     }
 }
 
@@ -55,16 +57,192 @@ bool NeuronSpi::init()
     if (!m_spi->init()) {
         return false;
     }
+    connect(m_spi, &Spi::resynchronized, this, [=] (bool success, const QVector<quint16> &versionRegisters) {
+        if (!success) {
+            qCWarning(dcNeuronSpi()) << "SPI bus resynchronization failed for node" << m_index;
+            return;
+        }
+        auto boardVersion = NeuronUtil::parseVersion(versionRegisters);
+        qCInfo(dcNeuronSpi()) << "SPI bus resynchronized for node" << m_index << "firmware" << QString("%1.%2").arg(SW_MAJOR(boardVersion.SwVersion)).arg(SW_MINOR(boardVersion.SwVersion));
+    });
+    connect(m_spi, &Spi::statusReceived, this, &NeuronSpi::statusReceived);
+    // Follows the fallback speed and its restore, the identity cache keeps the speed set during the initialization
+    connect(m_spi, &Spi::spiSpeedChanged, this, [=] {
+        m_speed = m_spi->spiSpeed();
+    });
     m_spi->start();
 
+    NeuronIdentityCache cache;
+    auto identity = cache.identity(m_spi->devicePath());
+    if (identity.isValid && (m_configuredSpeed == 0 || identity.speed == m_configuredSpeed)) {
+        validateIdentity(identity);
+    } else {
+        probeBoard();
+    }
+
+    // The board raises the interrupt e.g. when UART characters were received
+    if (m_gpio < 0) {
+        return true;
+    }
+    m_neuronInterrupt = new NeuronInterrupt(m_gpio, this);
+    if (!m_neuronInterrupt->init()) {
+        qCWarning(dcNeuronSpi()) << "Could not init NeuronInterrupt";
+        return false;
+    }
+    connect(m_neuronInterrupt, &NeuronInterrupt::interruptReceived, this, &NeuronSpi::interruptReceived);
+
+    return true;
+}
+
+QList<NeuronSpi *> NeuronSpi::initSubNodes(const QString &neuronModel, QString *model, int timeout, QObject *parent)
+{
+    return initSubNodes(NeuronTopology::defaultTopology(), neuronModel, model, timeout, parent);
+}
+
+QList<NeuronSpi *> NeuronSpi::initSubNodes(const NeuronTopology &topology, const QString &neuronModel, QString *model, int timeout, QObject *parent)
+{
+    int subNodes = neuronModel.isEmpty() ? topology.neuronNodeCount() : ModbusMap::numberOfNodes(neuronModel);
+    if (subNodes > topology.neuronNodeCount()) {
+        qCWarning(dcNeuronSpi()) << "The Neuron" << neuronModel << "has" << subNodes << "sub-nodes, the topology describes" << topology.neuronNodeCount();
+        return QList<NeuronSpi *>();
+    }
+    // The additional boards are numbered after the sub-nodes of the Neuron
+    QList<NeuronTopology::Node> probeNodes = topology.nodes().mid(0, subNodes) + topology.additionalBoards();
+    qCDebug(dcNeuronSpi()) << "Probing" << subNodes << "sub-nodes and" << probeNodes.count() - subNodes << "additional boards on SPI controllers" << topology.controllers();
+
+    QEventLoop probeLoop;
+    QList<NeuronSpi *> nodes;
+    int pendingNodes = 0;
+    int openedSubNodes = 0;
+    for (int i = 0; i < probeNodes.count(); i++) {
+        const NeuronTopology::Node &node = probeNodes.at(i);
+        // Once a sub-node of the Neuron could not be opened, the following ones are left out
+        if (!node.isAdditionalBoard() && openedSubNodes < i) {
+            continue;
+        }
+        NeuronSpi *spi = new NeuronSpi(node, nodes.count(), parent);
+        qCDebug(dcNeuronSpi()) << "Init SPI" << i << node.devicePath;
+        if (!spi->init()) {
+            spi->deleteLater();
+            if (!neuronModel.isEmpty() || node.isAdditionalBoard()) {
+                qCWarning(dcNeuronSpi()) << "Could not init SPI" << node.devicePath;
+                qDeleteAll(nodes);
+                return QList<NeuronSpi *>();
+            }
+            continue;
+        }
+        if (!node.isAdditionalBoard()) {
+            openedSubNodes++;
+        }
+        nodes.append(spi);
+        pendingNodes++;
+        connect(spi, &NeuronSpi::initialized, &probeLoop, [&pendingNodes, &probeLoop] {
+            if (--pendingNodes == 0) {
+                probeLoop.quit();
+            }
+        });
+    }
+    QTimer::singleShot(timeout, &probeLoop, &QEventLoop::quit);
+    if (pendingNodes > 0) {
+        probeLoop.exec();
+    }
+
+    // Sub-nodes are numbered consecutively, the first one that does not answer ends the list
+    QList<NeuronSpi *> initializedNodes;
+    QList<NeuronSpi *> additionalBoards;
+    QList<NeuronUtil::BoardVersion> boards;
+    bool lastNodeFound = false;
+    bool boardMissing = false;
+    foreach (NeuronSpi *spi, nodes) {
+        if (!spi->boardModel().isEmpty()) {
+            if (!spi->isInitialized()) {
+                qCWarning(dcNeuronSpi()) << "Additional board" << spi->boardModel() << "on" << spi->m_spi->devicePath() << "does not answer";
+                boardMissing = true;
+            }
+            additionalBoards.append(spi);
+            continue;
+        }
+        if (lastNodeFound || !spi->isInitialized()) {
+            lastNodeFound = true;
+            spi->deleteLater();
+            continue;
+        }
+        boards.append(spi->boardVersion());
+        initializedNodes.append(spi);
+    }
+
+    if (initializedNodes.isEmpty() || (!neuronModel.isEmpty() && initializedNodes.count() != subNodes) || boardMissing) {
+        qCWarning(dcNeuronSpi()) << "Could not init SPI, sub-nodes found:" << initializedNodes.count();
+        qDeleteAll(initializedNodes);
+        qDeleteAll(additionalBoards);
+        return QList<NeuronSpi *>();
+    }
+
+    // Only the sub-nodes of the Neuron identify its model
+    QString detectedModel = ModbusMap::detectModel(boards);
+    if (neuronModel.isEmpty()) {
+        if (detectedModel.isEmpty()) {
+            qCWarning(dcNeuronSpi()) << "Could not detect the Neuron model";
+            qDeleteAll(initializedNodes);
+            qDeleteAll(additionalBoards);
+            return QList<NeuronSpi *>();
+        }
+        qCInfo(dcNeuronSpi()) << "Detected Neuron model" << detectedModel;
+        *model = detectedModel;
+    } else {
+        if (!detectedModel.isEmpty() && detectedModel != neuronModel) {
+            qCWarning(dcNeuronSpi()) << "Given Neuron model" << neuronModel << "does not match the detected model" << detectedModel;
+        }
+        *model = neuronModel;
+    }
+    foreach (NeuronSpi *spi, additionalBoards) {
+        qCInfo(dcNeuronSpi()) << "Additional board" << spi->boardModel() << "group" << spi->boardGroup() << "is sub-node" << initializedNodes.count() + 1;
+        initializedNodes.append(spi);
+    }
+    return initializedNodes;
+}
+
+bool NeuronSpi::isInitialized() const
+{
+    return m_initialized;
+}
+
+NeuronUtil::BoardVersion NeuronSpi::boardVersion() const
+{
+    return m_boardVersion;
+}
+
+QString NeuronSpi::boardModel() const
+{
+    return m_boardModel;
+}
+
+int NeuronSpi::boardGroup() const
+{
+    return m_boardGroup;
+}
+
+int NeuronSpi::speed() const
+{
+    return m_speed;
+}
+
+void NeuronSpi::probeBoard()
+{
     // Read firmware and hardware versions
+    m_spi->setSpiSpeed(m_defaultSpiSpeed);
     auto reply = readRegisters(1000, 5);
     connect(reply, &SpiReply::finished, this, [=] {
         reply->deleteLater();
-
         auto configRegisters = reply->result();
+        if (reply->error() != SpiError::NoError || configRegisters.length() != 5) {
+            qCWarning(dcNeuronSpi()) << "Could not read register 1000:" << reply->errorString();
+            finishInitialization(false);
+            return;
+        }
+
         auto boardVersion = NeuronUtil::parseVersion(configRegisters);
-        int speed = NeuronUtil::getBoardSpeed(boardVersion);
+        int speed = m_configuredSpeed > 0 ? m_configuredSpeed : NeuronUtil::getBoardSpeed(boardVersion);
         qCInfo(dcNeuronSpi()) << "Digital Inputs:" << boardVersion.DiCount;
         qCInfo(dcNeuronSpi()) << "Digital Outputs:" << boardVersion.DoCount;
         qCInfo(dcNeuronSpi()) << "Analog Inputs:" << boardVersion.AiCount;
@@ -77,31 +255,65 @@ bool NeuronSpi::init()
 
         if (!m_spi->setSpiSpeed(speed)) {
             qCWarning(dcNeuronSpi()) << "Could not set SPI speed.";
+            speed = m_defaultSpiSpeed;
         }
 
-        /* TODO: Check if the registers can still be read
-         *    if (!readRegisters(1000, 5, configRegisters)) {
-        qCWarning(dcNeuronSpi()) << "Could not read register 1000";
-        return false;
-        {
-        qCWarning(dcNeuronSpi()) << "Could not read register 1000 with new SPI speed, setting back to default speed:" << m_defaultSpiSpeed;
-        m_spi->setSpiSpeed(m_defaultSpiSpeed);
-        speed = m_defaultSpiSpeed;
-        */
-     });
-
+        // Check if the registers can still be read with the new speed
+        auto verifyReply = readRegisters(1000, 5);
+        connect(verifyReply, &SpiReply::finished, this, [=] {
+            verifyReply->deleteLater();
+            int appliedSpeed = speed;
+            if (verifyReply->error() != SpiError::NoError || verifyReply->result() != configRegisters) {
+                qCWarning(dcNeuronSpi()) << "Could not read register 1000 with new SPI speed, setting back to default speed:" << m_defaultSpiSpeed;
+                m_spi->setSpiSpeed(m_defaultSpiSpeed);
+                appliedSpeed = m_defaultSpiSpeed;
+            }
+
+            m_boardVersion = boardVersion;
+            m_speed = m_spi->spiSpeed();
+
+            // A bus that fell back to a lower speed meanwhile did not prove the applied speed
+            if (m_speed == appliedSpeed) {
+                NeuronIdentityCache::Identity identity;
+                identity.boardVersion = boardVersion;
+                identity.speed = appliedSpeed;
+                identity.isValid = true;
+                NeuronIdentityCache().storeIdentity(m_spi->devicePath(), identity);
+            }
+            finishInitialization(true);
+        });
+    });
+}
 
-    // The interrupt is not yet used, this code is kept as a reminder to improve the code further.
-    m_neuronInterrupt = new NeuronInterrupt(m_gpio, this);
-    if (!m_neuronInterrupt->init()) {
-        qCWarning(dcNeuronSpi()) << "Could not init NeuronInterrupt";
-        return false;
-    }
-    connect(m_neuronInterrupt, &NeuronInterrupt::interruptReceived, this, [=] {
-        qCDebug(dcNeuronSpi()) << "Interrupt received, not yet implemented";
+void NeuronSpi::validateIdentity(const NeuronIdentityCache::Identity &identity)
+{
+    // A single read at the cached speed confirms that the same board is still connected
+    m_spi->setSpiSpeed(identity.speed);
+    auto reply = readRegisters(1000, 5);
+    connect(reply, &SpiReply::finished, this, [=] {
+        reply->deleteLater();
+        if (reply->error() == SpiError::NoError && reply->result().length() == 5) {
+            auto boardVersion = NeuronUtil::parseVersion(reply->result());
+            if (boardVersion.SwVersion == identity.boardVersion.SwVersion &&
+                    boardVersion.HwVersion == identity.boardVersion.HwVersion &&
+                    boardVersion.BaseHwVersion == identity.boardVersion.BaseHwVersion) {
+                qCInfo(dcNeuronSpi()) << "Board identity confirmed from cache, firmware" << QString("%1.%2").arg(SW_MAJOR(boardVersion.SwVersion)).arg(SW_MINOR(boardVersion.SwVersion)) << "SPI speed:" << identity.speed/1000000 << "MHz";
+                m_boardVersion = identity.boardVersion;
+                m_speed = m_spi->spiSpeed();
+                finishInitialization(true);
+                return;
+            }
+        }
+        qCInfo(dcNeuronSpi()) << "Cached board identity does not match, probing board on" << m_spi->devicePath();
+        NeuronIdentityCache().removeIdentity(m_spi->devicePath());
+        probeBoard();
     });
+}
 
-    return true;
+void NeuronSpi::finishInitialization(bool success)
+{
+    m_initialized = success;
+    emit initialized(success);
 }
 
 SpiReply *NeuronSpi::readRegisters(uint16_t reg, uint8_t cnt)
@@ -122,90 +334,118 @@ SpiReply *NeuronSpi::readRegisters(uint16_t reg, uint8_t cnt)
     */
 }
 
-bool NeuronSpi::writeRegister(uint16_t reg, uint16_t value)
+SpiReply *NeuronSpi::writeRegister(uint16_t reg, uint16_t value)
 {
-    Q_UNUSED(reg)
-    Q_UNUSED(value)
-    return true; //onePhaseOperation(FunctionCode::WriteRegister, reg, value);
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteRegister, reg, value, this);
+    return m_spi->sendMessage(message);
 }
 
-bool NeuronSpi::writeRegisters(uint16_t reg, uint8_t cnt, uint16_t *values)
+SpiReply *NeuronSpi::writeRegisters(uint16_t reg, const QVector<quint16> &values)
 {
-    if (cnt > 126) {
+    if (values.count() > 126) {
         qCWarning(dcNeuronSpi()) << "Too many registers in WRITE_REG";
-        return false;
+        return nullptr;
     }
-    Q_UNUSED(reg)
-    Q_UNUSED(values)
-    //uint16_t len2 = m_sizeOfCommunicationHeader + sizeof(uint16_t) * cnt;
-
-    ((CommunicationHeader *)(m_rx2))->len = cnt;
-    memmove(m_tx2 + m_sizeOfCommunicationHeader, values, cnt * sizeof(uint16_t));
-
-    //if (!twoPhaseOperation(FunctionCode::WriteRegister, reg, len2))
-    //    return false;
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteRegister, reg, values, this);
+    return m_spi->sendMessage(message);
+}
 
-    if (((CommunicationHeader *)(m_rx2))->op != FunctionCode::WriteRegister) {
-        qCWarning(dcNeuronSpi()) << "Unexpected reply in WRITE_REG";
-        return false;
+SpiReply *NeuronSpi::readBits(uint16_t reg, uint16_t cnt)
+{
+    // The bit count is sent in the length byte of the header
+    if (cnt > 255) {
+        qCWarning(dcNeuronSpi()) << "Too many bits in READ_BITS";
+        return nullptr;
     }
-    return true;
+    SpiMessage *message = new SpiMessage(FunctionCode::ReadBit, reg, static_cast<int>(cnt), this);
+    return m_spi->sendMessage(message);
 }
 
+SpiReply* NeuronSpi::writeBit(quint16 reg, quint8 value)
+{
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteBit, reg, static_cast<quint16>(value), this);
+    return m_spi->sendMessage(message);
+}
 
-bool NeuronSpi::readBits(uint16_t reg, uint16_t cnt, uint8_t *result)
+SpiReply *NeuronSpi::writeBits(uint16_t reg, uint16_t cnt, const uint8_t *values)
 {
-    uint16_t len2 = m_sizeOfCommunicationHeader + (((cnt+15) >> 4) << 1);  // trunc to 16bit in bytes
-    if (len2 > 256) {
-        qCWarning(dcNeuronSpi()) << "Too many registers in READ_BITS";
-        return false;
+    if (cnt > 255) {
+        qCWarning(dcNeuronSpi()) << "Too many bits in WRITE_BITS";
+        return nullptr;
     }
-    //if (!twoPhaseOperation(FunctionCode::ReadBit, reg, len2))
-    //        return false;
+    QVector<quint16> words((cnt + 15) >> 4);
+    NeuronBits::pack(values, cnt, words.data());
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteBits, reg, words, static_cast<int>(cnt), this);
+    return m_spi->sendMessage(message);
+}
 
-    if ((((CommunicationHeader *)(m_rx2))->op != FunctionCode::ReadBit) ||
-            (((CommunicationHeader *)(m_rx2))->reg != reg)) {
-        qCWarning(dcNeuronSpi()) << "Unexpected reply in READ_BIT";
-        return false;
-    }
-    cnt = ((CommunicationHeader *)(m_rx2))->len;
-    memmove(result, m_rx2+m_sizeOfCommunicationHeader, ((cnt+7) >> 3));    // trunc to 8 bit
+SpiReply *NeuronSpi::idleOperation()
+{
+    SpiMessage *message = new SpiMessage(this);
+    return m_spi->sendMessage(message);
+}
 
-    return true;
+void NeuronSpi::setIdleInterval(int milliseconds)
+{
+    m_spi->setIdleInterval(milliseconds);
 }
 
-SpiReply* NeuronSpi::writeBit(quint16 reg, quint8 value)
+quint8 NeuronSpi::takeStatus()
+{
+    return m_spi->takeStatus();
+}
+
+SpiReply *NeuronSpi::writeCharacter(int port, char character)
 {
-    SpiMessage *message = new SpiMessage(FunctionCode::WriteBit, reg, value, this);
+    // The UART index is sent in the upper byte of the register
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteCharacter, port << 8, static_cast<quint16>(static_cast<quint8>(character)), this);
     return m_spi->sendMessage(message);
 }
 
-bool NeuronSpi::writeBits(uint16_t reg, uint16_t cnt, uint8_t *values)
+SpiReply *NeuronSpi::writeString(int port, const QByteArray &characters)
 {
-    Q_UNUSED(reg)
-    uint16_t len2 = m_sizeOfCommunicationHeader + (((cnt+15) >> 4) << 1);  // trunc to 16bit in bytes
-    if (len2 > 256) {
-        qCWarning(dcNeuronSpi()) << "Too many registers in WRITE_BITS";
-        return false;
+    if (characters.length() > SpiMessage::maxStringLength) {
+        qCWarning(dcNeuronSpi()) << "Too many characters in WRITE_STR";
+        return nullptr;
     }
+    SpiMessage *message = new SpiMessage(FunctionCode::WriteString, port << 8, characters, this);
+    return m_spi->sendMessage(message);
+}
 
-    ((CommunicationHeader *)(m_rx2))->len = cnt;
-    memmove(m_tx2 + m_sizeOfCommunicationHeader, values, ((cnt+7) >> 3));
+SpiReply *NeuronSpi::readString(int port, int maxLength)
+{
+    SpiMessage *message = new SpiMessage(FunctionCode::ReadString, port << 8, qMin(maxLength, SpiMessage::maxStringLength), this);
+    return m_spi->sendMessage(message);
+}
 
-    //if (!twoPhaseOperation(FunctionCode::WriteBits, reg, len2))
-    //    return false;
+int NeuronSpi::readPiggybackedCharacters(char *characters, int maxCount)
+{
+    return m_spi->readUartCharacters(characters, maxCount);
+}
 
-    if (((CommunicationHeader *)(m_rx2))->op != FunctionCode::WriteBits) {
-        qCWarning(dcNeuronSpi()) << "Unexpected reply in WRITE_BITS";
-        return false;
-    }
-    return true;
+bool NeuronSpi::startStreaming(quint16 reg, quint8 cnt, int interFrameGap, int capacity)
+{
+    Spi::StreamConfiguration configuration;
+    configuration.address = reg;
+    configuration.count = cnt;
+    configuration.interFrameGap = interFrameGap;
+    configuration.capacity = capacity;
+    return m_spi->startStreaming(configuration);
 }
 
-bool NeuronSpi::idleOperation()
+void NeuronSpi::stopStreaming()
 {
-    //onePhaseOperation(FunctionCode::Idle, 0x0e55, 0);
-    return true;
+    m_spi->stopStreaming();
+}
+
+int NeuronSpi::readSamples(Spi::StreamSample *samples, int maxCount)
+{
+    return m_spi->readSamples(samples, maxCount);
+}
+
+Spi::StreamStatistics NeuronSpi::streamStatistics() const
+{
+    return m_spi->streamStatistics();
 }
 
 NeuronInterrupt::NeuronInterrupt(int gpio, QObject *parent) :
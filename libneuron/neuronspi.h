@@ -30,6 +30,9 @@
 #include <QDir>
 
 #include "spi.h"
+#include "neuronutil.h"
+#include "neuronidentitycache.h"
+#include "neurontopology.h"
 
 Q_DECLARE_LOGGING_CATEGORY(dcNeuronSpi)
 
@@ -39,21 +42,59 @@ class NeuronSpi : public QObject
 {
     Q_OBJECT
 public:
+    // Sub-node index of the default topology
     explicit NeuronSpi(int index, QObject *parent = nullptr);
+    NeuronSpi(const NeuronTopology::Node &node, int index, QObject *parent = nullptr);
 
+    // Probes all sub-nodes concurrently, each one runs on its own SPI thread. Without a model the
+    // answering sub-nodes are counted and the model is detected. The additional boards of the
+    // topology follow the sub-nodes of the Neuron and must all answer. Returns the initialized
+    // sub-nodes, an empty list on failure.
+    static QList<NeuronSpi *> initSubNodes(const QString &neuronModel, QString *model, int timeout = 2000, QObject *parent = nullptr);
+    static QList<NeuronSpi *> initSubNodes(const NeuronTopology &topology, const QString &neuronModel, QString *model, int timeout = 2000, QObject *parent = nullptr);
+
+    // Starts the board detection, initialized() is emitted once the board identity is known
     bool init();
+    bool isInitialized() const;
+    NeuronUtil::BoardVersion boardVersion() const;
+    // Speed in use, lower while the bus runs at the fallback speed after a resynchronization
+    int speed() const;
+    // Model and map group of an additional board, see NeuronTopology::Node. Empty for the sub-nodes of the Neuron.
+    QString boardModel() const;
+    int boardGroup() const;
 
     SpiReply *writeBit(quint16 reg, quint8 value);
     SpiReply *readRegisters(uint16_t reg, uint8_t cnt);
     //bool readRegisters(uint16_t reg, uint8_t cnt, uint16_t* result);
-    bool writeRegister(uint16_t reg, uint16_t value);
-    bool writeRegisters(uint16_t reg, uint8_t cnt, uint16_t* values);
-
-    bool readBits(uint16_t reg, uint16_t cnt, uint8_t* result);
-   // bool writeBit(uint16_t reg, uint8_t value);
-    bool writeBits(uint16_t reg, uint16_t cnt, uint8_t* values);
-
-    bool idleOperation();
+    SpiReply *writeRegister(uint16_t reg, uint16_t value);
+    // Returns nullptr if the values do not fit into one message
+    SpiReply *writeRegisters(uint16_t reg, const QVector<quint16> &values);
+
+    // Read bits are taken from the reply with SpiReply::bit(), written bits are passed as
+    // one byte per bit, see NeuronBits. Both return nullptr for more than 255 bits.
+    SpiReply *readBits(uint16_t reg, uint16_t cnt);
+    SpiReply *writeBits(uint16_t reg, uint16_t cnt, const uint8_t *values);
+
+    // Queues one idle frame, the status flags of its reply are collected by takeStatus()
+    SpiReply *idleOperation();
+    // Polls the board with idle frames whenever the bus was quiet for the interval, 0 disables it
+    void setIdleInterval(int milliseconds);
+    // Status flags the board reported since the last call, see NeuronFrame::idleStatus()
+    quint8 takeStatus();
+
+    // UART passthrough, port is the UART index of this sub-node
+    SpiReply *writeCharacter(int port, char character);
+    // Returns nullptr if the characters do not fit into one message
+    SpiReply *writeString(int port, const QByteArray &characters);
+    SpiReply *readString(int port, int maxLength);
+    // Characters of the first UART the board piggybacked on any reply
+    int readPiggybackedCharacters(char *characters, int maxCount);
+
+    // Samples consecutive registers, e.g. a few analog input values, as fast as the bus allows
+    bool startStreaming(quint16 reg, quint8 cnt, int interFrameGap = 0, int capacity = 4096);
+    void stopStreaming();
+    int readSamples(Spi::StreamSample *samples, int maxCount);
+    Spi::StreamStatistics streamStatistics() const;
 
 private:
     typedef struct {
@@ -75,15 +116,31 @@ private:
     const int m_index;
     const int m_defaultSpiSpeed = 8000000; //8 MHz
 
+    bool m_initialized = false;
+    NeuronUtil::BoardVersion m_boardVersion = {};
+    int m_speed = 0;
+    int m_configuredSpeed = 0; // Overrides the speed supported by the board if set
+    QString m_boardModel;
+    int m_boardGroup = 1;
+
+    void probeBoard();
+    void validateIdentity(const NeuronIdentityCache::Identity &identity);
+    void finishInitialization(bool success);
+
 
     NeuronInterrupt *m_neuronInterrupt =  nullptr;
 
-    int m_gpio;
+    int m_gpio = -1;
     NeuronSpiMessage m_tx1;
     NeuronSpiMessage m_rx1;
 
     uint8_t m_tx2[256 + 2 + 40];
     uint8_t m_rx2[256 + 2 + 40];
+
+signals:
+    void initialized(bool success);
+    void interruptReceived();
+    void statusReceived(quint8 status);
 };
 
 class NeuronInterrupt: public QObject
@@ -0,0 +1,174 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neurontopology.h"
+#include "neuronboardprofile.h"
+
+#include <QFile>
+#include <QStringList>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+Q_LOGGING_CATEGORY(dcNeuronTopology, "NeuronTopology")
+
+// Splits /dev/spidevB.C into bus and chip select
+static bool parseSpidev(const QString &devicePath, int *bus, int *chipSelect)
+{
+    const QString prefix("/dev/spidev");
+    if (!devicePath.startsWith(prefix)) {
+        return false;
+    }
+    QStringList numbers = devicePath.mid(prefix.length()).split('.');
+    if (numbers.count() != 2) {
+        return false;
+    }
+    bool busOk, chipSelectOk;
+    *bus = numbers.at(0).toInt(&busOk);
+    *chipSelect = numbers.at(1).toInt(&chipSelectOk);
+    return busOk && chipSelectOk;
+}
+
+int NeuronTopology::Node::controller() const
+{
+    int bus, chipSelect;
+    return parseSpidev(devicePath, &bus, &chipSelect) ? bus : -1;
+}
+
+int NeuronTopology::Node::chipSelect() const
+{
+    int bus, chipSelect;
+    return parseSpidev(devicePath, &bus, &chipSelect) ? chipSelect : -1;
+}
+
+NeuronTopology NeuronTopology::defaultTopology()
+{
+    NeuronTopology topology;
+    for (int i = 0; i < NeuronBoardProfiles::maxNodes; i++) {
+        Node node;
+        node.devicePath = NeuronBoardProfiles::wiring[i].devicePath;
+        node.gpio = NeuronBoardProfiles::wiring[i].gpio;
+        topology.addNode(node);
+    }
+    return topology;
+}
+
+bool NeuronTopology::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(dcNeuronTopology()) << "Could not open topology" << fileName << file.errorString();
+        return false;
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+        qCWarning(dcNeuronTopology()) << "Could not parse topology" << fileName << error.errorString();
+        return false;
+    }
+
+    QList<Node> nodes;
+    foreach (const QJsonValue &value, doc.object().value("nodes").toArray()) {
+        QJsonObject object = value.toObject();
+        Node node;
+        node.devicePath = object.value("device").toString();
+        node.gpio = object.value("gpio").toInt(-1);
+        node.speed = object.value("speed").toInt(0);
+        node.model = object.value("model").toString();
+        node.group = object.value("group").toInt(1);
+        if (node.devicePath.isEmpty() || node.speed < 0 || node.group < 1) {
+            qCWarning(dcNeuronTopology()) << "Invalid node" << nodes.count() + 1 << "in topology" << fileName;
+            return false;
+        }
+        if (!node.isAdditionalBoard() && !nodes.isEmpty() && nodes.last().isAdditionalBoard()) {
+            qCWarning(dcNeuronTopology()) << "Node" << nodes.count() + 1 << "in topology" << fileName << "follows an additional board, the sub-nodes of the Neuron come first";
+            return false;
+        }
+        foreach (const Node &other, nodes) {
+            if (other.devicePath == node.devicePath) {
+                qCWarning(dcNeuronTopology()) << "Device" << node.devicePath << "is used twice in topology" << fileName;
+                return false;
+            }
+        }
+        nodes.append(node);
+    }
+    if (nodes.isEmpty()) {
+        qCWarning(dcNeuronTopology()) << "Topology" << fileName << "has no nodes";
+        return false;
+    }
+    m_nodes = nodes;
+    return true;
+}
+
+void NeuronTopology::addNode(const Node &node)
+{
+    m_nodes.append(node);
+}
+
+QList<NeuronTopology::Node> NeuronTopology::nodes() const
+{
+    return m_nodes;
+}
+
+int NeuronTopology::nodeCount() const
+{
+    return m_nodes.count();
+}
+
+int NeuronTopology::neuronNodeCount() const
+{
+    int count = 0;
+    foreach (const Node &node, m_nodes) {
+        if (!node.isAdditionalBoard()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+QList<NeuronTopology::Node> NeuronTopology::additionalBoards() const
+{
+    QList<Node> boards;
+    foreach (const Node &node, m_nodes) {
+        if (node.isAdditionalBoard()) {
+            boards.append(node);
+        }
+    }
+    return boards;
+}
+
+NeuronTopology::Node NeuronTopology::node(int index) const
+{
+    return m_nodes.value(index);
+}
+
+QList<int> NeuronTopology::controllers() const
+{
+    QList<int> controllers;
+    foreach (const Node &node, m_nodes) {
+        if (!controllers.contains(node.controller())) {
+            controllers.append(node.controller());
+        }
+    }
+    return controllers;
+}
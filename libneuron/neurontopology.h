@@ -0,0 +1,82 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONTOPOLOGY_H
+#define NEURONTOPOLOGY_H
+
+#include <QList>
+#include <QString>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(dcNeuronTopology)
+
+// Describes the SPI device, interrupt line and speed of every sub-node.
+//
+// Sub-nodes are listed in order, the first one is sub-node 1. Additional boards follow the
+// sub-nodes of the Neuron and are numbered after them. Every sub-node runs on
+// its own SPI worker thread, so nodes on different controllers (spi0, spi1, ...) are
+// scanned concurrently, nodes on the same controller share its transfer queue in the kernel.
+class NeuronTopology
+{
+public:
+    struct Node {
+        QString devicePath;
+        int gpio = -1; // Interrupt line, -1 if the sub-node has none
+        int speed = 0; // In Hz, 0 takes the speed supported by the board
+        // Boards beyond the sub-nodes of the Neuron, e.g. on a second controller, name the model
+        // whose map group describes them, e.g. "L503" group 3 or "xS11". Empty for the Neuron itself.
+        QString model;
+        int group = 1;
+
+        bool isAdditionalBoard() const { return !model.isEmpty(); }
+
+        // Bus number B of /dev/spidevB.C, -1 for other device paths
+        int controller() const;
+        // Chip select C of /dev/spidevB.C, -1 for other device paths
+        int chipSelect() const;
+    };
+
+    // The wiring of the Neuron PLCs, see NeuronBoardProfiles::wiring
+    static NeuronTopology defaultTopology();
+
+    // Reads a JSON file like
+    // {"nodes": [{"device": "/dev/spidev0.1", "gpio": 27}, {"device": "/dev/spidev1.0", "gpio": -1, "speed": 8000000,
+    //  "model": "L503", "group": 3}]}
+    bool load(const QString &fileName);
+
+    void addNode(const Node &node);
+    QList<Node> nodes() const;
+    int nodeCount() const;
+    // Returns an empty node for indexes out of range
+    Node node(int index) const;
+    // Nodes without a model, they are the sub-nodes of the Neuron
+    int neuronNodeCount() const;
+    QList<Node> additionalBoards() const;
+
+    // The distinct controllers of all nodes, in order of appearance
+    QList<int> controllers() const;
+
+private:
+    QList<Node> m_nodes;
+};
+
+#endif // NEURONTOPOLOGY_H
@@ -0,0 +1,227 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neuronuart.h"
+#include "neuronspi.h"
+
+#include <QLoggingCategory>
+
+#include <cstddef>
+
+Q_LOGGING_CATEGORY(dcNeuronUart, "NeuronUart")
+
+// NeuronUart is created with plain new, C++11 only guarantees the alignment of max_align_t there
+static_assert(alignof(NeuronUart) <= alignof(std::max_align_t), "NeuronUart must not require an extended alignment");
+
+NeuronUart::NeuronUart(NeuronSpi *spi, int port, int bufferSize, QObject *parent) :
+    QObject{parent},
+    m_spi(spi),
+    m_port(port),
+    m_txRing(bufferSize),
+    m_rxRing(bufferSize)
+{
+    m_pollTimer.setInterval(10);
+    connect(&m_pollTimer, &QTimer::timeout, this, &NeuronUart::poll);
+    connect(m_spi, &NeuronSpi::interruptReceived, this, [this] {
+        if (m_isOpen) {
+            poll();
+        }
+    });
+}
+
+int NeuronUart::port() const
+{
+    return m_port;
+}
+
+int NeuronUart::pollInterval() const
+{
+    return m_pollTimer.interval();
+}
+
+void NeuronUart::setPollInterval(int milliseconds)
+{
+    m_pollTimer.setInterval(milliseconds);
+    if (m_isOpen && milliseconds <= 0) {
+        m_pollTimer.stop();
+    } else if (m_isOpen) {
+        m_pollTimer.start();
+    }
+}
+
+void NeuronUart::open()
+{
+    m_isOpen = true;
+    if (m_pollTimer.interval() > 0) {
+        m_pollTimer.start();
+    }
+    poll();
+}
+
+void NeuronUart::close()
+{
+    m_isOpen = false;
+    m_pollTimer.stop();
+}
+
+bool NeuronUart::isOpen() const
+{
+    return m_isOpen;
+}
+
+qint64 NeuronUart::write(const char *data, qint64 size)
+{
+    if (!m_isOpen) {
+        qCWarning(dcNeuronUart()) << "Cannot write to closed UART" << m_port;
+        return -1;
+    }
+    int queued = m_txRing.push(data, qMin<qint64>(size, m_txRing.capacity()));
+    flush();
+    return queued;
+}
+
+qint64 NeuronUart::write(const QByteArray &data)
+{
+    return write(data.constData(), data.size());
+}
+
+qint64 NeuronUart::read(char *data, qint64 maxSize)
+{
+    return m_rxRing.pop(data, qMin<qint64>(maxSize, m_rxRing.capacity()));
+}
+
+QByteArray NeuronUart::readAll()
+{
+    QByteArray data(m_rxRing.count(), 0);
+    data.resize(m_rxRing.pop(data.data(), data.size()));
+    return data;
+}
+
+qint64 NeuronUart::bytesAvailable() const
+{
+    return m_rxRing.count();
+}
+
+qint64 NeuronUart::bytesToWrite() const
+{
+    return m_txRing.count();
+}
+
+NeuronUart::Statistics NeuronUart::statistics() const
+{
+    return m_statistics;
+}
+
+void NeuronUart::flush()
+{
+    if (m_writing || m_txRing.count() == 0) {
+        return;
+    }
+
+    char characters[SpiMessage::maxStringLength];
+    int count = m_txRing.pop(characters, SpiMessage::maxStringLength);
+    SpiReply *reply;
+    if (count == 1) {
+        reply = m_spi->writeCharacter(m_port, characters[0]);
+    } else {
+        reply = m_spi->writeString(m_port, QByteArray(characters, count));
+    }
+    m_writing = true;
+    m_statistics.writeMessages++;
+    connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+    connect(reply, &SpiReply::finished, this, [this, reply, count] {
+        m_writing = false;
+        if (reply->error() != SpiError::NoError) {
+            // UART writes are never repeated, the characters are lost
+            qCWarning(dcNeuronUart()) << "Could not write" << count << "characters to UART" << m_port << reply->errorString();
+            m_statistics.errors++;
+            emit errorOccurred(reply->errorString());
+        } else {
+            m_statistics.bytesWritten += count;
+            emit bytesWritten(count);
+        }
+        flush();
+    });
+}
+
+void NeuronUart::poll()
+{
+    receivePiggybackedCharacters();
+
+    if (m_reading) {
+        return;
+    }
+    m_reading = true;
+    m_statistics.readMessages++;
+    int requested = m_readLength;
+    SpiReply *reply = m_spi->readString(m_port, requested);
+    connect(reply, &SpiReply::finished, reply, &SpiReply::deleteLater);
+    connect(reply, &SpiReply::finished, this, [this, reply, requested] {
+        m_reading = false;
+        if (reply->error() != SpiError::NoError) {
+            qCDebug(dcNeuronUart()) << "Could not read from UART" << m_port << reply->errorString();
+            m_statistics.errors++;
+            m_readLength = m_minReadLength;
+            return;
+        }
+
+        // Characters piggybacked on this reply were received before the string
+        receivePiggybackedCharacters();
+        QByteArray characters = reply->characters();
+        receive(characters.constData(), characters.count());
+
+        // A full reply means more is waiting on the board, drain it right away with full messages
+        if (characters.count() >= requested && m_isOpen) {
+            m_readLength = SpiMessage::maxStringLength;
+            poll();
+        } else {
+            m_readLength = m_minReadLength;
+        }
+    });
+}
+
+void NeuronUart::receivePiggybackedCharacters()
+{
+    // Only the first UART gets characters piggybacked on replies
+    if (m_port != 0) {
+        return;
+    }
+    char characters[64];
+    int count;
+    while ((count = m_spi->readPiggybackedCharacters(characters, sizeof(characters))) > 0) {
+        receive(characters, count);
+    }
+}
+
+void NeuronUart::receive(const char *data, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    int stored = m_rxRing.push(data, count);
+    m_statistics.bytesRead += stored;
+    if (stored < count) {
+        m_statistics.overruns += count - stored;
+        qCDebug(dcNeuronUart()) << "UART" << m_port << "receive buffer overrun, dropped" << count - stored << "characters";
+    }
+    emit readyRead();
+}
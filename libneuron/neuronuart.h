@@ -0,0 +1,100 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONUART_H
+#define NEURONUART_H
+
+#include <QObject>
+#include <QTimer>
+
+#include "spscring.h"
+
+class NeuronSpi;
+
+// Serial port passthrough of one UART of a sub-node.
+//
+// Written bytes are queued in a ring and sent with as few WriteString
+// messages as possible, at most one message is in flight at any time so the
+// register scan keeps its share of the bus. Received bytes are drained with
+// ReadString when polled, when the board raises its interrupt or while the
+// previous read returned a full message.
+class NeuronUart : public QObject
+{
+    Q_OBJECT
+public:
+    struct Statistics {
+        quint64 bytesWritten = 0;
+        quint64 bytesRead = 0;
+        quint64 writeMessages = 0;
+        quint64 readMessages = 0;
+        quint64 overruns = 0; // Received bytes dropped because the receive ring was full
+        quint64 errors = 0;
+    };
+
+    explicit NeuronUart(NeuronSpi *spi, int port = 0, int bufferSize = 4096, QObject *parent = nullptr);
+
+    int port() const;
+
+    // 0 disables polling, the receive ring is then only drained on interrupts
+    int pollInterval() const;
+    void setPollInterval(int milliseconds);
+    void open();
+    void close();
+    bool isOpen() const;
+
+    // Returns the number of bytes queued, less than size if the transmit ring is full
+    qint64 write(const char *data, qint64 size);
+    qint64 write(const QByteArray &data);
+    qint64 read(char *data, qint64 maxSize);
+    QByteArray readAll();
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+
+    Statistics statistics() const;
+
+private:
+    NeuronSpi *m_spi;
+    int m_port;
+    bool m_isOpen = false;
+    QTimer m_pollTimer;
+
+    SpscRing<char> m_txRing;
+    SpscRing<char> m_rxRing;
+    bool m_writing = false;
+    bool m_reading = false;
+    const int m_minReadLength = 16; // Polling an idle line stays a short transfer
+    int m_readLength = m_minReadLength;
+    Statistics m_statistics;
+
+    void flush();
+    void poll();
+    void receivePiggybackedCharacters();
+    void receive(const char *data, int count);
+
+signals:
+    void readyRead();
+    void bytesWritten(qint64 bytes);
+    void errorOccurred(const QString &errorString);
+};
+
+#endif // NEURONUART_H
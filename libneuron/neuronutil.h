@@ -33,6 +33,9 @@
 #define SW_MAJOR(sw)  ((sw) >> 8)
 #define SW_MINOR(sw)  ((sw) & 0xff)
 
+// Event of the interrupt mask register, reported in the status flags of idle replies
+#define INT_DI_CHANGED 0x01
+
 class NeuronUtil : public QObject
 {
     Q_OBJECT
@@ -60,7 +63,7 @@ public:
     static int upboardExists(int board);
     static int checkCompatibility(int hw_base, int upboard);
     static int getBoardSpeed(const BoardVersion &boardVersion);
-    static uint16_t crcString(uint8_t *inputstring, int length, uint16_t initval);
+    static uint16_t crcString(const uint8_t *inputstring, int length, uint16_t initval);
 };
 
 #endif // NEURONUTIL_H
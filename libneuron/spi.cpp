@@ -22,171 +22,249 @@
 
 #include "spi.h"
 
-extern "C" {
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/types.h>
-}
+#include <QFile>
+
+#include <cstddef>
+
+#include <errno.h>
+#include <string.h>
 
 Q_LOGGING_CATEGORY(dcSpi, "Spi")
 
+// Spi is created with plain new, C++11 only guarantees the alignment of max_align_t there
+static_assert(alignof(Spi) <= alignof(std::max_align_t), "Spi must not require an extended alignment");
+
+const int Spi::maxStreamRegisters;
+
 Spi::Spi(const QString &spiDevicePath, QObject *parent)
-    : QThread{parent}
+    : QObject{parent},
+      m_transport(this)
 {
-    m_spiDevice.setFileName(spiDevicePath);
+    m_devicePath = spiDevicePath;
+}
+
+Spi::~Spi()
+{
+    // Pending replies are finished before the children of this object are deleted
+    m_stopping.storeRelease(1);
+    m_transport.stop();
 }
 
 bool Spi::init()
 {
-    qCInfo(dcSpi()) << "Initializing SPI interface" << m_spiDevice.fileName();
-    if (!m_spiDevice.exists()) {
-        qCWarning(dcSpi()) << "Neuron SPI interface does not exist" << m_spiDevice.fileName();
+    qCInfo(dcSpi()) << "Initializing SPI interface" << m_devicePath;
+    if (!QFile::exists(m_devicePath)) {
+        qCWarning(dcSpi()) << "Neuron SPI interface does not exist" << m_devicePath;
         return false;
     }
 
-    if (!m_spiDevice.open(QFile::ReadOnly)) {
-        qCWarning(dcSpi()) << "Could not open SPI interface:" << m_spiDevice.fileName();
+    if (!m_transport.open(QFile::encodeName(m_devicePath).constData())) {
+        qCWarning(dcSpi()) << "Could not open SPI interface:" << m_devicePath << strerror(errno);
         return false;
     }
     return true;
 }
 
-void Spi::run()
-{
-    qCInfo(dcSpi()) << "SPI loop started for" << m_spiDevice.fileName();
-    spi_ioc_transfer spiTransfer[7];
-
-    while (!isInterruptionRequested()) {
-
-        if (!m_messageQueue.isEmpty()) {
-            auto messageAndResponse = m_messageQueue.dequeue();
-            auto message = messageAndResponse.first;
-            auto reply = messageAndResponse.second;
-            reply->startTimeoutTimer();
-
-            if (message->messageLength() < 6) {
-                qWarning(dcSpi()) << "Invalid SPI message, length must be min 6 bytes";
-            } else if (message->messageLength() == 6) {
-                // One phase operation
-                // Message count is fixed to 2
-                memset(spiTransfer, 0, sizeof(spiTransfer));
-                spiTransfer[0].delay_usecs = m_nssDefaultPause;
-                spiTransfer[1].delay_usecs = 0;
-                spiTransfer[1].tx_buf = (unsigned long) message->txData();
-                spiTransfer[1].rx_buf = (unsigned long) reply->rxData();
-                spiTransfer[1].len = message->messageLength();
-
-                // Sending data on the SPI bus
-                if (ioctl(m_spiDevice.handle(), SPI_IOC_MESSAGE(2), &spiTransfer) < 1) {
-                    qCWarning(dcSpi()) << "Can't send SPI message";
-                    reply->setError(SpiError::UnknownError, "Unknown Error");
-                }
-                reply->setFinished(true);
-            } else {
-                // Two phase operation
-                memset(spiTransfer, 0, sizeof(spiTransfer));
-                spiTransfer[0].delay_usecs = m_nssDefaultPause;    // starting pause between NSS and SCLK
-                spiTransfer[1].tx_buf = (unsigned long) message->txData();
-                spiTransfer[1].rx_buf = (unsigned long) reply->rxData();
-                spiTransfer[1].len = 6;
-
-                int total = message->messageLength();
-                int messageCount = 2;
-                // Splitting data up to fit into SPI messages
-                while (total > 0 && messageCount < 7) {
-                    spiTransfer[messageCount].tx_buf = (unsigned long)message->txData()+6+(m_maxSpiRx*(messageCount-2));
-                    spiTransfer[messageCount].rx_buf = (unsigned long)reply->rxData()+6+(m_maxSpiRx*(messageCount-2));
-                    if ((total - m_maxSpiRx) > 0) {
-                        spiTransfer[messageCount].len = m_maxSpiRx;
-                        total -= m_maxSpiRx;
-                    } else {
-                        spiTransfer[messageCount].len = total;
-                        total = 0;
-                    }
-                    messageCount++;
-                }
-                // Sending data on the SPI bus
-                if (ioctl(m_spiDevice.handle(), SPI_IOC_MESSAGE(messageCount), spiTransfer) < 1) {
-                    qCWarning(dcSpi()) << "Can't send SPI message";
-                    reply->setError(SpiError::UnknownError, "Unknown Error");
-                }
-                reply->setFinished(true);
-            }
-            QThread::msleep(1);
-        } else {
-            QThread::msleep(100);
-        }
-    }
+void Spi::start()
+{
+    qCInfo(dcSpi()) << "SPI loop started for" << m_devicePath;
+    m_transport.start();
+}
+
+QString Spi::devicePath() const
+{
+    return m_devicePath;
 }
 
 bool Spi::setSpiSpeed(int speed)
 {
-    qCInfo(dcSpi()) << "Setting SPI speed to" << speed/1000000 << "MHz";;
-    if (ioctl(m_spiDevice.handle(), SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
-        qCWarning(dcSpi) << "Cannot set speed" << m_spiDevice.errorString();
+    qCInfo(dcSpi()) << "Setting SPI speed to" << speed/1000000 << "MHz";
+    if (!m_transport.setSpeed(speed)) {
+        qCWarning(dcSpi) << "Cannot set speed" << strerror(errno);
         return false;
     }
     return true;
 }
-/*
-bool Spi::onePhaseOperation(SpiMessage *message)
+
+int Spi::spiSpeed() const
 {
+    return m_transport.speed();
 }
 
-    uint16_t crc = crcString((uint8_t*)&rx, m_sizeOfCommunicationHeader, 0);
-    if (crc != rx.crc) {
-        qCWarning(dcSpi()) << "Invalid CRC in one-phase operation";
-        return rx;
-    }
+SpiReply *Spi::sendMessage(SpiMessage *message)
+{
+    SpiReply *reply = new SpiReply(this);
+    NeuronTransport::Request request;
+    request.frame = message->frame();
+    request.retryable = message->isRetryable();
+    request.context = reply;
+    // The engine keeps its own copy of the frame
+    delete message;
+    m_transport.submit(std::move(request));
+    return reply;
+}
 
-    if ((*((uint32_t*)&rx) & 0xffff00ff) == m_idlePattern) {
-        return rx;
-    }
+int Spi::transactionTimeout() const
+{
+    return m_transport.transactionTimeout();
+}
 
-    if (rx.op != FunctionCode::WriteCharacter) {
-        qCWarning(dcSpi()) << "Unexpected reply in one-phase operation, Function code" << FunctionCode(rx.op) << QString("Length 0x%1, Register 0x%2").arg(rx.len, 0, 16).arg(rx.reg, 0, 16);
-        return rx;
-    }
-    return rx;
+void Spi::setTransactionTimeout(int milliseconds)
+{
+    m_transport.setTransactionTimeout(milliseconds);
+}
+
+Spi::RetryPolicy Spi::retryPolicy() const
+{
+    return m_transport.retryPolicy();
 }
 
-bool Spi::twoPhaseOperation(SpiMessage *message)
+void Spi::setRetryPolicy(const RetryPolicy &policy)
 {
-    uint16_t tr_len2;
-    uint16_t crc;
+    m_transport.setRetryPolicy(policy);
+}
 
-    // Prepare transactional structure
-    spi_ioc_transfer spiTransfer[7];
+Spi::Statistics Spi::statistics() const
+{
+    return m_transport.statistics();
+}
 
-    crc = NeuronUtil::crcString((uint8_t*)&m_rx1, m_sizeOfCommunicationHeader, 0);
-    if (crc != m_rx1.crc) {
-        qCWarning(dcSpi()) << "Bad 1.crc in two phase operation";
+bool Spi::startStreaming(const StreamConfiguration &configuration)
+{
+    if (!m_transport.startStreaming(configuration)) {
+        qCWarning(dcSpi()) << "Invalid stream register count" << configuration.count;
         return false;
     }
+    return true;
+}
+
+void Spi::stopStreaming()
+{
+    m_transport.stopStreaming();
+}
 
-    crc = crcString(m_rx2, tr_len2, crc);
+bool Spi::isStreaming() const
+{
+    return m_transport.isStreaming();
+}
 
-    if (m_rx1.op == FunctionCode::WriteCharacter) {
-        if (((uint16_t*)m_rx2)[tr_len2>>1] != crc) {
-            qCWarning(dcSpi()) << "Bad 2.crc in two phase operation";
-            return false;
+int Spi::readSamples(StreamSample *samples, int maxCount)
+{
+    return m_transport.readSamples(samples, maxCount);
+}
+
+Spi::StreamStatistics Spi::streamStatistics() const
+{
+    return m_transport.streamStatistics();
+}
+
+int Spi::readUartCharacters(char *characters, int maxCount)
+{
+    return m_transport.readUartCharacters(characters, maxCount);
+}
+
+int Spi::idleInterval() const
+{
+    return m_transport.idleInterval();
+}
+
+void Spi::setIdleInterval(int milliseconds)
+{
+    m_transport.setIdleInterval(milliseconds);
+}
+
+quint8 Spi::takeStatus()
+{
+    return m_transport.takeStatus();
+}
+
+void Spi::requestFinished(const NeuronTransport::Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx)
+{
+    const NeuronFrame &frame = request.frame;
+    QString errorText;
+    switch (error) {
+    case SpiError::NoError:
+        break;
+    case SpiError::TimeoutError:
+        qCDebug(dcSpi()) << "SPI transaction timed out in queue, function code" << frame.functionCode();
+        errorText = "Timeout";
+        break;
+    case SpiError::CrcError:
+        errorText = "CRC error";
+        break;
+    default:
+        errorText = m_stopping.loadAcquire() ? "SPI interface stopped" : "Transfer error";
+        break;
+    }
+
+    // The result vector is implicitly shared, the attached replies do not copy the values
+    QVector<quint16> result;
+    QByteArray characters;
+    if (rx) {
+        result.resize(frame.resultCount(rx));
+        memcpy(result.data(), frame.resultData(rx), result.count() * sizeof(quint16));
+        characters = QByteArray(frame.characterData(rx), frame.characterCount(rx));
+    }
+
+    QList<SpiReply *> replies;
+    replies.append(static_cast<SpiReply *>(request.context));
+    for (size_t i = 0; i < sharedContexts.size(); i++) {
+        replies.append(static_cast<SpiReply *>(sharedContexts.at(i)));
+    }
+    foreach (SpiReply *reply, replies) {
+        reply->setResult(result);
+        reply->setCharacters(characters);
+        if (error != SpiError::NoError) {
+            reply->setError(error, errorText);
         }
-        return true;
     }
-    if (((uint16_t*)m_rx2)[tr_len2>>1] != crc) {
-        qCWarning(dcSpi()) << "Bad 2.crc in two phase operation";
-        return false;
+    foreach (SpiReply *reply, replies) {
+        reply->setFinished(true);
     }
-    if ((*((uint32_t*)&m_rx1) & 0xffff00ff) == m_idlePattern) {
-        return true;
+}
+
+void Spi::transferFailed(const NeuronFrame &frame, SpiError error)
+{
+    switch (error) {
+    case SpiError::CrcError:
+        qCWarning(dcSpi()) << "Invalid CRC in reply, function code" << frame.functionCode() << "register" << frame.address();
+        break;
+    case SpiError::ProtocolError:
+        qCWarning(dcSpi()) << "Unexpected reply, function code" << frame.functionCode() << "register" << frame.address();
+        break;
+    default:
+        qCWarning(dcSpi()) << "Can't send SPI message";
+        break;
     }
-    qCWarning(dcSpi()) << "Unexpected reply in two phase operation" << FunctionCode(m_rx1.op) << QString("Length 0x%1, Register 0x%2").arg(m_rx1.len, 0, 16).arg(m_rx1.reg, 0, 16);
-    return false;
 }
-*/
-SpiReply *Spi::sendMessage(const SpiMessage * const message)
+
+void Spi::unexpectedReply(const NeuronFrame &frame, const uint8_t *rx)
 {
-    auto reply = new SpiReply(this);
-    m_messageQueue.enqueue(QPair<const SpiMessage *, SpiReply *>(message, reply));
-    return reply;
+    quint16 reg;
+    memcpy(&reg, rx + 2, sizeof(reg));
+    qCDebug(dcSpi()) << "Unexpected reply in one phase operation, function code" << rx[0] << QString("Length 0x%1, Register 0x%2").arg(rx[1], 0, 16).arg(reg, 0, 16) << "sent" << frame.functionCode();
+}
+
+void Spi::resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count)
+{
+    qCWarning(dcSpi()) << "Resynchronized SPI bus" << m_devicePath << "after" << failures << "failed transfers";
+    if (!success) {
+        qCWarning(dcSpi()) << "Could not read register 1000 after resynchronization";
+    }
+    QVector<quint16> registers;
+    for (int i = 0; i < count; i++) {
+        registers.append(versionRegisters[i]);
+    }
+    emit resynchronized(success, registers);
+}
+
+void Spi::statusReported(uint8_t status)
+{
+    emit statusReceived(status);
+}
+
+void Spi::speedChanged(int speed)
+{
+    qCWarning(dcSpi()) << "SPI bus" << m_devicePath << "runs at" << speed / 1000000.0 << "MHz";
+    emit spiSpeedChanged(speed);
 }
@@ -23,47 +23,96 @@
 #ifndef SPI_H
 #define SPI_H
 
-#include <QThread>
 #include <QObject>
-#include <QFile>
 #include <QDebug>
-#include <QQueue>
+#include <QAtomicInt>
 #include <QLoggingCategory>
-
-extern "C" {
-#include <linux/spi/spidev.h>
-}
+#include <QVector>
 
 #include "spimessage.h"
+#include "neurontransport.h"
 
 Q_DECLARE_LOGGING_CATEGORY(dcSpi)
 
-class Spi : public QThread
+// Qt adapter of the transaction engine in libneuron-core, see NeuronTransport.
+// Messages become SpiReply objects, the engine callbacks become signals.
+class Spi : public QObject, private NeuronTransport::Listener
 {
     Q_OBJECT
 public:
+    typedef NeuronTransport::Statistics Statistics;
+    typedef NeuronTransport::RetryPolicy RetryPolicy;
+    typedef NeuronTransport::StreamSample StreamSample;
+    typedef NeuronTransport::StreamConfiguration StreamConfiguration;
+    typedef NeuronTransport::StreamStatistics StreamStatistics;
+
+    static const int maxStreamRegisters = NeuronTransport::maxStreamRegisters;
+
     explicit Spi(const QString &spiDevicePath, QObject *parent = nullptr);
+    ~Spi() override;
 
     bool init();
-    void run() override;
+    // Starts the worker thread of the engine
+    void start();
+
+    QString devicePath() const;
 
     bool setSpiSpeed(int speed);
-private:
+    // Speed in use, lower than the one set while the bus runs at the fallback speed of the retry policy
+    int spiSpeed() const;
+
+    // Time a transaction may wait in the queue before it fails with a TimeoutError
+    int transactionTimeout() const;
+    void setTransactionTimeout(int milliseconds);
 
-    QFile m_spiDevice;
+    RetryPolicy retryPolicy() const;
+    void setRetryPolicy(const RetryPolicy &policy);
 
-    const int m_maxSpiRx = 64; // On the RPI 2,3 the SPI transmit is limitted to 94 bytes.
-    const int m_maxSpiStr = 240;
-    const int m_nssDefaultPause = 10;
-    const uint32_t m_idlePattern = 0x0e5500fa;
+    Statistics statistics() const;
+
+    // Streaming reads the same registers continuously whenever no transaction is queued
+    bool startStreaming(const StreamConfiguration &configuration);
+    void stopStreaming();
+    bool isStreaming() const;
+    // Called by one consumer thread, returns the number of samples taken
+    int readSamples(StreamSample *samples, int maxCount);
+    StreamStatistics streamStatistics() const;
+
+    // UART characters the board piggybacked on replies, called by one consumer thread
+    int readUartCharacters(char *characters, int maxCount);
+
+    // Idle frames are sent whenever the bus was quiet for the interval, 0 disables them.
+    // Their replies carry the status flags of the board, as do the first phases of all other replies.
+    int idleInterval() const;
+    void setIdleInterval(int milliseconds);
+    // Status flags reported since the last call
+    quint8 takeStatus();
+
+private:
+    QString m_devicePath;
+    NeuronTransport m_transport;
+    QAtomicInt m_stopping;
 
-    QQueue<QPair<const SpiMessage *, SpiReply *>> m_messageQueue;
+    // Called by the worker thread of the engine
+    void requestFinished(const NeuronTransport::Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx) override;
+    void transferFailed(const NeuronFrame &frame, SpiError error) override;
+    void unexpectedReply(const NeuronFrame &frame, const uint8_t *rx) override;
+    void resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count) override;
+    void statusReported(uint8_t status) override;
+    void speedChanged(int speed) override;
 
 public slots:
-    SpiReply *sendMessage(const SpiMessage * const message);
+    // Takes over the message
+    SpiReply *sendMessage(SpiMessage *message);
 
 signals:
     void messageSent(bool success, SpiMessage * const message);
+    // Emitted from the worker thread after the bus has been resynchronized, carries the register 1000 block
+    void resynchronized(bool success, const QVector<quint16> &versionRegisters);
+    // Emitted from the worker thread when the board reports status flags after the last takeStatus()
+    void statusReceived(quint8 status);
+    // Emitted from the worker thread when the bus falls back to a lower speed or returns to the previous one
+    void spiSpeedChanged(int speed);
 };
 
 
@@ -21,11 +21,17 @@
 // SOFTWARE.
 
 #include "spimessage.h"
+#include "neuronutil.h"
+#include "spi.h"
+
+#include <QSharedPointer>
 
 SpiMessage::SpiMessage(QObject *parent) :
-    QObject{parent}
+    QObject{parent},
+    m_functionCode(FunctionCode::Idle),
+    m_address(0x0e55)
 {
-
+    setTxMessage();
 }
 
 SpiMessage::SpiMessage(FunctionCode functionCode, int address, int length, QObject *parent) :
@@ -34,32 +40,17 @@ SpiMessage::SpiMessage(FunctionCode functionCode, int address, int length, QObje
     m_address(address),
     m_length(length)
 {
-    /*
-     * Read message structure in bytes:
-     *   Function
-     *   Starting Address Hi
-     *   Starting Address Lo
-     *   Quantity of Registers Hi
-     *   Quantity of Registers Lo
-     *   Error Check Lo
-     *   Error Check Hi
-     */
-
-
-    m_tx = new uint8_t[6];
-    m_tx[0] = functionCode;
-    m_tx[1] = address;
+    setTxMessage();
 }
 
-
-
 SpiMessage::SpiMessage(FunctionCode functionCode, int address, quint16 data, QObject *parent) :
     QObject{parent},
     m_functionCode(functionCode),
     m_address(address),
-    m_data(data)
+    m_data(1, data)
 {
     m_length = 1;
+    setTxMessage();
 }
 
 SpiMessage::SpiMessage(FunctionCode functionCode, int address, const QVector<quint16> &data, QObject *parent) :
@@ -69,85 +60,213 @@ SpiMessage::SpiMessage(FunctionCode functionCode, int address, const QVector<qui
     m_data(data)
 {
     m_length = data.length();
+    setTxMessage();
+}
+
+SpiMessage::SpiMessage(FunctionCode functionCode, int address, const QVector<quint16> &data, int bitCount, QObject *parent) :
+    QObject{parent},
+    m_functionCode(functionCode),
+    m_address(address),
+    m_data(data)
+{
+    m_length = bitCount;
+    setTxMessage();
 }
 
+SpiMessage::SpiMessage(FunctionCode functionCode, int address, const QByteArray &characters, QObject *parent) :
+    QObject{parent},
+    m_functionCode(functionCode),
+    m_address(address),
+    m_characters(characters.left(maxStringLength))
+{
+    m_length = m_characters.length();
+    setTxMessage();
+}
+
+SpiMessage::~SpiMessage()
+{
+
+}
+
+bool SpiMessage::isRetryable() const
+{
+    return m_functionCode != FunctionCode::WriteCharacter && m_functionCode != FunctionCode::WriteString;
+}
+
+bool SpiMessage::checkRxCrc(const uint8_t *rx) const
+{
+    return m_frame.checkRxCrc(rx);
+}
+
+bool SpiMessage::checkRxHeader(const uint8_t *rx) const
+{
+    if (isOnePhaseOperation() && !NeuronFrame::isIdleReply(rx)) {
+        const uint16_t *reg = (const uint16_t *)(rx + 2);
+        qCDebug(dcSpi()) << "Unexpected reply in one phase operation, function code" << rx[0] << QString("Length 0x%1, Register 0x%2").arg(rx[1], 0, 16).arg(*reg, 0, 16);
+    }
+    return m_frame.checkRxHeader(rx);
+}
+
+QVector<quint16> SpiMessage::parseResult(const uint8_t *rx) const
+{
+    QVector<quint16> result(m_frame.resultCount(rx));
+    memmove(result.data(), m_frame.resultData(rx), result.count() * sizeof(uint16_t));
+    return result;
+}
+
+QByteArray SpiMessage::parseCharacters(const uint8_t *rx) const
+{
+    if (m_functionCode != FunctionCode::ReadString) {
+        return QByteArray();
+    }
+    return QByteArray(m_frame.characterData(rx), m_frame.characterCount(rx));
+}
+
+int SpiMessage::piggybackedCharacter(const uint8_t *rx)
+{
+    return NeuronFrame::piggybackedCharacter(rx);
+}
 
-bool SpiMessage::checkRxCrc()
+int SpiMessage::idleStatus(const uint8_t *rx)
 {
-    return true;
+    return NeuronFrame::idleStatus(rx);
 }
 
 void SpiMessage::setTxMessage()
 {
-    if (m_functionCode == FunctionCode::WriteBit) {
-
-    } else if (m_functionCode == FunctionCode::ReadBit || m_functionCode == FunctionCode::ReadRegister) {
-        /*
-         * Read bit message structure in bytes:
-         *   Function
-         *   Starting Address Hi
-         *   Starting Address Lo
-         *   Quantity of Registers Hi
-         *   Quantity of Registers Lo
-         *   Error Check Lo
-         *   Error Check Hi
-         */
-        m_tx[0] = m_functionCode;
-        m_tx[1] = (m_address >> 8) & 0xff;
-        m_tx[2] = m_address & 0xff;
-        m_tx[3] = (m_length >> 8) & 0xff;
-        m_tx[4] = m_length & 0xff;
+    if (NeuronFrame::payloadLength(m_functionCode, m_length) < 0) {
+        // One phase operations carry the value in the length byte
+        m_frame = NeuronFrame(m_functionCode, m_address, m_data.isEmpty() ? 0 : (m_data.first() & 0xff));
+    } else if (m_functionCode == FunctionCode::WriteString) {
+        m_frame = NeuronFrame(m_functionCode, m_address, m_length, m_characters.constData(), m_characters.length());
+    } else {
+        m_frame = NeuronFrame(m_functionCode, m_address, m_length, m_data.constData(), m_data.length() * sizeof(quint16));
     }
 }
 
+SpiReply::SpiReply(QObject *parent) :
+    QObject{parent},
+    m_future(std::make_shared<Future>())
+{
 
+}
 
-SpiReply::SpiReply(QObject *parent) : QObject{parent}
+SpiReply::~SpiReply()
 {
-    m_rx = new uint8_t[256+2+40];
+
 }
 
 bool SpiReply::isFinished() const
 {
-    return m_isFinished;
+    return m_isFinished.loadAcquire() != 0;
 }
 
 QVector<quint16> SpiReply::result() const
 {
-    return QVector<quint16>();
+    return m_result;
 }
 
-void SpiReply::setFinished(bool isFinished)
+bool SpiReply::bit(int index) const
 {
-    m_isFinished = isFinished;
-    if (isFinished) {
-        emit finished();
-    }
+    return m_result.value(index >> 4) & (1 << (index & 15));
 }
 
-void SpiReply::setError(SpiError error, const QString &errorText)
+SpiResult SpiReply::toResult() const
 {
-    m_error = error;
-    m_errorString = errorText;
+    SpiResult result;
+    result.error = m_error;
+    result.errorString = m_errorString;
+    result.values = m_result;
+    result.characters = m_characters;
+    return result;
+}
 
-    if (error != SpiError::NoError) {
-        emit errorOccurred(error);
+void SpiReply::then(QObject *context, const std::function<void (const SpiResult &)> &callback)
+{
+    // The reply may have finished before anyone connected, the flag delivers exactly once
+    QSharedPointer<QAtomicInt> delivered(new QAtomicInt(0));
+    auto deliver = [this, delivered, callback] {
+        if (!delivered->testAndSetOrdered(0, 1)) {
+            return;
+        }
+        callback(toResult());
+        deleteLater();
+    };
+    connect(this, &SpiReply::finished, context, deliver);
+    if (isFinished()) {
+        QMetaObject::invokeMethod(context, deliver, Qt::QueuedConnection);
     }
 }
 
-void SpiReply::startTimeoutTimer()
+std::future<SpiResult> SpiReply::toFuture()
 {
-    startTimer(m_timeoutInterval);
+    // Nobody else may delete the reply, it is freed once the result is delivered
+    disconnect(this, &SpiReply::finished, nullptr, nullptr);
+    std::future<SpiResult> future = m_future->promise.get_future();
+    // Whoever comes second delivers the result and frees the reply
+    if (m_future->state.testAndSetOrdered(FutureStateNone, FutureStateRequested)) {
+        return future;
+    }
+    m_future->promise.set_value(m_future->result);
+    deleteLater();
+    return future;
 }
 
-uint8_t *SpiReply::rxData()
+void SpiReply::setResult(const QVector<quint16> &result)
 {
-    return m_rx;
+    m_result = result;
 }
 
-void SpiReply::timerEvent(QTimerEvent *event)
+QByteArray SpiReply::characters() const
 {
-    Q_UNUSED(event);
-    emit errorOccurred(SpiError::TimeoutError);
+    return m_characters;
+}
+
+void SpiReply::setCharacters(const QByteArray &characters)
+{
+    m_characters = characters;
+}
+
+QString SpiReply::errorString() const
+{
+    return m_errorString;
+}
+
+SpiError SpiReply::error() const
+{
+    return m_error;
+}
+
+void SpiReply::setFinished(bool isFinished)
+{
+    if (!isFinished) {
+        return;
+    }
+    // Only the first completion is reported, late timeouts or transfers are dropped
+    if (!m_isFinished.testAndSetOrdered(0, 1)) {
+        return;
+    }
+    // A receiver of finished() may delete the reply, only the shared future is used afterwards
+    std::shared_ptr<Future> future = m_future;
+    future->result = toResult();
     emit finished();
+    if (!future->state.testAndSetOrdered(FutureStateNone, FutureStateFinished)) {
+        // Taken over by toFuture(), nothing else is connected to finished()
+        future->promise.set_value(future->result);
+        deleteLater();
+    }
 }
+
+void SpiReply::setError(SpiError error, const QString &errorText)
+{
+    if (isFinished()) {
+        return;
+    }
+    m_error = error;
+    m_errorString = errorText;
+
+    if (error != SpiError::NoError) {
+        emit errorOccurred(error);
+    }
+}
+
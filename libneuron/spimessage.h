@@ -25,55 +25,82 @@
 
 #include <QObject>
 #include <QDebug>
+#include <QVector>
+#include <QByteArray>
+#include <QAtomicInt>
 
-#include "neurondefines.h"
+#include <functional>
+#include <future>
+#include <memory>
 
-enum SpiError {
-    NoError,
-    TimeoutError,
-    ProtocolError,
-    UnknownError
-};
+#include "neurondefines.h"
+#include "neuronframe.h"
 
 class SpiMessage : public QObject
 {
     Q_OBJECT
 public:
 
+    // Constructor for the idle message
     explicit SpiMessage(QObject *parent = nullptr);
     // Constructor for read messages
     SpiMessage(FunctionCode functionCode, int address, int length, QObject *parent = nullptr);
     // Constructor for write messages
     SpiMessage(FunctionCode functionCode, int address, quint16 data, QObject *parent = nullptr);
     SpiMessage(FunctionCode functionCode, int address, const QVector<quint16> &data, QObject *parent = nullptr);
+    // Constructor for WriteBits messages, the bits are packed into 16 bit words
+    SpiMessage(FunctionCode functionCode, int address, const QVector<quint16> &data, int bitCount, QObject *parent = nullptr);
+    // Constructor for WriteString messages
+    SpiMessage(FunctionCode functionCode, int address, const QByteArray &characters, QObject *parent = nullptr);
+    ~SpiMessage();
+
+    // Characters per WriteString and ReadString message, the second phase length must fit into one byte
+    static const int maxStringLength = 240;
 
-    void startTimeoutTimer();
     FunctionCode functionCode() const { return m_functionCode; }
-    uint8_t length() const { return m_data.length(); }
+    uint8_t length() const { return m_length; }
     uint16_t address() const { return m_address; }
-    uint8_t messageLength() const { return m_sizeOfNeuronSpiMessage; };
-    bool checkRxCrc();
-
-    uint8_t * txData() const { return m_tx; }
+    const QVector<quint16> &data() const { return m_data; }
+
+    bool isOnePhaseOperation() const { return m_frame.isOnePhaseOperation(); }
+    // Total number of bytes on the bus, first phase plus the second phase including its CRC
+    int messageLength() const { return m_frame.messageLength(); }
+    int secondPhaseLength() const { return m_frame.secondPhaseLength(); }
+    // Writes to the UART are not repeated, a retry could duplicate characters on the line
+    bool isRetryable() const;
+
+    bool checkRxCrc(const uint8_t *rx) const;
+    bool checkRxHeader(const uint8_t *rx) const;
+    QVector<quint16> parseResult(const uint8_t *rx) const;
+    QByteArray parseCharacters(const uint8_t *rx) const;
+    // Any reply may carry one received UART character in its first phase, returns -1 if there is none
+    static int piggybackedCharacter(const uint8_t *rx);
+    // Status flags of an idle reply, -1 if there are none, see NeuronFrame::idleStatus()
+    static int idleStatus(const uint8_t *rx);
+
+    const uint8_t *txData() const { return m_frame.txData(); }
+    // Encoded frame of the Qt free core
+    const NeuronFrame &frame() const { return m_frame; }
 
 private:
-    bool onePhaseOperation;
     FunctionCode m_functionCode = FunctionCode::Idle;
     uint16_t m_address = 0;
     uint8_t m_length = 0;
     QVector<quint16> m_data;
-
-    typedef struct {
-        uint8_t op;
-        uint8_t len;
-        uint16_t reg;
-        uint16_t crc;
-    } __attribute__((packed)) NeuronSpiMessage;
-    const int m_sizeOfNeuronSpiMessage = 6;
+    QByteArray m_characters;
+    NeuronFrame m_frame;
 
     void setTxMessage();
+};
+
+// Copy of a finished transaction, it outlives the reply
+struct SpiResult {
+    SpiError error = SpiError::NoError;
+    QString errorString;
+    QVector<quint16> values;
+    QByteArray characters;
 
-    uint8_t *m_tx;
+    bool isSuccess() const { return error == SpiError::NoError; }
 };
 
 class SpiReply: public QObject
@@ -81,25 +108,50 @@ class SpiReply: public QObject
     Q_OBJECT
 public:
     SpiReply(QObject *parent = nullptr);
+    ~SpiReply();
     bool isFinished() const;
     QVector<quint16> result() const;
+    // Bit of a ReadBit reply, the result holds them packed into 16 bit words
+    bool bit(int index) const;
+    SpiResult toResult() const;
+
+    // Both take over the reply, it is deleted with deleteLater() in its own thread once the
+    // result is delivered. The callback runs in the thread of the context object. The future
+    // is fulfilled by the thread finishing the reply and needs no event loop. toFuture()
+    // drops all other connections to finished(), the reply must not be used afterwards.
+    void then(QObject *context, const std::function<void(const SpiResult &result)> &callback);
+    std::future<SpiResult> toFuture();
+
+    // Characters read by a ReadString message
+    QByteArray characters() const;
     QString errorString() const;
     SpiError error() const;
-    void setResult(uint8_t result);
+    void setResult(const QVector<quint16> &result);
+    void setCharacters(const QByteArray &characters);
     void setFinished(bool isFinished);
     void setError(SpiError error, const QString &errorText);
 
-    void startTimeoutTimer();
-    uint8_t *rxData();
 private:
-    bool m_isFinished = false;
+    enum FutureState {
+        FutureStateNone,
+        FutureStateRequested, // toFuture() came first, setFinished() delivers and deletes
+        FutureStateFinished // setFinished() came first, toFuture() delivers and deletes
+    };
+
+    // Outlives the reply, the finishing thread touches nothing else once it emitted finished()
+    struct Future {
+        QAtomicInt state;
+        SpiResult result;
+        std::promise<SpiResult> promise;
+    };
+
+    // Set once by the Spi worker thread, a reply completes exactly one time
+    QAtomicInt m_isFinished;
+    std::shared_ptr<Future> m_future;
     QString m_errorString = "No error";
-    SpiError m_error;
-
-    const int m_timeoutInterval = 100; // In milliseconds
-    uint8_t *m_rx;
-
-    void timerEvent(QTimerEvent *event) override;
+    SpiError m_error = SpiError::NoError;
+    QVector<quint16> m_result;
+    QByteArray m_characters;
 
 signals:
     void errorOccurred(SpiError error);
@@ -0,0 +1,144 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <future>
+
+#include "neurontransport.h"
+
+// Completes a std::promise per request, the listener runs on the worker thread of the transport
+class ReadListener : public NeuronTransport::Listener
+{
+public:
+    struct Result {
+        SpiError error = SpiError::NoError;
+        std::vector<uint16_t> registers;
+    };
+
+    void requestFinished(const NeuronTransport::Request &request, const std::vector<void *> &sharedContexts, SpiError error, const uint8_t *rx) override
+    {
+        Result result;
+        result.error = error;
+        if (rx) {
+            const uint16_t *data = request.frame.resultData(rx);
+            result.registers.assign(data, data + request.frame.resultCount(rx));
+        }
+        static_cast<std::promise<Result> *>(request.context)->set_value(result);
+        for (size_t i = 0; i < sharedContexts.size(); i++) {
+            static_cast<std::promise<Result> *>(sharedContexts.at(i))->set_value(result);
+        }
+    }
+
+    void transferFailed(const NeuronFrame &frame, SpiError error) override
+    {
+        fprintf(stderr, "Transfer of register %u failed with error %d\n", frame.address(), static_cast<int>(error));
+    }
+
+    void unexpectedReply(const NeuronFrame &frame, const uint8_t *rx) override
+    {
+        (void)frame;
+        (void)rx;
+    }
+
+    void resynchronizationFinished(int failures, bool success, const uint16_t *versionRegisters, int count) override
+    {
+        (void)versionRegisters;
+        (void)count;
+        fprintf(stderr, "Resynchronized SPI bus after %d failed transfers: %s\n", failures, success ? "ok" : "failed");
+    }
+
+    void statusReported(uint8_t status) override
+    {
+        (void)status;
+    }
+
+    void speedChanged(int speed) override
+    {
+        (void)speed;
+    }
+};
+
+// Reads registers of one sub-node through the Qt free core, e.g. for minimal images
+int main(int argc, char *argv[])
+{
+    const char *device = "/dev/spidev0.1";
+    int speed = 0;
+    int option;
+    while ((option = getopt(argc, argv, "d:s:h")) != -1) {
+        switch (option) {
+        case 'd':
+            device = optarg;
+            break;
+        case 's':
+            speed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-s speed] register [count]\n", argv[0]);
+            return option == 'h' ? 0 : -1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-d device] [-s speed] register [count]\n", argv[0]);
+        return -1;
+    }
+    int address = atoi(argv[optind]);
+    int count = optind + 1 < argc ? atoi(argv[optind + 1]) : 1;
+    if (address < 0 || address > 0xffff || count < 1 || count > 125) {
+        fprintf(stderr, "Invalid register range\n");
+        return -1;
+    }
+
+    ReadListener listener;
+    NeuronTransport transport(&listener);
+    if (!transport.open(device)) {
+        perror(device);
+        return -1;
+    }
+    if (speed > 0 && !transport.setSpeed(speed)) {
+        perror("Cannot set speed");
+        return -1;
+    }
+    transport.start();
+
+    // Queued, retried and resynchronized by the same engine the Qt library uses
+    std::promise<ReadListener::Result> promise;
+    std::future<ReadListener::Result> future = promise.get_future();
+    NeuronTransport::Request request;
+    request.frame = NeuronFrame(FunctionCode::ReadRegister, address, count);
+    request.context = &promise;
+    transport.submit(request);
+    ReadListener::Result result = future.get();
+    transport.stop();
+
+    if (result.error != SpiError::NoError) {
+        fprintf(stderr, "Could not read registers %d to %d\n", address, address + count - 1);
+        return -1;
+    }
+    for (size_t i = 0; i < result.registers.size(); i++) {
+        printf("%d: %u\n", address + static_cast<int>(i), result.registers.at(i));
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+include(../libneuron.pri)
+
+TARGET = neuron-read
+
+CONFIG += console
+CONFIG -= app_bundle qt
+# The transport of the core runs its own worker thread
+CONFIG += thread
+
+INCLUDEPATH += $$top_srcdir/libneuron-core/
+LIBS += -L$$top_builddir/libneuron-core/ -lneuroncore
+
+SOURCES += \
+        main.cpp
+
+target.path = $$[QT_INSTALL_PREFIX]/bin
+INSTALLS += target
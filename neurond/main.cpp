@@ -0,0 +1,67 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+#include "neurondaemon.h"
+#include "neurontopology.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("neurond");
+    QCoreApplication::setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Owns the Neuron SPI buses and shares the process image with other processes");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("model", "Neuron model type, detected from the hardware if omitted");
+
+    QCommandLineOption nameOption(QStringList() << "n" << "name", "Shared memory object <name>", "name", NeuronSharedImage::defaultName);
+    parser.addOption(nameOption);
+
+    QCommandLineOption intervalOption(QStringList() << "i" << "interval", "Scan interval in <milliseconds>", "milliseconds", "10");
+    parser.addOption(intervalOption);
+
+    QCommandLineOption modbusPortOption(QStringList() << "p" << "modbus-port", "Serve the image via Modbus TCP on <port>, e.g. 502", "port", "0");
+    parser.addOption(modbusPortOption);
+
+    QCommandLineOption topologyOption(QStringList() << "t" << "topology", "SPI devices, interrupt lines and speeds of the sub-nodes from the JSON <file>", "file");
+    parser.addOption(topologyOption);
+    parser.process(app);
+
+    NeuronTopology topology = NeuronTopology::defaultTopology();
+    if (parser.isSet(topologyOption) && !topology.load(parser.value(topologyOption))) {
+        return -1;
+    }
+
+    NeuronDaemon daemon;
+    if (!daemon.init(topology, parser.positionalArguments().value(0), parser.value(nameOption), parser.value(intervalOption).toInt(), parser.value(modbusPortOption).toUShort())) {
+        qWarning() << "Could not start neurond";
+        return -1;
+    }
+    return app.exec();
+}
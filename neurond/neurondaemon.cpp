@@ -0,0 +1,145 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "neurondaemon.h"
+#include "modbusmap.h"
+#include "neuronspi.h"
+#include "neuronprocessimage.h"
+#include "neuronmodbustcpserver.h"
+
+#include <QDebug>
+
+NeuronDaemon::NeuronDaemon(QObject *parent) :
+    QObject{parent}
+{
+    qRegisterMetaType<QVector<NeuronSharedImage::Command> >();
+}
+
+NeuronDaemon::~NeuronDaemon()
+{
+    delete m_modbusServer;
+    if (m_commandReader) {
+        m_commandReader->requestInterruption();
+        m_commandReader->wait();
+    }
+}
+
+bool NeuronDaemon::init(const NeuronTopology &topology, const QString &neuronModel, const QString &sharedMemoryName, int scanInterval, quint16 modbusPort)
+{
+    m_spiList = NeuronSpi::initSubNodes(topology, neuronModel, &m_model, 2000, this);
+    if (m_spiList.isEmpty()) {
+        return false;
+    }
+
+    m_modbusMap = new ModbusMap(m_model, this);
+    foreach (NeuronSpi *spi, m_spiList) {
+        if (!spi->boardModel().isEmpty() && m_modbusMap->addBoard(spi->boardModel(), spi->boardGroup()) < 0) {
+            return false;
+        }
+    }
+    if (!m_modbusMap->loadModbusMap()) {
+        qWarning() << "Could not load modbus map of" << m_model;
+        return false;
+    }
+
+    // Every basic register is part of the image, clients pick what they need from the snapshot
+    m_processImage = new NeuronProcessImage(m_modbusMap, m_spiList, this);
+    m_processImage->setScanInterval(scanInterval);
+    int registersPerUnit = 0;
+    for (int i = 0; i < m_modbusMap->circuitCount(ModbusMapImage::CircuitTypeRegister); i++) {
+        ModbusMap::CircuitHandle handle = m_modbusMap->circuitHandle(ModbusMapImage::CircuitTypeRegister, i);
+        const ModbusMapImage::Entry &entry = m_modbusMap->circuit(handle);
+        if (entry.category == ModbusMapImage::CategoryBasic) {
+            m_processImage->watch(handle);
+            registersPerUnit = qMax(registersPerUnit, entry.registerAddress + entry.count);
+        }
+    }
+
+    if (!m_sharedImage.create(sharedMemoryName, m_model, m_spiList.count(), registersPerUnit)) {
+        return false;
+    }
+    qInfo() << "Publishing" << m_spiList.count() << "sub-nodes of the Neuron" << m_model << "with" << registersPerUnit << "registers each in" << sharedMemoryName;
+
+    connect(m_processImage, &NeuronProcessImage::cycleFinished, this, &NeuronDaemon::publish);
+    m_processImage->start();
+
+    m_commandReader = new CommandReader(&m_sharedImage, this);
+    connect(m_commandReader, &CommandReader::commandsReceived, this, &NeuronDaemon::onCommandsReceived, Qt::QueuedConnection);
+    m_commandReader->start();
+
+    if (modbusPort != 0) {
+        // Served from the shared image, writes take the same way as the ones of other processes
+        m_modbusServer = new NeuronModbusTcpServer(&m_sharedImage, m_modbusMap);
+        if (!m_modbusServer->listen(modbusPort)) {
+            return false;
+        }
+        qInfo() << "Serving Modbus TCP on port" << m_modbusServer->port();
+        m_modbusServer->start();
+    }
+    return true;
+}
+
+void NeuronDaemon::publish()
+{
+    m_sharedImage.beginPublish();
+    for (int unit = 1; unit <= m_sharedImage.unitCount(); unit++) {
+        m_sharedImage.publishUnit(unit, m_processImage->registers(unit, 0), qMin<int>(m_modbusMap->nodeRange(unit).lastRegister + 1, m_sharedImage.registersPerUnit()));
+    }
+    m_sharedImage.endPublish(m_processImage->cycles(), m_processImage->cycleTimestamp());
+}
+
+void NeuronDaemon::onCommandsReceived(const QVector<NeuronSharedImage::Command> &commands)
+{
+    // Staged like the outputs of the tasks, they are sent merged with the commit of the next cycle
+    foreach (const NeuronSharedImage::Command &command, commands) {
+        if (command.unit < 1 || command.unit > m_spiList.count()) {
+            qWarning() << "Command for unknown unit" << command.unit;
+            continue;
+        }
+        if (command.type == NeuronSharedImage::CommandWriteBit) {
+            m_processImage->writeBit(command.unit, command.address, command.value);
+        } else {
+            m_processImage->writeRegister(command.unit, command.address, command.value);
+        }
+    }
+}
+
+CommandReader::CommandReader(NeuronSharedImage *sharedImage, QObject *parent) :
+    QThread{parent},
+    m_sharedImage(sharedImage)
+{
+
+}
+
+void CommandReader::run()
+{
+    while (!isInterruptionRequested()) {
+        if (!m_sharedImage->waitForCommands(m_maxWait)) {
+            continue;
+        }
+        QVector<NeuronSharedImage::Command> commands(64);
+        commands.resize(m_sharedImage->takeCommands(commands.data(), commands.count()));
+        if (!commands.isEmpty()) {
+            emit commandsReceived(commands);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+// MIT License
+//
+// Copyright (c) 2023 Bernhard Trinnes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NEURONDAEMON_H
+#define NEURONDAEMON_H
+
+#include <QObject>
+#include <QThread>
+#include <QVector>
+
+#include "neuronsharedimage.h"
+#include "neurontopology.h"
+
+class ModbusMap;
+class NeuronSpi;
+class NeuronProcessImage;
+class CommandReader;
+class NeuronModbusTcpServer;
+
+// Owns the SPI buses, scans all basic registers and publishes them in the shared image.
+class NeuronDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NeuronDaemon(QObject *parent = nullptr);
+    ~NeuronDaemon() override;
+
+    // A modbus port of 0 disables the Modbus TCP server
+    bool init(const NeuronTopology &topology, const QString &neuronModel, const QString &sharedMemoryName, int scanInterval, quint16 modbusPort = 0);
+
+private:
+    QList<NeuronSpi *> m_spiList;
+    QString m_model;
+    ModbusMap *m_modbusMap = nullptr;
+    NeuronProcessImage *m_processImage = nullptr;
+    NeuronSharedImage m_sharedImage;
+    CommandReader *m_commandReader = nullptr;
+    NeuronModbusTcpServer *m_modbusServer = nullptr;
+
+    void publish();
+
+private slots:
+    void onCommandsReceived(const QVector<NeuronSharedImage::Command> &commands);
+};
+
+// Sleeps on the command futex of the shared image and hands the posted commands to the daemon
+class CommandReader : public QThread
+{
+    Q_OBJECT
+public:
+    explicit CommandReader(NeuronSharedImage *sharedImage, QObject *parent = nullptr);
+    void run() override;
+
+private:
+    NeuronSharedImage *m_sharedImage;
+    const int m_maxWait = 100; // In milliseconds, upper bound to notice interruption requests
+
+signals:
+    void commandsReceived(const QVector<NeuronSharedImage::Command> &commands);
+};
+
+Q_DECLARE_METATYPE(NeuronSharedImage::Command)
+
+#endif // NEURONDAEMON_H